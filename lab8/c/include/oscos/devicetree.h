@@ -2,6 +2,7 @@
 #define OSCOS_DEVICETREE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "oscos/libc/string.h"
@@ -170,4 +171,102 @@ typedef struct {
 fdt_read_reg_result_t fdt_read_reg(const fdt_prop_t *prop,
                                    fdt_n_address_size_cells_t n_cells);
 
+// Unflattened devicetree.
+//
+// The devicetree blob is expanded once by devicetree_init into a tree of nodes
+// allocated with the startup allocator. Names and property values point into
+// the devicetree blob, so property values are still big-endian.
+
+/// \brief A property of a node in the unflattened devicetree.
+typedef struct dt_prop_t {
+  const char *name;
+  const void *value;
+  uint32_t len;
+  const struct dt_prop_t *next;
+} dt_prop_t;
+
+/// \brief A node in the unflattened devicetree.
+typedef struct dt_node_t {
+  const char *name;
+  /// \brief The phandle of the node, or 0 if the node doesn't have one.
+  uint32_t phandle;
+  /// \brief The #address-cells and the #size-cells properties of the node,
+  ///        which apply to the reg properties of its children.
+  fdt_n_address_size_cells_t n_cells;
+  const struct dt_node_t *parent, *children, *next_sibling;
+  const dt_prop_t *props;
+} dt_node_t;
+
+/// \brief Expands to a for loop that loops over each child of the given node.
+///
+/// \param NODE The pointer to the node.
+/// \param CHILD_NAME The name of the variable for the child.
+#define DT_FOR_CHILD(NODE, CHILD_NAME)                                         \
+  for (const dt_node_t *CHILD_NAME = (NODE)->children; CHILD_NAME;             \
+       CHILD_NAME = CHILD_NAME->next_sibling)
+
+/// \brief Expands to a for loop that loops over each property of the given
+///        node.
+///
+/// \param NODE The pointer to the node.
+/// \param PROP_NAME The name of the variable for the property.
+#define DT_FOR_PROP(NODE, PROP_NAME)                                           \
+  for (const dt_prop_t *PROP_NAME = (NODE)->props; PROP_NAME;                  \
+       PROP_NAME = PROP_NAME->next)
+
+/// \brief Gets the root node of the devicetree.
+///
+/// The devicetree must have been successfully initialized.
+const dt_node_t *dt_get_root(void);
+
+/// \brief Gets the next node of the given node in pre-order.
+/// \return The next node, or NULL if \p node is the last node.
+const dt_node_t *dt_next_node(const dt_node_t *node);
+
+/// \brief Finds a node by its full path or by an alias.
+///
+/// A path component without a unit address matches a node whose name differs
+/// only in its unit address, e. g., "/memory" matches "/memory@0". A path not
+/// starting with '/' is resolved through the /aliases node.
+///
+/// \return The node, or NULL if it doesn't exist.
+const dt_node_t *dt_find_node_by_path(const char *path);
+
+/// \brief Finds a node by its phandle.
+/// \return The node, or NULL if no node has the phandle.
+const dt_node_t *dt_find_node_by_phandle(uint32_t phandle);
+
+/// \brief Finds the next node compatible with the given string.
+///
+/// \param from The node to start the search after, or NULL to search from the
+///             root node.
+/// \param compatible The string to match against the compatible properties.
+/// \return The node, or NULL if there are no more compatible nodes.
+const dt_node_t *dt_find_compatible_node(const dt_node_t *from,
+                                         const char *compatible);
+
+/// \brief Finds a property of a node by its name.
+/// \return The property, or NULL if the node doesn't have the property.
+const dt_prop_t *dt_find_prop(const dt_node_t *node, const char *name);
+
+/// \brief Returns whether or not the compatible property of a node contains
+///        the given string.
+bool dt_node_is_compatible(const dt_node_t *node, const char *compatible);
+
+/// \brief Reads a property holding a single 32-bit cell.
+/// \return Whether or not the property exists and has the right length.
+bool dt_read_u32(const dt_node_t *node, const char *name, uint32_t *value);
+
+/// \brief Reads an entry of the reg property of a node.
+///
+/// The entry is decoded using the #address-cells and the #size-cells
+/// properties of the parent node.
+///
+/// \param node The node. Must not be the root node.
+/// \param index The index of the entry.
+/// \param result Where to store the entry.
+/// \return Whether or not the entry exists.
+bool dt_read_reg(const dt_node_t *node, size_t index,
+                 fdt_read_reg_result_t *result);
+
 #endif
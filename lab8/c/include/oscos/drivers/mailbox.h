@@ -6,6 +6,9 @@
 
 #define MAILBOX_CHANNEL_PROPERTY_TAGS_ARM_TO_VC ((unsigned char)8)
 
+/// \brief The maximum size of a message in bytes.
+#define MAILBOX_MAX_MESSAGE_SIZE 1024
+
 typedef struct {
   uint32_t base, size;
 } arm_memory_t;
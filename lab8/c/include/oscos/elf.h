@@ -0,0 +1,88 @@
+/// \file include/oscos/elf.h
+/// \brief ELF64 executable loading.
+
+#ifndef OSCOS_ELF_H
+#define OSCOS_ELF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "oscos/fs/vfs.h"
+
+/// \brief ELF64 file header.
+typedef struct {
+  unsigned char e_ident[16];
+  uint16_t e_type;
+  uint16_t e_machine;
+  uint32_t e_version;
+  uint64_t e_entry;
+  uint64_t e_phoff;
+  uint64_t e_shoff;
+  uint32_t e_flags;
+  uint16_t e_ehsize;
+  uint16_t e_phentsize;
+  uint16_t e_phnum;
+  uint16_t e_shentsize;
+  uint16_t e_shnum;
+  uint16_t e_shstrndx;
+} elf64_ehdr_t;
+
+/// \brief ELF64 program header.
+typedef struct {
+  uint32_t p_type;
+  uint32_t p_flags;
+  uint64_t p_offset;
+  uint64_t p_vaddr;
+  uint64_t p_paddr;
+  uint64_t p_filesz;
+  uint64_t p_memsz;
+  uint64_t p_align;
+} elf64_phdr_t;
+
+#define ELFCLASS64 2
+#define ELFDATA2LSB 1
+#define ET_EXEC 2
+#define EM_AARCH64 183
+
+#define PT_LOAD 1
+
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+/// \brief The maximum number of loadable segments of an executable.
+#define ELF_MAX_LOAD_SEGMENTS 8
+
+/// \brief A loadable segment, widened to page boundaries.
+typedef struct {
+  void *start;
+  size_t len;
+  /// \brief The offset into the file at which the segment starts.
+  size_t file_offset;
+  /// \brief The number of bytes of the file in the segment. The rest of the
+  ///        segment is zero-filled.
+  size_t file_len;
+  /// \brief Bitwise OR of `PROT_*`.
+  int prot;
+} elf_load_segment_t;
+
+/// \brief The memory image of an executable.
+typedef struct {
+  void *entry;
+  size_t n_segments;
+  elf_load_segment_t segments[ELF_MAX_LOAD_SEGMENTS];
+} elf_image_t;
+
+/// \brief Reads the memory image of an ELF64 AArch64 executable.
+///
+/// The segments are sorted by address and do not overlap.
+///
+/// \param file The executable. Its file position is changed.
+/// \param image The memory image.
+/// \return 0 on success.
+/// \return -ENOEXEC if the file is not an ELF file.
+/// \return -EINVAL if the file is a malformed or unsupported ELF file.
+/// \return Other negative error numbers if the file cannot be read.
+int elf_read_image(struct file *file, elf_image_t *image);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef OSCOS_FS_VFS_H
 #define OSCOS_FS_VFS_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #include "oscos/uapi/fcntl.h" // O_* constants.
@@ -10,6 +11,9 @@ struct vnode {
   struct vnode_operations *v_ops;
   struct file_operations *f_ops;
   void *internal;
+  // The number of pages of the file in the page cache, including those being
+  // read in. Maintained by the page cache.
+  size_t n_cached_pages;
 };
 
 // file handle
@@ -24,6 +28,9 @@ struct mount {
   struct vnode *root;
   struct filesystem *fs;
   struct super_operations *s_ops;
+  // Whether or not every write to the file system fails with -EROFS, so that
+  // pages written through shared mappings can never be written back.
+  bool is_read_only;
   void *internal;
 };
 
@@ -56,6 +63,19 @@ struct vnode_operations {
   int (*mknod)(struct vnode *dir_node, struct vnode **target,
                const char *component_name, struct device *device);
   long (*get_size)(struct vnode *vnode);
+  // Optional. Checks if the vnode is a regular file. Vnodes without it, e.g.,
+  // device files, are never regular files. Only regular files can be mapped
+  // into memory.
+  bool (*is_regular)(struct vnode *vnode);
+  // Optional. Reads the page at the given page offset of a regular file into a
+  // page-sized buffer, zero-filling the part beyond the end of the file. File
+  // systems providing it have `read` go through the page cache.
+  int (*read_page)(struct vnode *vnode, size_t index, void *page);
+  // Optional. Gets the kernel virtual address of the page at the given page
+  // offset of a regular file whose data already lies page-aligned in memory
+  // that is never written, so that the page can be mapped read-only without
+  // copying. Fails for pages extending past the end of the file.
+  int (*direct_access)(struct vnode *vnode, size_t index, const void **page);
 };
 
 struct super_operations {
@@ -64,12 +84,21 @@ struct super_operations {
 
 extern struct mount rootfs;
 
+bool vfs_init(void);
+
+// Allocation of file handles. File systems should allocate the file handles
+// they return from `open` using these functions.
+struct file *vfs_alloc_file(void);
+void vfs_free_file(struct file *file);
+
 int register_filesystem(struct filesystem *fs);
 int register_device(struct device *dev);
 
 int vfs_open(const char *pathname, int flags, struct file **target);
 int vfs_open_relative(struct vnode *cwd, const char *pathname, int flags,
                       struct file **target);
+int vfs_open_vnode(struct vnode *vnode, struct file **target);
+bool vfs_is_regular(struct vnode *vnode);
 int vfs_close(struct file *file);
 int vfs_write(struct file *file, const void *buf, size_t len);
 int vfs_read(struct file *file, void *buf, size_t len);
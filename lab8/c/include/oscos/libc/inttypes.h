@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#define PRIu32 "u"
+#define PRIu64 "lu"
 #define PRIx32 "x"
 #define PRIx64 "lx"
 
@@ -0,0 +1,49 @@
+/// \file include/oscos/mem/cache.h
+/// \brief Cache maintenance.
+///
+/// Kernel and user memory is mapped as write-back cacheable normal memory. The
+/// VideoCore, however, does not snoop the caches of the ARM cores, so buffers
+/// shared with it must be cleaned before it reads them and invalidated before
+/// the CPU reads what it has written. Likewise, the instruction cache is not
+/// coherent with the data cache, so freshly written code must be synchronized
+/// before it is executed.
+
+#ifndef OSCOS_MEM_CACHE_H
+#define OSCOS_MEM_CACHE_H
+
+#include <stddef.h>
+
+/// \brief The cache line size of the Cortex-A53.
+///
+/// Buffers shared with non-coherent observers should be aligned to and sized in
+/// multiples of this, so that no unrelated data share their cache lines.
+#define CACHE_LINE_SIZE 64
+
+/// \brief Cleans the data cache lines covering a VA range to the point of
+///        coherency.
+///
+/// After this function returns, writes made by the CPU to the range are
+/// visible to non-coherent observers.
+void cache_clean_range(const void *start, size_t len);
+
+/// \brief Invalidates the data cache lines covering a VA range to the point of
+///        coherency.
+///
+/// After this function returns, the CPU observes writes made by non-coherent
+/// observers to the range. Cache lines only partially covered by the range are
+/// cleaned as well as invalidated, so that data outside of the range are not
+/// lost.
+void cache_invalidate_range(void *start, size_t len);
+
+/// \brief Cleans and invalidates the data cache lines covering a VA range to
+///        the point of coherency.
+void cache_clean_invalidate_range(const void *start, size_t len);
+
+/// \brief Makes the instruction cache coherent with the data cache for a VA
+///        range.
+///
+/// This must be called after writing instructions to memory and before
+/// executing them.
+void cache_sync_icache_range(const void *start, size_t len);
+
+#endif
@@ -10,6 +10,26 @@
 #include <stdalign.h>
 #include <stddef.h>
 
+/// \brief Usage statistics of a size class of the dynamic memory allocator.
+typedef struct {
+  /// \brief The slot size in bytes.
+  size_t slot_size;
+  /// \brief The number of allocation requests.
+  size_t n_allocs;
+  /// \brief The number of allocation requests served from the magazine.
+  size_t n_magazine_hits;
+  /// \brief The number of allocation requests that failed.
+  size_t n_failures;
+  /// \brief The number of frees.
+  size_t n_frees;
+  /// \brief The number of slabs, including the empty ones.
+  size_t n_slabs;
+  /// \brief The number of cached empty slabs.
+  size_t n_empty_slabs;
+  /// \brief The number of slots in the magazine.
+  size_t n_magazine_slots;
+} malloc_class_stats_t;
+
 /// \brief Initializes the dynamic memory allocator.
 void malloc_init(void);
 
@@ -27,4 +47,51 @@ void *malloc(size_t size)
     __attribute__((alloc_size(1), assume_aligned(alignof(max_align_t)), malloc,
                    malloc(free, 1)));
 
+/// \brief Gets the number of size classes of the dynamic memory allocator.
+size_t malloc_get_n_classes(void) __attribute__((const));
+
+/// \brief Gets the usage statistics of a size class.
+///
+/// \param class_id The size class ID. Must be less than the value returned by
+///                 size_t malloc_get_n_classes(void).
+malloc_class_stats_t malloc_get_class_stats(size_t class_id);
+
+// Object caches.
+
+/// \brief Object cache.
+///
+/// An object cache allocates objects of a single type, packed according to
+/// their exact size and alignment. Objects can optionally be initialized by a
+/// constructor when their backing memory is first obtained; objects must then
+/// be freed in their constructed state, so that they can be handed out again
+/// without re-initialization.
+typedef struct slab_cache_t obj_cache_t;
+
+/// \brief Creates an object cache.
+///
+/// \param name The name of the cache. Must outlive the cache.
+/// \param size The size of each object in bytes. Must be at most 4032.
+/// \param align The alignment of each object. Must be a power of 2 no greater
+///              than 64. Values less than `alignof(max_align_t)` are rounded up.
+/// \param ctor The constructor of the objects, or NULL.
+/// \return The object cache, or NULL if the request cannot be fulfilled.
+obj_cache_t *obj_cache_create(const char *name, size_t size, size_t align,
+                              void (*ctor)(void *obj));
+
+/// \brief Allocates an object from an object cache.
+/// \return The object, or NULL if the request cannot be fulfilled.
+void *obj_cache_alloc(obj_cache_t *cache)
+    __attribute__((assume_aligned(alignof(max_align_t))));
+
+/// \brief Frees an object to the object cache it was allocated from.
+///
+/// Passing the object to void free(void *) has the same effect.
+void obj_cache_free(obj_cache_t *cache, void *obj);
+
+/// \brief Calls a callback with the name and the usage statistics of each
+///        object cache.
+void obj_cache_for_each(void (*callback)(const char *name,
+                                         malloc_class_stats_t stats, void *arg),
+                        void *arg);
+
 #endif
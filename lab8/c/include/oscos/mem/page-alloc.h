@@ -6,12 +6,56 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "oscos/mem/types.h"
 
 #define PAGE_ORDER 12
 #define MAX_BLOCK_ORDER 18
 
+/// \brief Page descriptor.
+///
+/// Each page frame within the usable memory range has a page descriptor. The
+/// page frame allocator zero-initializes the page descriptors and otherwise
+/// leaves them to the users of the page frames.
+typedef struct {
+  /// \brief The reference count. Meaningful only if `PAGE_FLAG_SHARED` is set.
+  uint32_t refcnt;
+  /// \brief Bitwise OR of `PAGE_FLAG_*`.
+  uint32_t flags;
+  /// \brief The object the page holds data of, if any.
+  void *mapping;
+  /// \brief The page offset of the page within \ref mapping.
+  size_t index;
+} page_t;
+
+/// \brief The page is reference-counted by the shared page allocator.
+#define PAGE_FLAG_SHARED ((uint32_t)1 << 0)
+/// \brief The page is in the page cache and is modified since it was read in.
+#define PAGE_FLAG_DIRTY ((uint32_t)1 << 1)
+/// \brief The page is in the page cache or holds file data mapped in place, and
+///        the instruction cache holds no stale copy of its contents.
+#define PAGE_FLAG_ICACHE_CLEAN ((uint32_t)1 << 2)
+
+/// \brief The maximum order of blocks cached on the per-CPU page lists.
+#define PCP_MAX_ORDER 2
+
+/// \brief Usage statistics of the per-CPU page lists of a core.
+typedef struct {
+  /// \brief The number of allocation requests of order up to `PCP_MAX_ORDER`.
+  size_t n_allocs;
+  /// \brief The number of such requests served without refilling.
+  size_t n_hits;
+  /// \brief The number of frees of blocks of order up to `PCP_MAX_ORDER`.
+  size_t n_frees;
+  /// \brief The number of refills from the buddy system.
+  size_t n_refills;
+  /// \brief The number of drains to the buddy system.
+  size_t n_drains;
+  /// \brief The number of blocks currently on the list of each order.
+  size_t n_blocks[PCP_MAX_ORDER + 1];
+} page_alloc_pcp_stats_t;
+
 /// \brief Initializes the page frame allocator.
 ///
 /// After calling this function, the startup allocator should not be used.
@@ -25,7 +69,8 @@ spage_id_t alloc_pages(size_t order);
 
 /// \brief Allocates a block of page frames.
 ///
-/// This function is safe to call only within a critical section.
+/// This function is safe to call only within a critical section. It takes the
+/// allocator's own spinlocks, so the caller must not hold any of them.
 ///
 /// \param order The order of the block.
 /// \return The page number of the first page, or a negative number if the
@@ -38,7 +83,8 @@ void free_pages(page_id_t page);
 
 /// \brief Frees a block of page frames.
 ///
-/// This function is safe to call only within a critical section.
+/// This function is safe to call only within a critical section. It takes the
+/// allocator's own spinlocks, so the caller must not hold any of them.
 ///
 /// \param page The page number of the first page of the block.
 void free_pages_unlocked(page_id_t page);
@@ -57,12 +103,21 @@ void mark_pages(page_id_range_t range, bool is_avail);
 ///
 /// Note that the range can be arbitrary and doesn't need to be a block.
 ///
-/// This function is safe to call only within a critical section.
+/// This function is safe to call only within a critical section. It takes the
+/// allocator's own spinlocks, so the caller must not hold any of them.
 ///
 /// \param range The range of page frames to mark.
 /// \param is_avail The target reservation status.
 void mark_pages_unlocked(page_id_range_t range, bool is_avail);
 
+/// \brief Gets the usage statistics of the per-CPU page lists of a core.
+page_alloc_pcp_stats_t page_alloc_get_pcp_stats(size_t core_id);
+
+/// \brief Gets the page descriptor of a page frame.
+/// \return The page descriptor, or NULL if the page frame lies outside of the
+///         usable memory range.
+page_t *page_get(page_id_t page) __attribute__((pure));
+
 /// \brief Converts the given page ID into its corresponding physical address.
 pa_t page_id_to_pa(page_id_t page) __attribute__((pure));
 
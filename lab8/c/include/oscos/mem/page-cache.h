@@ -0,0 +1,85 @@
+/// \file include/oscos/mem/page-cache.h
+/// \brief Cache of file pages.
+///
+/// The page cache holds page frames containing file data, indexed by vnode and
+/// page offset within the file. A page in the cache is a shared page; the cache
+/// holds a reference to it, and so does every user of it, e.g., a mapping.
+///
+/// Pages are read in with the `read_page` vnode operation if the file system
+/// provides one, or through a file opened on the vnode otherwise. `vfs_read`
+/// goes through the cache for vnodes with a `read_page` operation or with any
+/// page in the cache, and `vfs_write` updates the cached pages of any vnode
+/// with some, as counted by `struct vnode::n_cached_pages`.
+
+#ifndef OSCOS_MEM_PAGE_CACHE_H
+#define OSCOS_MEM_PAGE_CACHE_H
+
+#include <stddef.h>
+
+#include "oscos/fs/vfs.h"
+#include "oscos/mem/types.h"
+
+/// \brief The number of pages above which unused pages are evicted.
+///
+/// Pages in use, e.g., mapped, are never evicted, so the cache may still grow
+/// beyond this.
+#ifndef PAGE_CACHE_MAX_PAGES
+#define PAGE_CACHE_MAX_PAGES 1024
+#endif
+
+/// \brief Usage statistics of the page cache.
+typedef struct {
+  /// \brief The number of pages in the cache.
+  size_t n_pages;
+  /// \brief The number of lookups served from the cache.
+  size_t n_hits;
+  /// \brief The number of lookups that read the page from the file.
+  size_t n_misses;
+  /// \brief The number of pages evicted.
+  size_t n_evictions;
+  /// \brief The number of pages written back to their files.
+  size_t n_write_backs;
+} page_cache_stats_t;
+
+/// \brief Gets the page caching a page of a file, reading it in on a miss.
+///
+/// The part of the page beyond the end of the file is zero-filled.
+///
+/// \param vnode The vnode of the file.
+/// \param index The page offset of the page within the file.
+/// \return The page number of the page, with a new reference for the caller,
+///         or a negative error number.
+spage_id_t page_cache_get_page(struct vnode *vnode, size_t index);
+
+/// \brief Marks a page in the cache as dirty, so that it is written back to
+///        its file by \ref page_cache_sync.
+void page_cache_mark_dirty(page_id_t page);
+
+/// \brief Reads from a file through the page cache.
+///
+/// This has the semantics of the `read` file operation, including advancing
+/// the file position.
+int page_cache_read(struct file *file, void *buf, size_t len);
+
+/// \brief Updates the cached pages of a file after it is written to.
+///
+/// Pages not in the cache are not read in.
+///
+/// \param vnode The vnode of the file.
+/// \param offset The offset at which the data are written.
+/// \param buf The data written.
+/// \param len The length of the data written.
+void page_cache_update(struct vnode *vnode, size_t offset, const void *buf,
+                       size_t len);
+
+/// \brief Writes back the dirty pages.
+///
+/// A dirty page stays dirty after being written back as long as it is in use,
+/// since it may still be written through a writable mapping. Clean pages stay
+/// in the cache until evicted to make room for other pages.
+void page_cache_sync(void);
+
+/// \brief Gets the usage statistics of the page cache.
+page_cache_stats_t page_cache_get_stats(void);
+
+#endif
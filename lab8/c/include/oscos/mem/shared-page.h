@@ -1,12 +1,27 @@
 #ifndef OSCOS_MEM_SHARED_PAGE_H
 #define OSCOS_MEM_SHARED_PAGE_H
 
+#include <stdbool.h>
+
 #include "oscos/mem/types.h"
 
 spage_id_t shared_page_alloc(void);
+spage_id_t shared_page_alloc_zeroed(void);
+spage_id_t shared_page_alloc_block(size_t order);
 size_t shared_page_getref(page_id_t page) __attribute__((pure));
 void shared_page_incref(page_id_t page);
 void shared_page_decref(page_id_t page);
 spage_id_t shared_page_clone_unshare(page_id_t page);
 
+/// \brief Takes a reference to a page frame not allocated by the page frame
+///        allocator, e.g., one in the initial ramdisk.
+///
+/// The first reference taken makes the page a shared page holding an extra
+/// reference that is never dropped. The page is therefore never freed, nor
+/// considered exclusively owned and written in place by CoW.
+///
+/// \return Whether or not the reference is taken. false if the page has no
+///         page descriptor.
+bool shared_page_ref_foreign(page_id_t page);
+
 #endif
@@ -7,6 +7,25 @@
 #include "oscos/uapi/sys/mman.h"
 #include "oscos/utils/rb.h"
 
+/// \brief The end of the user address space, which is mapped by TTBR0_EL1 with
+///        48-bit virtual addresses.
+#define VM_USER_VA_END ((uintptr_t)1 << 48)
+
+/// \brief The number of pages in the fault-around window.
+///
+/// On a translation fault, the unmapped pages in the naturally-aligned window
+/// of this many pages containing the faulting page are mapped as well, as long
+/// as they are in the same region. Must be a power of 2 not greater than 512.
+/// Setting this to 1 disables fault-around.
+#ifndef VM_FAULT_AROUND_PAGES
+#define VM_FAULT_AROUND_PAGES 16
+#endif
+
+_Static_assert((VM_FAULT_AROUND_PAGES & (VM_FAULT_AROUND_PAGES - 1)) == 0 &&
+                   VM_FAULT_AROUND_PAGES <= 512,
+               "VM_FAULT_AROUND_PAGES must be a power of 2 not greater than "
+               "512");
+
 /// \brief Converts a kernel space virtual address into its corresponding
 ///        physical address.
 pa_t kernel_va_to_pa(const void *va) __attribute__((const));
@@ -33,16 +52,45 @@ typedef struct {
     shared_file_t *backing_file;
     pa_t pa_base;
   };
+  /// \brief The offset into the backing file at which the region starts.
+  ///        Meaningful only for backed regions.
+  size_t file_offset;
+  /// \brief The number of bytes of the backing file mapped from
+  ///        \ref file_offset, or `SIZE_MAX` to map up to the end of the file.
+  ///        The rest of the region reads zero. Meaningful only for private
+  ///        backed regions.
+  size_t file_len;
   int prot;
+  /// \brief `MAP_SHARED` or `MAP_PRIVATE`. Meaningful only for backed regions.
+  ///
+  /// Pages of a shared region are the pages in the page cache, so writes to
+  /// them reach the backing file. Pages of a private region are private copies.
+  int flags;
 } mem_region_t;
 
 typedef struct {
   rb_node_t *root;
 } mem_regions_t;
 
+typedef struct {
+  size_t n_translation_faults;
+  size_t n_permission_faults;
+  /// \brief The number of pages mapped by fault-around, excluding the faulting
+  ///        pages.
+  size_t n_pages_faulted_around;
+  /// \brief The number of 2 MiB blocks mapped.
+  size_t n_blocks_mapped;
+} vm_fault_stats_t;
+
 typedef struct {
   mem_regions_t mem_regions;
   page_table_entry_t *pgd;
+  /// \brief The ASID tagged with the generation in which it is allocated.
+  ///
+  /// The lower 16 bits are the ASID, and the remaining bits are the
+  /// generation. 0 means that no ASID has been allocated yet.
+  uint64_t asid;
+  vm_fault_stats_t fault_stats;
 } vm_addr_space_t;
 
 typedef enum {
@@ -51,19 +99,81 @@ typedef enum {
   VM_MAP_PAGE_NOMEM
 } vm_map_page_result_t;
 
-void vm_mem_regions_insert_region(mem_regions_t *regions,
-                                  const mem_region_t *region);
+/// \brief Inserts a region.
+///
+/// On success, the region set takes ownership of the backing file of the
+/// region, if any. On failure, the caller keeps it.
+///
+/// \return 0 on success, -EINVAL if the region overlaps an existing one, or
+///         -ENOMEM if out of memory.
+int vm_mem_regions_insert_region(mem_regions_t *regions,
+                                 const mem_region_t *region);
 const mem_region_t *vm_mem_regions_find_region(const mem_regions_t *regions,
                                                void *va);
 
+/// \brief Initializes the virtual memory subsystem.
+///
+/// Must be called after the page frame allocator is initialized.
+///
+/// \return Whether or not the initialization succeeds.
+bool vm_init(void);
+
+/// \brief Initializes virtual memory on a secondary core.
+///
+/// Must be called by each secondary core on startup, after vm_init(void).
+void vm_init_secondary_core(void);
+
 vm_addr_space_t vm_new_addr_space(void);
 vm_addr_space_t vm_clone_addr_space(vm_addr_space_t addr_space);
 void vm_drop_addr_space(vm_addr_space_t pgd);
-vm_map_page_result_t vm_map_page(vm_addr_space_t *addr_space, void *va);
+
+/// \brief Handles a translation fault.
+///
+/// This function and \ref vm_handle_permission_fault may sleep waiting for
+/// file I/O. The caller must hold the `addr_space_lock` of the process owning
+/// the address space.
+vm_map_page_result_t vm_map_page(vm_addr_space_t *addr_space, void *va,
+                                 int access_mode);
 vm_map_page_result_t vm_handle_permission_fault(vm_addr_space_t *addr_space,
                                                 void *va, int access_mode);
+/// \brief Unmaps a range of an address space.
+///
+/// Regions and blocks straddling the boundaries of the range are split. Parts
+/// of the range not covered by any region are ignored.
+///
+/// \param addr_space The address space. Must be the current one.
+/// \param start_va The start address of the range. Must be page-aligned.
+/// \param len The length of the range. Must be a multiple of the page size.
+/// \return 0 on success, or -ENOMEM if out of memory, in which case the
+///         regions are kept, though some of their pages may have been unmapped
+///         and will be faulted in again on access.
+int vm_unmap_range(vm_addr_space_t *addr_space, void *start_va, size_t len);
+
+/// \brief Changes the protection of a range of an address space.
+///
+/// Regions and blocks straddling the boundaries of the range are split.
+///
+/// \param addr_space The address space. Must be the current one.
+/// \param start_va The start address of the range. Must be page-aligned.
+/// \param len The length of the range. Must be a multiple of the page size.
+/// \param prot The new protection.
+/// \return 0 on success, -ENOMEM if the range is not fully covered by regions
+///         or if out of memory, in which case the protection is left as is,
+///         or -EACCES if a shared mapping of a file on a read-only file
+///         system would become writable.
+int vm_protect_range(vm_addr_space_t *addr_space, void *start_va, size_t len,
+                     int prot);
+
+/// \brief Removes a region from an address space.
+///
+/// \param addr_space The address space. Must be the current one.
+/// \param start_va The start address of the region.
 bool vm_remove_region(vm_addr_space_t *addr_space, void *start_va);
-void vm_switch_to_addr_space(const vm_addr_space_t *addr_space);
+
+/// \brief Switches to an address space, allocating an ASID for it if needed.
+///
+/// No TLB maintenance is done unless the ASIDs run out.
+void vm_switch_to_addr_space(vm_addr_space_t *addr_space);
 
 void *vm_decide_mmap_addr(vm_addr_space_t addr_space, void *va, size_t len);
 
@@ -3,6 +3,16 @@
 
 #include <stdbool.h>
 
+// Memory attribute indices. These must agree with the value of MAIR_EL1 set by
+// `start.S`.
+#define ATTR_INDX_DEVICE_nGnRnE 0x0
+#define ATTR_INDX_NORMAL_NOCACHE 0x1
+#define ATTR_INDX_NORMAL_WB 0x2
+
+// Shareability.
+#define SH_NON_SHAREABLE 0x0
+#define SH_INNER_SHAREABLE 0x3
+
 typedef struct {
   unsigned _reserved0 : (50 - 48 + 1);
   unsigned ignored : (58 - 51 + 1);
@@ -0,0 +1,76 @@
+/// \file include/oscos/mem/zero-pool.h
+/// \brief Pool of pre-zeroed page frames.
+///
+/// The idle thread zeroes free page frames into the pool in the background, so
+/// that code paths needing zero-filled pages, e.g., anonymous page faults, do
+/// not have to zero them on the spot.
+
+#ifndef OSCOS_MEM_ZERO_POOL_H
+#define OSCOS_MEM_ZERO_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "oscos/mem/types.h"
+
+/// \brief The maximum number of page frames in the pool.
+#define ZERO_POOL_CAPACITY 32
+
+/// \brief How long refilling is held off after the page frame allocator runs
+///        out of memory, in seconds.
+#define ZERO_POOL_REFILL_BACKOFF_SECS 1
+
+/// \brief Usage statistics of the pool.
+typedef struct {
+  /// \brief The number of page frames in the pool.
+  size_t n_pages;
+  /// \brief The number of allocation requests.
+  size_t n_allocs;
+  /// \brief The number of allocation requests served from the pool.
+  size_t n_hits;
+  /// \brief The number of page frames zeroed into the pool.
+  size_t n_refills;
+  /// \brief The number of times the pool is drained to relieve memory
+  ///        pressure.
+  size_t n_drains;
+} zero_pool_stats_t;
+
+/// \brief Allocates a zero-filled page frame.
+///
+/// The page frame is taken from the pool if it is nonempty, or allocated from
+/// the page frame allocator and zeroed otherwise.
+///
+/// \return The page number of the page, or a negative number if the request
+///         cannot be fulfilled.
+spage_id_t alloc_zeroed_page(void);
+
+/// \brief Zeroes a free page frame into the pool.
+///
+/// This function is meant to be called by the idle thread.
+///
+/// \return Whether or not a page frame is added to the pool. false if the pool
+///         is full, if the page frame allocator is out of memory, or if it has
+///         run out of memory within the last
+///         `ZERO_POOL_REFILL_BACKOFF_SECS` seconds.
+bool zero_pool_refill(void);
+
+/// \brief Returns every page frame in the pool to the page frame allocator.
+///
+/// This function is called by the page frame allocator when it is out of
+/// memory. It is safe to call only within a critical section, and the caller
+/// must not hold any lock.
+void zero_pool_drain(void);
+
+/// \brief Gets the usage statistics of the pool.
+zero_pool_stats_t zero_pool_get_stats(void);
+
+/// \brief Fills a page with zeros.
+///
+/// The page is zeroed a cache line at a time using `dc zva` where permitted,
+/// which avoids reading the old contents into the cache. It must therefore be
+/// mapped as normal memory.
+///
+/// \param page The kernel virtual address of the page. Must be page-aligned.
+void zero_page(void *page);
+
+#endif
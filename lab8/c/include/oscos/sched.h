@@ -10,15 +10,13 @@
 #include "oscos/fs/vfs.h"
 #include "oscos/mem/types.h"
 #include "oscos/mem/vm.h"
+#include "oscos/sync.h"
+#include "oscos/utils/rb.h"
 #include "oscos/uapi/signal.h"
 #include "oscos/xcpt/trap-frame.h"
 
 #define N_FDS 16
 
-typedef struct thread_list_node_t {
-  struct thread_list_node_t *prev, *next;
-} thread_list_node_t;
-
 typedef struct {
   alignas(16) uint64_t words[2];
 } uint128_t;
@@ -38,6 +36,10 @@ typedef struct {
     };
     uint64_t regs[14];
   };
+  /// \brief The FP/SIMD context, allocated on the first FP/SIMD access.
+  ///
+  /// The context is switched lazily: it is only out of date while the thread
+  /// is running and owns the FP/SIMD registers of its core.
   thread_fp_simd_ctx_t *fp_simd_ctx;
 } thread_ctx_t;
 
@@ -52,14 +54,41 @@ typedef struct {
     bool is_stopped : 1;
     bool is_waken_up_by_signal : 1;
     bool is_handling_signal : 1;
+    bool is_idle : 1;
+    /// \brief Whether or not the thread is running on some core.
+    bool is_running : 1;
+    /// \brief Whether or not the thread has been killed while running on
+    ///        another core or holding a mutex. The thread exits once it is
+    ///        about to wait or return to user space without holding a mutex.
+    bool is_killed : 1;
   } status;
   page_id_t stack_page_id;
   struct process_t *process;
+  /// \brief The number of mutexes the thread holds.
+  size_t n_mutexes_held;
+  /// \brief The bit mask of the cores the thread may run on.
+  uint64_t affinity;
+  /// \brief The core whose run queue the thread is in, or the core the thread
+  ///        last ran on if it is not in a run queue.
+  size_t core_id;
+  /// \brief The nice value, from PRIO_MIN to PRIO_MAX - 1. A lower value
+  ///        gives the thread a larger share of CPU time.
+  int nice;
+  /// \brief The CPU time the thread has received, scaled by the inverse of its
+  ///        weight, relative to the run queue of its core.
+  uint64_t vruntime;
+  /// \brief The CPU time the thread has received, in timer counter ticks.
+  uint64_t cpu_time;
+  /// \brief The node linking the thread into a run queue, preallocated so that
+  ///        queueing never allocates memory. NULL for idle threads.
+  rb_node_t *run_queue_node;
 } thread_t;
 
 typedef struct process_t {
   size_t id;
   vm_addr_space_t addr_space;
+  /// \brief Serializes page fault handling, which may wait for file I/O.
+  mutex_t addr_space_lock;
   thread_t *main_thread;
   uint32_t pending_signals, blocked_signals;
   sighandler_t signal_handlers[32];
@@ -67,12 +96,98 @@ typedef struct process_t {
   shared_file_t *fds[N_FDS];
 } process_t;
 
+/// \brief Statistics of lazy FP/SIMD context switching.
+typedef struct {
+  /// \brief The number of FP/SIMD access traps taken.
+  size_t n_traps;
+  /// \brief The number of FP/SIMD contexts saved to memory.
+  size_t n_saves;
+  /// \brief The number of FP/SIMD contexts restored from memory.
+  size_t n_restores;
+  /// \brief The number of context switches from a thread with an FP/SIMD
+  ///        context that did not own the registers, each sparing a save.
+  size_t n_saves_avoided;
+  /// \brief The number of context switches to a thread whose FP/SIMD context
+  ///        was still live in the registers of the core, each sparing a
+  ///        restore.
+  size_t n_restores_avoided;
+} sched_fp_simd_stats_t;
+
+/// \brief Statistics of the run queue of a core.
+typedef struct {
+  /// \brief The number of threads waiting in the run queue.
+  size_t n_ready_threads;
+  /// \brief The number of threads moved to the core from other cores.
+  size_t n_migrations;
+  /// \brief The number of threads stolen by the core when it would otherwise
+  ///        be idle.
+  size_t n_steals;
+  /// \brief The number of threads pulled by the core to balance the loads.
+  size_t n_balance_pulls;
+  /// \brief The number of times a woken-up thread preempted the running
+  ///        thread.
+  size_t n_wakeup_preemptions;
+  /// \brief The time the core has spent idle, in timer counter ticks.
+  uint64_t idle_time;
+} sched_run_queue_stats_t;
+
 /// \brief Initializes the scheduler and creates the idle thread.
 ///
 /// \return true if the initialization succeeds.
 /// \return false if the initialization fails due to memory shortage.
 bool sched_init(void);
 
+/// \brief Creates an idle thread for a secondary core.
+///
+/// The thread is not put into the run queue. Its kernel stack pointer is set to
+/// the end of its stack.
+///
+/// \return The idle thread, or NULL if out of memory.
+thread_t *sched_create_idle_thread(void);
+
+/// \brief Names the current thread the given idle thread.
+///
+/// This function is called by each secondary core on startup.
+void sched_init_secondary_core(thread_t *idle_thread);
+
+/// \brief Checks if the current core has threads to run, either in its own run
+///        queue or to steal from another core.
+bool sched_has_ready_threads(void);
+
+/// \brief Pulls threads from the busiest core to the current one once every few
+///        calls.
+///
+/// This function is called on every scheduler tick.
+void sched_balance_load(void);
+
+/// \brief Sets the cores the main thread of a process may run on.
+///
+/// \param process The process.
+/// \param affinity The bit mask of the cores. Bits of nonexistent cores are
+///                 ignored.
+/// \return 0 on success, or -EINVAL if no online core is allowed.
+int sched_set_affinity(process_t *process, uint64_t affinity);
+
+/// \brief Gets the statistics of the run queue of a core.
+sched_run_queue_stats_t sched_get_run_queue_stats(size_t core_id);
+
+/// \brief Sets the nice value of the main thread of a process.
+///
+/// \param process The process.
+/// \param nice The nice value. It is clamped to the range from PRIO_MIN to
+///             PRIO_MAX - 1.
+void sched_set_nice(process_t *process, int nice);
+
+/// \brief Gets the nice value of the main thread of a process.
+int sched_get_nice(const process_t *process);
+
+/// \brief Calls a function on every process in ascending order of PID.
+///
+/// The function is called within a critical section and must not sleep.
+void sched_for_each_process(void (*callback)(const process_t *process,
+                                             void *arg),
+                            void *arg);
+
 /// \brief Creates a thread.
 ///
 /// \param task The task to execute in the new thread.
@@ -89,6 +204,19 @@ noreturn void thread_exit(void);
 /// \brief Gets the current thread.
 thread_t *current_thread(void);
 
+/// \brief Makes the current thread the owner of the FP/SIMD registers.
+///
+/// This function is called when the current thread traps on an FP/SIMD access.
+/// It allocates a zeroed FP/SIMD context on the first access and loads the
+/// context of the current thread into the registers of the core.
+///
+/// \return true if the operation succeeds.
+/// \return false if the operation fails due to memory shortage.
+bool thread_fp_simd_acquire(void);
+
+/// \brief Gets the statistics of lazy FP/SIMD context switching.
+sched_fp_simd_stats_t sched_get_fp_simd_stats(void);
+
 /// \brief Creates a process and name the current thread the main thread of the
 ///        process.
 ///
@@ -96,25 +224,17 @@ thread_t *current_thread(void);
 /// \return false if the process creation fails due to memory shortage.
 bool process_create(void);
 
-/// \brief Executes the first ever user program on the current process.
-///
-/// This function jumps to the user program and does not return if the operation
-/// succeeds. If the operation fails due to memory shortage, this function
-/// returns.
-///
-/// \param text_file The user program.
-void exec_first(struct file *text_file);
-
 /// \brief Executes a user program on the current process.
 ///
-/// This function jumps to the user program and does not return if the operation
-/// succeeds. If the operation fails due to memory shortage, this function
-/// returns.
+/// The user program is either an ELF64 AArch64 executable or a raw binary
+/// loaded at address 0. The address space of the current process is replaced.
 ///
-/// The text_page_id field of the current process must be valid.
+/// This function jumps to the user program and does not return if the operation
+/// succeeds. If the user program cannot be loaded, this function returns.
 ///
-/// \param text_file The user program.
-void exec(struct file *text_file);
+/// \param text_file The user program. This function takes ownership of it.
+/// \return A negative error number if the operation fails.
+int exec(struct file *text_file);
 
 /// \brief Forks the current process.
 process_t *fork(const extended_trap_frame_t *trap_frame);
@@ -132,6 +252,10 @@ void suspend_to_wait_queue(thread_list_node_t *wait_queue);
 /// \brief Wake up every thread in the given wait queue.
 void wake_up_all_threads_in_wait_queue(thread_list_node_t *wait_queue);
 
+/// \brief Wake up the first thread in the given wait queue, if any.
+/// \return Whether or not a thread is woken up.
+bool wake_up_first_thread_in_wait_queue(thread_list_node_t *wait_queue);
+
 /// \brief Gets a process by its PID.
 process_t *get_process_by_id(size_t pid);
 
@@ -0,0 +1,23 @@
+/// \file include/oscos/smp.h
+/// \brief Bring-up of the secondary cores.
+///
+/// The firmware parks the secondary cores in a loop that polls the spin table,
+/// one 64-bit release address per core starting at physical address 0xd8. A
+/// core jumps to the address once it becomes non-zero.
+
+#ifndef OSCOS_SMP_H
+#define OSCOS_SMP_H
+
+#include <stddef.h>
+
+/// \brief Starts the secondary cores.
+///
+/// Each secondary core gets an idle thread of its own and joins scheduling. The
+/// boot core must be holding the kernel lock, and the scheduler and the
+/// virtual memory subsystem must have been initialized.
+void smp_start_secondary_cores(void);
+
+/// \brief Gets the number of cores that have joined scheduling.
+size_t smp_get_n_online_cores(void);
+
+#endif
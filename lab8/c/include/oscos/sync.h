@@ -0,0 +1,103 @@
+/// \file include/oscos/sync.h
+/// \brief Sleeping synchronization primitives.
+///
+/// Unlike the spinlocks in `oscos/utils/lock.h`, these put a waiting thread to
+/// sleep on a wait queue, so that they can be held across long operations,
+/// e.g., storage I/O, with interrupts enabled. They must only be used in thread
+/// context with interrupts unmasked. Like the wait queues themselves, their
+/// state is protected by the kernel lock and local interrupt masking.
+///
+/// Waiting is not interruptible by signals: a signal arriving meanwhile is
+/// handled on the way back to user space.
+
+#ifndef OSCOS_SYNC_H
+#define OSCOS_SYNC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct thread_list_node_t {
+  struct thread_list_node_t *prev, *next;
+} thread_list_node_t;
+
+/// \brief Static initializer of an empty wait queue.
+#define WAIT_QUEUE_INIT(QUEUE) {.prev = &(QUEUE), .next = &(QUEUE)}
+
+/// \brief Mutex.
+///
+/// A thread holding a mutex is not killed until it releases all the mutexes it
+/// holds, so that the protected data are never left inconsistent.
+typedef struct {
+  bool is_locked;
+  thread_list_node_t wait_queue;
+} mutex_t;
+
+/// \brief Static initializer of a mutex.
+#define MUTEX_INIT(MUTEX)                                                      \
+  {.is_locked = false, .wait_queue = WAIT_QUEUE_INIT((MUTEX).wait_queue)}
+
+/// \brief Counting semaphore.
+typedef struct {
+  size_t count;
+  thread_list_node_t wait_queue;
+} semaphore_t;
+
+/// \brief Static initializer of a semaphore.
+#define SEMAPHORE_INIT(SEMAPHORE, COUNT)                                       \
+  {.count = (COUNT), .wait_queue = WAIT_QUEUE_INIT((SEMAPHORE).wait_queue)}
+
+/// \brief Condition variable.
+typedef struct {
+  thread_list_node_t wait_queue;
+} condvar_t;
+
+/// \brief Static initializer of a condition variable.
+#define CONDVAR_INIT(CONDVAR)                                                  \
+  {.wait_queue = WAIT_QUEUE_INIT((CONDVAR).wait_queue)}
+
+/// \brief Initializes a mutex as unlocked.
+void mutex_init(mutex_t *mutex);
+
+/// \brief Acquires a mutex, sleeping until it is available.
+void mutex_lock(mutex_t *mutex);
+
+/// \brief Tries to acquire a mutex without sleeping.
+/// \return Whether or not the mutex is acquired.
+bool mutex_trylock(mutex_t *mutex);
+
+/// \brief Releases a mutex held by the current thread.
+void mutex_unlock(mutex_t *mutex);
+
+/// \brief Initializes a semaphore.
+/// \param count The initial count.
+void semaphore_init(semaphore_t *semaphore, size_t count);
+
+/// \brief Decrements a semaphore, sleeping until its count is positive.
+void semaphore_down(semaphore_t *semaphore);
+
+/// \brief Tries to decrement a semaphore without sleeping.
+/// \return Whether or not the semaphore is decremented.
+bool semaphore_trydown(semaphore_t *semaphore);
+
+/// \brief Increments a semaphore, waking up the threads waiting on it.
+void semaphore_up(semaphore_t *semaphore);
+
+/// \brief Initializes a condition variable.
+void condvar_init(condvar_t *condvar);
+
+/// \brief Atomically releases a mutex and sleeps on a condition variable, then
+///        reacquires the mutex.
+///
+/// Wakeups may be spurious, so the caller must recheck its condition.
+///
+/// \param condvar The condition variable.
+/// \param mutex The mutex, which the current thread must hold.
+void condvar_wait(condvar_t *condvar, mutex_t *mutex);
+
+/// \brief Wakes up a thread waiting on a condition variable, if any.
+void condvar_signal(condvar_t *condvar);
+
+/// \brief Wakes up every thread waiting on a condition variable.
+void condvar_broadcast(condvar_t *condvar);
+
+#endif
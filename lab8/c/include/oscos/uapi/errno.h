@@ -3,8 +3,10 @@
 #define ESRCH 3
 #define EINTR 4
 #define EIO 5
+#define ENOEXEC 8
 #define EBADF 9
 #define ENOMEM 12
+#define EACCES 13
 #define EBUSY 16
 #define EEXIST 17
 #define ENODEV 19
@@ -6,6 +6,10 @@
 #define PROT_WRITE 2
 #define PROT_EXEC 4
 
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+
 #define MAP_FAILED ((void *)-1)
 
 #endif
@@ -0,0 +1,11 @@
+#ifndef OSCOS_UAPI_SYS_RESOURCE_H
+#define OSCOS_UAPI_SYS_RESOURCE_H
+
+#define PRIO_PROCESS 0
+#define PRIO_PGRP 1
+#define PRIO_USER 2
+
+#define PRIO_MIN (-20)
+#define PRIO_MAX 20
+
+#endif
@@ -23,5 +23,10 @@
 #define SYS_ioctl 19
 #define SYS_sync 20
 #define SYS_sigreturn 21
+#define SYS_munmap 22
+#define SYS_mprotect 23
+#define SYS_sched_setaffinity 24
+#define SYS_setpriority 25
+#define SYS_getpriority 26
 
 #endif
@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 
+/// \brief The number of cores.
+#define N_CORES 4
+
 size_t get_core_id(void);
 
 #endif
@@ -0,0 +1,31 @@
+/// \file include/oscos/utils/kernel-lock.h
+/// \brief The kernel lock.
+///
+/// The kernel lock serializes kernel code across cores. A core acquires it on
+/// every exception taken from EL0 and releases it right before returning to
+/// EL0, and the idle thread releases it while waiting for interrupts. Kernel
+/// code therefore always runs with the lock held, so critical sections only
+/// have to keep out ISRs of the same core.
+///
+/// The lock is a ticket lock, so that cores acquire it in FIFO order. It must
+/// only be used with the data cache enabled, since exclusive accesses to
+/// device memory are not supported.
+
+#ifndef OSCOS_UTILS_KERNEL_LOCK_H
+#define OSCOS_UTILS_KERNEL_LOCK_H
+
+/// \brief Acquires the kernel lock.
+///
+/// This function clobbers x9–x12 and lr only, so that it can be called from
+/// exception vectors before the system call arguments are consumed. It must be
+/// called with interrupts masked and the lock not already held by the current
+/// core.
+void kernel_lock_acquire(void);
+
+/// \brief Releases the kernel lock.
+///
+/// This function clobbers x9–x12 and lr only. It must be called with
+/// interrupts masked.
+void kernel_lock_release(void);
+
+#endif
@@ -0,0 +1,388 @@
+/// \file include/oscos/utils/lock.h
+/// \brief Spinlocks, reader-writer locks and sequence locks.
+///
+/// The kernel is preempted by the timer interrupt, and a thread preempted while
+/// holding a spinlock would leave the other threads spinning, possibly with the
+/// kernel lock held (see `oscos/utils/kernel-lock.h`), so that it could never
+/// run again. Locks must therefore be held with interrupts masked: use the
+/// irqsave variants unless interrupts are already masked, and never call a
+/// function that may schedule while holding a lock.
+///
+/// All locks are valid when zero-initialized. Initializing a lock with its init
+/// function additionally names it for the statistics, which are collected when
+/// `LOCK_ENABLE_STATS` is defined.
+
+#ifndef OSCOS_UTILS_LOCK_H
+#define OSCOS_UTILS_LOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "oscos/utils/critical-section.h"
+
+/// \brief Statistics of a lock.
+typedef struct lock_stats_t {
+  /// \brief The name of the lock.
+  const char *name;
+  /// \brief The number of times the lock was acquired.
+  uint64_t n_acquisitions;
+  /// \brief The number of acquisitions that had to wait.
+  uint64_t n_contended;
+  /// \brief The total time spent waiting for the lock, in core timer ticks.
+  uint64_t wait_ticks;
+  /// \brief The total time the lock was held exclusively, in core timer
+  ///        ticks.
+  uint64_t hold_ticks;
+  /// \brief The longest time the lock was held exclusively, in core timer
+  ///        ticks.
+  uint64_t max_hold_ticks;
+  /// \brief The next registered lock.
+  struct lock_stats_t *next;
+} lock_stats_t;
+
+/// \brief Ticket spinlock.
+///
+/// Waiters are served in FIFO order, so that no core starves.
+typedef struct {
+  union {
+    uint32_t word;
+    struct {
+      /// \brief The ticket being served.
+      uint16_t owner;
+      /// \brief The next ticket to hand out.
+      uint16_t next;
+    };
+  };
+#ifdef LOCK_ENABLE_STATS
+  lock_stats_t stats;
+  uint64_t acquired_at;
+#endif
+} spinlock_t;
+
+/// \brief Reader-writer spinlock.
+///
+/// Any number of readers or a single writer can hold the lock. Readers are
+/// preferred, so the lock suits data that are rarely written.
+typedef struct {
+  /// \brief Bit 31 is set while a writer holds the lock. The rest count the
+  ///        readers.
+  uint32_t word;
+#ifdef LOCK_ENABLE_STATS
+  lock_stats_t stats;
+  uint64_t acquired_at;
+#endif
+} rwlock_t;
+
+/// \brief Sequence lock.
+///
+/// Writers serialize on a spinlock and bump the sequence number before and
+/// after writing. Readers never block writers: they read optimistically and
+/// retry if the sequence number is odd or has changed.
+typedef struct {
+  spinlock_t lock;
+  uint32_t seq;
+} seqlock_t;
+
+#define RWLOCK_WRITER_BIT ((uint32_t)1 << 31)
+
+// Statistics hooks. No-ops unless `LOCK_ENABLE_STATS` is defined.
+
+#ifdef LOCK_ENABLE_STATS
+
+void lock_stats_register(lock_stats_t *stats, const char *name);
+uint64_t lock_stats_now(void);
+void lock_stats_record_acquisition(lock_stats_t *stats, bool is_contended,
+                                   uint64_t wait_start);
+void lock_stats_record_release(lock_stats_t *stats, uint64_t acquired_at);
+
+#define LOCK_STATS_WAIT_START(VAR) const uint64_t VAR = lock_stats_now()
+#define LOCK_STATS_ACQUIRED(LOCK, IS_CONTENDED, WAIT_START)                    \
+  do {                                                                         \
+    lock_stats_record_acquisition(&(LOCK)->stats, (IS_CONTENDED),              \
+                                  (WAIT_START));                               \
+  } while (0)
+#define LOCK_STATS_HOLD_START(LOCK)                                            \
+  do {                                                                         \
+    (LOCK)->acquired_at = lock_stats_now();                                    \
+  } while (0)
+#define LOCK_STATS_HOLD_END(LOCK)                                              \
+  do {                                                                         \
+    lock_stats_record_release(&(LOCK)->stats, (LOCK)->acquired_at);            \
+  } while (0)
+
+#else
+
+#define LOCK_STATS_WAIT_START(VAR) const uint64_t VAR = 0
+#define LOCK_STATS_ACQUIRED(LOCK, IS_CONTENDED, WAIT_START)                    \
+  do {                                                                         \
+    (void)(IS_CONTENDED);                                                      \
+    (void)(WAIT_START);                                                        \
+  } while (0)
+#define LOCK_STATS_HOLD_START(LOCK)                                            \
+  do {                                                                         \
+  } while (0)
+#define LOCK_STATS_HOLD_END(LOCK)                                              \
+  do {                                                                         \
+  } while (0)
+
+#endif
+
+// Spinlock.
+
+/// \brief Initializes a spinlock.
+/// \param name The name of the lock in the statistics.
+void spin_lock_init(spinlock_t *lock, const char *name);
+
+/// \brief Acquires a spinlock. Interrupts must be masked.
+static inline void spin_lock(spinlock_t *const lock) {
+  LOCK_STATS_WAIT_START(wait_start);
+
+  uint32_t old_val, tmp, status;
+  __asm__ __volatile__("   prfm pstl1strm, %3\n"
+                       // Take a ticket.
+                       "1: ldaxr %w0, %3\n"
+                       "   add %w1, %w0, %w4\n"
+                       "   stxr %w2, %w1, %3\n"
+                       "   cbnz %w2, 1b\n"
+                       // Done if our ticket is being served.
+                       "   eor %w1, %w0, %w0, ror 16\n"
+                       "   cbz %w1, 3f\n"
+                       // Otherwise, wait for it. The exclusive load arms the
+                       // monitor, so that the release wakes us up from wfe.
+                       "   sevl\n"
+                       "2: wfe\n"
+                       "   ldaxrh %w2, %3\n"
+                       "   eor %w1, %w2, %w0, lsr 16\n"
+                       "   cbnz %w1, 2b\n"
+                       "3:"
+                       : "=&r"(old_val), "=&r"(tmp), "=&r"(status),
+                         "+Q"(lock->word)
+                       : "r"(UINT32_C(1) << 16)
+                       : "memory");
+
+  LOCK_STATS_ACQUIRED(lock, (uint16_t)old_val != (uint16_t)(old_val >> 16),
+                      wait_start);
+  LOCK_STATS_HOLD_START(lock);
+}
+
+/// \brief Tries to acquire a spinlock without waiting. Interrupts must be
+///        masked.
+/// \return Whether or not the lock is acquired.
+static inline bool spin_trylock(spinlock_t *const lock) {
+  uint32_t val, status;
+  __asm__ __volatile__("1: ldaxr %w0, %2\n"
+                       "   eor %w1, %w0, %w0, ror 16\n"
+                       "   cbnz %w1, 2f\n"
+                       "   add %w0, %w0, %w3\n"
+                       "   stxr %w1, %w0, %2\n"
+                       "   cbnz %w1, 1b\n"
+                       "2:"
+                       : "=&r"(val), "=&r"(status), "+Q"(lock->word)
+                       : "r"(UINT32_C(1) << 16)
+                       : "memory");
+
+  if (status != 0)
+    return false;
+
+  LOCK_STATS_ACQUIRED(lock, false, 0);
+  LOCK_STATS_HOLD_START(lock);
+  return true;
+}
+
+/// \brief Releases a spinlock.
+static inline void spin_unlock(spinlock_t *const lock) {
+  LOCK_STATS_HOLD_END(lock);
+
+  // Only the holder writes the ticket being served.
+  const uint16_t owner = lock->owner;
+  __asm__ __volatile__("stlrh %w1, %0"
+                       : "=Q"(lock->owner)
+                       : "r"((uint32_t)owner + 1)
+                       : "memory");
+}
+
+/// \brief Masks interrupts and acquires a spinlock.
+/// \return The saved interrupt mask, to pass to spin_unlock_irqrestore.
+static inline uint64_t spin_lock_irqsave(spinlock_t *const lock) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+  spin_lock(lock);
+  return daif_val;
+}
+
+/// \brief Releases a spinlock and restores the interrupt mask.
+static inline void spin_unlock_irqrestore(spinlock_t *const lock,
+                                          const uint64_t daif_val) {
+  spin_unlock(lock);
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+// Reader-writer lock.
+
+/// \brief Initializes a reader-writer lock.
+/// \param name The name of the lock in the statistics.
+void rwlock_init(rwlock_t *lock, const char *name);
+
+/// \brief Acquires a reader-writer lock for reading. Interrupts must be masked.
+static inline void read_lock(rwlock_t *const lock) {
+  LOCK_STATS_WAIT_START(wait_start);
+
+  uint32_t val, status, is_contended = 0;
+  __asm__ __volatile__("   b 2f\n"
+                       "1: mov %w2, 1\n"
+                       "   wfe\n"
+                       // Wait for the writer, if any, and count us in.
+                       "2: ldaxr %w0, %3\n"
+                       "   tbnz %w0, 31, 1b\n"
+                       "   add %w0, %w0, 1\n"
+                       "   stxr %w1, %w0, %3\n"
+                       "   cbnz %w1, 2b"
+                       : "=&r"(val), "=&r"(status), "+r"(is_contended),
+                         "+Q"(lock->word)
+                       :
+                       : "memory");
+
+  LOCK_STATS_ACQUIRED(lock, is_contended, wait_start);
+}
+
+/// \brief Releases a reader-writer lock held for reading.
+static inline void read_unlock(rwlock_t *const lock) {
+  uint32_t val, status;
+  __asm__ __volatile__("1: ldxr %w0, %2\n"
+                       "   sub %w0, %w0, 1\n"
+                       "   stlxr %w1, %w0, %2\n"
+                       "   cbnz %w1, 1b"
+                       : "=&r"(val), "=&r"(status), "+Q"(lock->word)
+                       :
+                       : "memory");
+}
+
+/// \brief Acquires a reader-writer lock for writing. Interrupts must be masked.
+static inline void write_lock(rwlock_t *const lock) {
+  LOCK_STATS_WAIT_START(wait_start);
+
+  uint32_t val, status, is_contended = 0;
+  __asm__ __volatile__("   b 2f\n"
+                       "1: mov %w2, 1\n"
+                       "   wfe\n"
+                       // Wait for the lock to become free and take it.
+                       "2: ldaxr %w0, %3\n"
+                       "   cbnz %w0, 1b\n"
+                       "   stxr %w1, %w4, %3\n"
+                       "   cbnz %w1, 2b"
+                       : "=&r"(val), "=&r"(status), "+r"(is_contended),
+                         "+Q"(lock->word)
+                       : "r"(RWLOCK_WRITER_BIT)
+                       : "memory");
+
+  LOCK_STATS_ACQUIRED(lock, is_contended, wait_start);
+  LOCK_STATS_HOLD_START(lock);
+}
+
+/// \brief Releases a reader-writer lock held for writing.
+static inline void write_unlock(rwlock_t *const lock) {
+  LOCK_STATS_HOLD_END(lock);
+
+  __asm__ __volatile__("stlr wzr, %0" : "=Q"(lock->word) : : "memory");
+}
+
+/// \brief Masks interrupts and acquires a reader-writer lock for reading.
+/// \return The saved interrupt mask, to pass to read_unlock_irqrestore.
+static inline uint64_t read_lock_irqsave(rwlock_t *const lock) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+  read_lock(lock);
+  return daif_val;
+}
+
+/// \brief Releases a reader-writer lock held for reading and restores the
+///        interrupt mask.
+static inline void read_unlock_irqrestore(rwlock_t *const lock,
+                                          const uint64_t daif_val) {
+  read_unlock(lock);
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+/// \brief Masks interrupts and acquires a reader-writer lock for writing.
+/// \return The saved interrupt mask, to pass to write_unlock_irqrestore.
+static inline uint64_t write_lock_irqsave(rwlock_t *const lock) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+  write_lock(lock);
+  return daif_val;
+}
+
+/// \brief Releases a reader-writer lock held for writing and restores the
+///        interrupt mask.
+static inline void write_unlock_irqrestore(rwlock_t *const lock,
+                                           const uint64_t daif_val) {
+  write_unlock(lock);
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+// Sequence lock.
+
+/// \brief Initializes a sequence lock.
+/// \param name The name of the lock in the statistics.
+void seqlock_init(seqlock_t *lock, const char *name);
+
+/// \brief Begins a read-side critical section of a sequence lock.
+/// \return The sequence number to pass to read_seqretry.
+static inline uint32_t read_seqbegin(const seqlock_t *const lock) {
+  uint32_t seq;
+  while ((seq = *(const volatile uint32_t *)&lock->seq) & 1) {
+    __asm__ __volatile__("yield");
+  }
+  __asm__ __volatile__("dmb ishld" : : : "memory");
+  return seq;
+}
+
+/// \brief Ends a read-side critical section of a sequence lock.
+/// \return Whether or not a writer has intervened, in which case the data read
+///         may be inconsistent and must be read again.
+static inline bool read_seqretry(const seqlock_t *const lock,
+                                 const uint32_t seq) {
+  __asm__ __volatile__("dmb ishld" : : : "memory");
+  return *(const volatile uint32_t *)&lock->seq != seq;
+}
+
+/// \brief Acquires a sequence lock for writing. Interrupts must be masked.
+static inline void write_seqlock(seqlock_t *const lock) {
+  spin_lock(&lock->lock);
+  *(volatile uint32_t *)&lock->seq = lock->seq + 1;
+  __asm__ __volatile__("dmb ishst" : : : "memory");
+}
+
+/// \brief Releases a sequence lock held for writing.
+static inline void write_sequnlock(seqlock_t *const lock) {
+  __asm__ __volatile__("dmb ishst" : : : "memory");
+  *(volatile uint32_t *)&lock->seq = lock->seq + 1;
+  spin_unlock(&lock->lock);
+}
+
+/// \brief Masks interrupts and acquires a sequence lock for writing.
+/// \return The saved interrupt mask, to pass to write_sequnlock_irqrestore.
+static inline uint64_t write_seqlock_irqsave(seqlock_t *const lock) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+  write_seqlock(lock);
+  return daif_val;
+}
+
+/// \brief Releases a sequence lock held for writing and restores the interrupt
+///        mask.
+static inline void write_sequnlock_irqrestore(seqlock_t *const lock,
+                                              const uint64_t daif_val) {
+  write_sequnlock(lock);
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+/// \brief Calls a callback on the statistics of every named lock.
+///
+/// Does nothing unless `LOCK_ENABLE_STATS` is defined.
+void lock_stats_for_each(void (*callback)(const lock_stats_t *stats,
+                                          void *arg),
+                         void *arg);
+
+#endif
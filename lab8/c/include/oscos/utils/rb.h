@@ -5,14 +5,20 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-// typedef enum { RB_NC_BLACK, RB_NC_RED } rb_node_colour_t;
+typedef enum { RB_NC_BLACK, RB_NC_RED } rb_node_colour_t;
 
 typedef struct rb_node_t {
-  // rb_node_colour_t colour;
-  struct rb_node_t *children[2] /*, **parent */;
+  struct rb_node_t *children[2];
+  rb_node_colour_t colour;
   alignas(16) unsigned char payload[];
 } rb_node_t;
 
+/// \brief The maximum height of a tree.
+///
+/// The height of a red-black tree with n nodes is at most 2 log2(n + 1), and
+/// there cannot be more than 2^48 nodes in the address space.
+#define RB_MAX_HEIGHT 96
+
 rb_node_t *rb_clone(const rb_node_t *root, size_t size,
                     bool (*cloner)(void *dst, const void *src),
                     void (*deleter)(void *payload));
@@ -32,9 +38,23 @@ const void *rb_successor(const rb_node_t *root, const void *restrict key,
 bool rb_insert(rb_node_t **root, size_t size, const void *restrict item,
                int (*compar)(const void *, const void *, void *), void *arg);
 
+/// \brief Inserts a node allocated by the caller, with its payload set.
+///
+/// Unlike rb_insert, this function never allocates memory. The tree must not
+/// hold an item equal to the payload of the node.
+void rb_insert_node(rb_node_t **root, rb_node_t *node,
+                    int (*compar)(const void *, const void *, void *),
+                    void *arg);
+
 void rb_delete(rb_node_t **root, const void *restrict key,
                int (*compar)(const void *, const void *, void *), void *arg);
 
+/// \brief Removes the node holding an item from a tree without freeing it.
+/// \return The node, or NULL if there is none.
+rb_node_t *rb_remove_node(rb_node_t **root, const void *restrict key,
+                          int (*compar)(const void *, const void *, void *),
+                          void *arg);
+
 void rb_drop(rb_node_t *root, void (*deleter)(void *payload));
 
 #endif
@@ -75,7 +75,7 @@ static int _console_dev_read(struct file *const file, void *const buf,
 
 static int _console_dev_open(struct vnode *const file_node,
                              struct file **const target) {
-  struct file *const file_handle = malloc(sizeof(struct file));
+  struct file *const file_handle = vfs_alloc_file();
   if (!file_handle)
     return -ENOMEM;
 
@@ -89,7 +89,7 @@ static int _console_dev_open(struct vnode *const file_node,
 }
 
 static int _console_dev_close(struct file *const file) {
-  free(file);
+  vfs_free_file(file);
   return 0;
 }
 
@@ -1,19 +1,142 @@
 #include "oscos/devicetree.h"
 
-#include <stddef.h>
+#include "oscos/libc/stdlib.h"
+#include "oscos/mem/startup-alloc.h"
 
 static const char *_dtb_start = NULL;
 
+static const dt_node_t *_dt_root;
+/// \brief The nodes with phandles sorted by their phandles.
+static const dt_node_t **_dt_phandle_index;
+static size_t _dt_n_phandles;
+
+static const fdt_item_t *_fdt_get_root_node(void) {
+  return (const fdt_item_t *)(_dtb_start +
+                              rev_u32(((const fdt_header_t *)_dtb_start)
+                                          ->off_dt_struct));
+}
+
+static uint32_t _dt_prop_to_u32(const dt_prop_t *const prop) {
+  return rev_u32(*(const uint32_t *)prop->value);
+}
+
+/// \brief Expands a node of the devicetree blob and all of its descendants.
+///
+/// \param fdt_node The node in the devicetree blob.
+/// \param parent The parent of the node, or NULL if the node is the root node.
+/// \param result Where to store the expanded node.
+/// \return The item following the node in the devicetree blob, or NULL if
+///         memory allocation fails.
+static const fdt_item_t *_dt_unflatten_rec(const fdt_item_t *const fdt_node,
+                                           const dt_node_t *const parent,
+                                           dt_node_t **const result) {
+  dt_node_t *const node = startup_alloc(sizeof(dt_node_t));
+  if (!node)
+    return NULL;
+
+  *node = (dt_node_t){.name = FDT_NODE_NAME(fdt_node),
+                      .phandle = 0,
+                      .n_cells = {.n_address_cells = 2, .n_size_cells = 1},
+                      .parent = parent,
+                      .children = NULL,
+                      .next_sibling = NULL,
+                      .props = NULL};
+
+  const dt_prop_t **next_prop = &node->props;
+  const dt_node_t **next_child = &node->children;
+
+  const fdt_item_t *item;
+  for (item = FDT_ITEMS_START(fdt_node); !FDT_ITEM_IS_END(item);) {
+    if (FDT_TOKEN(item) == FDT_BEGIN_NODE) {
+      dt_node_t *child;
+      const fdt_item_t *const next_item = _dt_unflatten_rec(item, node, &child);
+      if (!next_item)
+        return NULL;
+      *next_child = child;
+      next_child = &child->next_sibling;
+      item = next_item;
+    } else {
+      if (FDT_TOKEN(item) == FDT_PROP) {
+        const fdt_prop_t *const fdt_prop = (const fdt_prop_t *)item->payload;
+
+        dt_prop_t *const prop = startup_alloc(sizeof(dt_prop_t));
+        if (!prop)
+          return NULL;
+
+        *prop = (dt_prop_t){.name = FDT_PROP_NAME(fdt_prop),
+                            .value = FDT_PROP_VALUE(fdt_prop),
+                            .len = FDT_PROP_VALUE_LEN(fdt_prop),
+                            .next = NULL};
+        *next_prop = prop;
+        next_prop = &prop->next;
+
+        if (prop->len == sizeof(uint32_t)) {
+          if (strcmp(prop->name, "#address-cells") == 0) {
+            node->n_cells.n_address_cells = _dt_prop_to_u32(prop);
+          } else if (strcmp(prop->name, "#size-cells") == 0) {
+            node->n_cells.n_size_cells = _dt_prop_to_u32(prop);
+          } else if (strcmp(prop->name, "phandle") == 0 ||
+                     (strcmp(prop->name, "linux,phandle") == 0 &&
+                      node->phandle == 0)) {
+            node->phandle = _dt_prop_to_u32(prop);
+          }
+        }
+      }
+      item = fdt_next_item(item);
+    }
+  }
+
+  if (node->phandle != 0) {
+    _dt_n_phandles++;
+  }
+
+  *result = node;
+  return item + 1;
+}
+
+static int _dt_cmp_nodes_by_phandle(const dt_node_t *const *const n1,
+                                    const dt_node_t *const *const n2) {
+  return (*n1)->phandle < (*n2)->phandle   ? -1
+         : (*n1)->phandle > (*n2)->phandle ? 1
+                                           : 0;
+}
+
+/// \brief Expands the devicetree blob and builds the phandle index.
+/// \return Whether or not memory allocation succeeds.
+static bool _dt_unflatten(void) {
+  _dt_n_phandles = 0;
+  dt_node_t *root;
+  if (!_dt_unflatten_rec(_fdt_get_root_node(), NULL, &root))
+    return false;
+  _dt_root = root;
+
+  _dt_phandle_index = startup_alloc(_dt_n_phandles * sizeof(dt_node_t *));
+  if (!_dt_phandle_index)
+    return false;
+
+  size_t i = 0;
+  for (const dt_node_t *node = _dt_root; node; node = dt_next_node(node)) {
+    if (node->phandle != 0) {
+      _dt_phandle_index[i++] = node;
+    }
+  }
+  qsort(_dt_phandle_index, _dt_n_phandles, sizeof(dt_node_t *),
+        (int (*)(const void *, const void *))_dt_cmp_nodes_by_phandle);
+
+  return true;
+}
+
 bool devicetree_init(const void *const dtb_start) {
   // TODO: More thoroughly validate the DTB.
 
   if (rev_u32(((const fdt_header_t *)dtb_start)->magic) == 0xd00dfeed) {
     _dtb_start = dtb_start;
-    return true;
-  } else {
-    _dtb_start = NULL;
-    return false;
+    if (_dt_unflatten())
+      return true;
   }
+
+  _dtb_start = NULL;
+  return false;
 }
 
 bool devicetree_is_init(void) { return _dtb_start; }
@@ -75,11 +198,7 @@ _fdt_traverse_rec(const fdt_item_t *const node,
 }
 
 void fdt_traverse(fdt_traverse_callback_t *const callback, void *const arg) {
-  const fdt_item_t *const root_node =
-      (const fdt_item_t *)(_dtb_start +
-                           rev_u32(((const fdt_header_t *)_dtb_start)
-                                       ->off_dt_struct));
-  _fdt_traverse_rec(root_node, NULL, callback, arg);
+  _fdt_traverse_rec(_fdt_get_root_node(), NULL, callback, arg);
 }
 
 fdt_n_address_size_cells_t
@@ -105,10 +224,8 @@ fdt_get_n_address_size_cells(const fdt_item_t *const node) {
                                       .n_size_cells = n_size_cells};
 }
 
-fdt_read_reg_result_t fdt_read_reg(const fdt_prop_t *const prop,
-                                   const fdt_n_address_size_cells_t n_cells) {
-  const uint32_t *arr = (const uint32_t *)FDT_PROP_VALUE(prop);
-
+static fdt_read_reg_result_t
+_read_reg_cells(const uint32_t *arr, const fdt_n_address_size_cells_t n_cells) {
   uintmax_t address = 0;
   bool address_overflow = false;
   for (uint32_t i = 0; i < n_cells.n_address_cells; i++) {
@@ -127,3 +244,167 @@ fdt_read_reg_result_t fdt_read_reg(const fdt_prop_t *const prop,
                                  .address_overflow = address_overflow,
                                  .size_overflow = size_overflow};
 }
+
+fdt_read_reg_result_t fdt_read_reg(const fdt_prop_t *const prop,
+                                   const fdt_n_address_size_cells_t n_cells) {
+  return _read_reg_cells((const uint32_t *)FDT_PROP_VALUE(prop), n_cells);
+}
+
+const dt_node_t *dt_get_root(void) { return _dt_root; }
+
+const dt_node_t *dt_next_node(const dt_node_t *node) {
+  if (node->children)
+    return node->children;
+
+  for (; node; node = node->parent) {
+    if (node->next_sibling)
+      return node->next_sibling;
+  }
+  return NULL;
+}
+
+/// \brief Finds a child of a node by a path component.
+///
+/// \param component The path component. Need not be NUL-terminated.
+/// \param len The length of the path component.
+static const dt_node_t *_dt_find_child(const dt_node_t *const node,
+                                       const char *const component,
+                                       const size_t len) {
+  bool has_unit_address = false;
+  for (size_t i = 0; i < len; i++) {
+    if (component[i] == '@') {
+      has_unit_address = true;
+      break;
+    }
+  }
+
+  DT_FOR_CHILD(node, child) {
+    if (strncmp(child->name, component, len) == 0 &&
+        (child->name[len] == '\0' ||
+         (!has_unit_address && child->name[len] == '@')))
+      return child;
+  }
+  return NULL;
+}
+
+/// \brief Finds a node by a path relative to another node.
+static const dt_node_t *_dt_find_node_by_path_from(const dt_node_t *node,
+                                                   const char *path) {
+  while (node && *path) {
+    if (*path == '/') {
+      path++;
+      continue;
+    }
+
+    const char *const slash = strchr(path, '/');
+    const size_t len = slash ? (size_t)(slash - path) : strlen(path);
+    node = _dt_find_child(node, path, len);
+    path += len;
+  }
+  return node;
+}
+
+const dt_node_t *dt_find_node_by_path(const char *const path) {
+  if (*path != '/') { // Alias.
+    const dt_node_t *const aliases = dt_find_node_by_path("/aliases");
+    if (!aliases)
+      return NULL;
+
+    const char *const slash = strchr(path, '/');
+    const size_t alias_len = slash ? (size_t)(slash - path) : strlen(path);
+
+    const dt_prop_t *alias = NULL;
+    DT_FOR_PROP(aliases, prop) {
+      if (strncmp(prop->name, path, alias_len) == 0 &&
+          prop->name[alias_len] == '\0') {
+        alias = prop;
+        break;
+      }
+    }
+    if (!(alias && *(const char *)alias->value == '/'))
+      return NULL;
+
+    const dt_node_t *const node = dt_find_node_by_path(alias->value);
+    return node && slash ? _dt_find_node_by_path_from(node, slash) : node;
+  }
+
+  return _dt_find_node_by_path_from(_dt_root, path);
+}
+
+const dt_node_t *dt_find_node_by_phandle(const uint32_t phandle) {
+  size_t l = 0, r = _dt_n_phandles;
+  while (l < r) {
+    const size_t m = l + (r - l) / 2;
+    const uint32_t m_phandle = _dt_phandle_index[m]->phandle;
+    if (m_phandle == phandle) {
+      return _dt_phandle_index[m];
+    } else if (m_phandle < phandle) {
+      l = m + 1;
+    } else {
+      r = m;
+    }
+  }
+  return NULL;
+}
+
+const dt_node_t *dt_find_compatible_node(const dt_node_t *const from,
+                                         const char *const compatible) {
+  for (const dt_node_t *node = from ? dt_next_node(from) : _dt_root; node;
+       node = dt_next_node(node)) {
+    if (dt_node_is_compatible(node, compatible))
+      return node;
+  }
+  return NULL;
+}
+
+const dt_prop_t *dt_find_prop(const dt_node_t *const node,
+                              const char *const name) {
+  DT_FOR_PROP(node, prop) {
+    if (strcmp(prop->name, name) == 0)
+      return prop;
+  }
+  return NULL;
+}
+
+bool dt_node_is_compatible(const dt_node_t *const node,
+                           const char *const compatible) {
+  const dt_prop_t *const prop = dt_find_prop(node, "compatible");
+  if (!prop)
+    return false;
+
+  // The compatible property is a list of NUL-terminated strings.
+  const char *const value = prop->value;
+  for (size_t i = 0; i < prop->len; i += strlen(value + i) + 1) {
+    if (strcmp(value + i, compatible) == 0)
+      return true;
+  }
+  return false;
+}
+
+bool dt_read_u32(const dt_node_t *const node, const char *const name,
+                 uint32_t *const value) {
+  const dt_prop_t *const prop = dt_find_prop(node, name);
+  if (!(prop && prop->len == sizeof(uint32_t)))
+    return false;
+
+  *value = _dt_prop_to_u32(prop);
+  return true;
+}
+
+bool dt_read_reg(const dt_node_t *const node, const size_t index,
+                 fdt_read_reg_result_t *const result) {
+  const dt_prop_t *const prop = dt_find_prop(node, "reg");
+  if (!prop)
+    return false;
+
+  const fdt_n_address_size_cells_t n_cells = node->parent->n_cells;
+  const size_t entry_size =
+      (n_cells.n_address_cells + n_cells.n_size_cells) * sizeof(uint32_t);
+  if (entry_size == 0 || (index + 1) * entry_size > prop->len)
+    return false;
+
+  *result = _read_reg_cells(
+      (const uint32_t *)((const char *)prop->value + index * entry_size),
+      n_cells);
+  return true;
+}
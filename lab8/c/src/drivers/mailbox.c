@@ -3,7 +3,11 @@
 #include <stdalign.h>
 
 #include "oscos/drivers/board.h"
+#include "oscos/libc/string.h"
+#include "oscos/mem/cache.h"
 #include "oscos/mem/vm.h"
+#include "oscos/panic.h"
+#include "oscos/utils/critical-section.h"
 
 #define MAILBOX_REG_BASE ((void *)((char *)PERIPHERAL_BASE + 0xb880))
 
@@ -29,14 +33,29 @@ typedef struct {
 #define TAG_REQUEST_CODE ((uint32_t)0x00000000)
 #define END_TAG ((uint32_t)0x00000000)
 
+// The VideoCore doesn't snoop the caches of the ARM cores, so messages are
+// passed through a bounce buffer that shares its cache lines with nothing else.
+alignas(CACHE_LINE_SIZE) static uint32_t
+    _mailbox_buf[MAILBOX_MAX_MESSAGE_SIZE / sizeof(uint32_t)];
+
 void mailbox_init(void) {
   // No-op.
 }
 
 void mailbox_call(uint32_t message[], const unsigned char channel) {
+  const size_t message_len = message[0];
+  if (message_len > MAILBOX_MAX_MESSAGE_SIZE)
+    PANIC("mailbox: Message too long");
+
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  memcpy(_mailbox_buf, message, message_len);
+  cache_clean_invalidate_range(_mailbox_buf, message_len);
+
   PERIPHERAL_WRITE_BARRIER();
 
-  const uint32_t mailbox_write_data = kernel_va_to_pa(message) | channel;
+  const uint32_t mailbox_write_data = kernel_va_to_pa(_mailbox_buf) | channel;
 
   while (MAILBOX_REGS[1].status & MAILBOX_STATUS_FULL_MASK)
     ;
@@ -52,6 +71,13 @@ void mailbox_call(uint32_t message[], const unsigned char channel) {
   }
 
   PERIPHERAL_READ_BARRIER();
+
+  // Discard any lines speculatively fetched while the VideoCore was writing the
+  // response.
+  cache_invalidate_range(_mailbox_buf, message_len);
+  memcpy(message, _mailbox_buf, message_len);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
 }
 
 uint32_t mailbox_get_board_revision(void) {
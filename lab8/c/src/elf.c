@@ -0,0 +1,109 @@
+#include "oscos/elf.h"
+
+#include <stdbool.h>
+
+#include "oscos/libc/string.h"
+#include "oscos/mem/page-alloc.h"
+#include "oscos/mem/vm.h"
+#include "oscos/uapi/errno.h"
+#include "oscos/uapi/sys/mman.h"
+#include "oscos/uapi/unistd.h"
+#include "oscos/utils/align.h"
+
+/// \brief Reads from a file at the given offset.
+/// \return The number of bytes read, which is less than \p len only at the end
+///         of the file, or a negative error number.
+static long _elf_read_at(struct file *const file, const uint64_t offset,
+                         void *const buf, const size_t len) {
+  const long seek_result = vfs_lseek64(file, offset, SEEK_SET);
+  if (seek_result < 0)
+    return seek_result;
+
+  size_t n_bytes_read = 0;
+  while (n_bytes_read < len) {
+    const int n_bytes_just_read =
+        vfs_read(file, (char *)buf + n_bytes_read, len - n_bytes_read);
+    if (n_bytes_just_read < 0)
+      return n_bytes_just_read;
+    if (n_bytes_just_read == 0)
+      break;
+
+    n_bytes_read += n_bytes_just_read;
+  }
+
+  return n_bytes_read;
+}
+
+static bool _elf_check_ehdr(const elf64_ehdr_t *const ehdr) {
+  return ehdr->e_ident[4] == ELFCLASS64 && ehdr->e_ident[5] == ELFDATA2LSB &&
+         ehdr->e_ident[6] == 1 && // EV_CURRENT.
+         ehdr->e_type == ET_EXEC && ehdr->e_machine == EM_AARCH64 &&
+         ehdr->e_phentsize == sizeof(elf64_phdr_t);
+}
+
+static int _elf_phdr_to_prot(const elf64_phdr_t *const phdr) {
+  return (phdr->p_flags & PF_R ? PROT_READ : 0) |
+         (phdr->p_flags & PF_W ? PROT_WRITE : 0) |
+         (phdr->p_flags & PF_X ? PROT_EXEC : 0);
+}
+
+int elf_read_image(struct file *const file, elf_image_t *const image) {
+  elf64_ehdr_t ehdr;
+  const long ehdr_read_result = _elf_read_at(file, 0, &ehdr, sizeof(ehdr));
+  if (ehdr_read_result < 0)
+    return ehdr_read_result;
+  if (ehdr_read_result < 4 || memcmp(ehdr.e_ident, "\177ELF", 4) != 0)
+    return -ENOEXEC;
+  if ((size_t)ehdr_read_result < sizeof(ehdr) || !_elf_check_ehdr(&ehdr))
+    return -EINVAL;
+
+  *image = (elf_image_t){.entry = (void *)ehdr.e_entry, .n_segments = 0};
+
+  for (size_t i = 0; i < ehdr.e_phnum; i++) {
+    elf64_phdr_t phdr;
+    const long phdr_read_result = _elf_read_at(
+        file, ehdr.e_phoff + i * sizeof(phdr), &phdr, sizeof(phdr));
+    if (phdr_read_result < 0)
+      return phdr_read_result;
+    if ((size_t)phdr_read_result < sizeof(phdr))
+      return -EINVAL;
+
+    if (phdr.p_type != PT_LOAD || phdr.p_memsz == 0)
+      continue;
+
+    // The file data of a segment must be mappable page by page, and the
+    // segment must lie in the user address space.
+    if (phdr.p_filesz > phdr.p_memsz ||
+        (phdr.p_offset - phdr.p_vaddr) & ((1 << PAGE_ORDER) - 1) ||
+        phdr.p_vaddr >= VM_USER_VA_END ||
+        phdr.p_memsz > VM_USER_VA_END - phdr.p_vaddr)
+      return -EINVAL;
+    if (image->n_segments == ELF_MAX_LOAD_SEGMENTS)
+      return -EINVAL;
+
+    const uint64_t start = phdr.p_vaddr & ~(uint64_t)((1 << PAGE_ORDER) - 1),
+                   end = ALIGN(phdr.p_vaddr + phdr.p_memsz, 1 << PAGE_ORDER),
+                   start_padding = phdr.p_vaddr - start;
+
+    // Segments sharing a page would need their contents merged into a single
+    // page, which we don't support.
+    if (image->n_segments != 0) {
+      const elf_load_segment_t *const prev_segment =
+          &image->segments[image->n_segments - 1];
+      if (start < (uint64_t)prev_segment->start + prev_segment->len)
+        return -EINVAL;
+    }
+
+    image->segments[image->n_segments++] = (elf_load_segment_t){
+        .start = (void *)start,
+        .len = end - start,
+        .file_offset = phdr.p_offset - start_padding,
+        .file_len = phdr.p_filesz + start_padding,
+        .prot = _elf_phdr_to_prot(&phdr)};
+  }
+
+  if (image->n_segments == 0)
+    return -EINVAL;
+
+  return 0;
+}
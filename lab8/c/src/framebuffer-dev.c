@@ -2,6 +2,7 @@
 
 #include "oscos/drivers/mailbox.h"
 #include "oscos/libc/string.h"
+#include "oscos/mem/cache.h"
 #include "oscos/mem/malloc.h"
 #include "oscos/mem/page-alloc.h"
 #include "oscos/mem/vm.h"
@@ -118,6 +119,9 @@ static int _framebuffer_dev_write(struct file *const file,
                cpy_len = len < remaining_len ? len : remaining_len;
 
   memcpy((char *)internal->framebuffer_base + file->f_pos, buf, cpy_len);
+  // Make the written pixels visible to the VideoCore. This is cheap if the
+  // framebuffer is mapped as non-cacheable memory, as it normally is.
+  cache_clean_range((char *)internal->framebuffer_base + file->f_pos, cpy_len);
   file->f_pos += cpy_len;
 
   CRITICAL_SECTION_LEAVE(daif_val);
@@ -136,7 +140,7 @@ static int _framebuffer_dev_read(struct file *const file, void *const buf,
 
 static int _framebuffer_dev_open(struct vnode *const file_node,
                                  struct file **const target) {
-  struct file *const file_handle = malloc(sizeof(struct file));
+  struct file *const file_handle = vfs_alloc_file();
   if (!file_handle)
     return -ENOMEM;
 
@@ -150,7 +154,7 @@ static int _framebuffer_dev_open(struct vnode *const file_node,
 }
 
 static int _framebuffer_dev_close(struct file *const file) {
-  free(file);
+  vfs_free_file(file);
   return 0;
 }
 
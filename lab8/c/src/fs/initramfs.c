@@ -3,6 +3,7 @@
 #include "oscos/initrd.h"
 #include "oscos/libc/string.h"
 #include "oscos/mem/malloc.h"
+#include "oscos/mem/page-alloc.h"
 #include "oscos/uapi/errno.h"
 #include "oscos/uapi/unistd.h"
 #include "oscos/utils/critical-section.h"
@@ -16,9 +17,14 @@ typedef struct {
 typedef struct {
   struct vnode *parent;
   const cpio_newc_entry_t *entry;
-  rb_node_t *child_vnodes; // Created lazily.
+  rb_node_t *child_vnodes; // Built once when mounting.
 } initramfs_internal_t;
 
+typedef struct {
+  const char *name;
+  size_t len;
+} initramfs_component_t;
+
 static int _initramfs_setup_mount(struct filesystem *fs, struct mount *mount);
 
 static int _initramfs_write(struct file *file, const void *buf, size_t len);
@@ -38,6 +44,9 @@ static int _initramfs_mkdir(struct vnode *dir_node, struct vnode **target,
 static int _initramfs_mknod(struct vnode *dir_node, struct vnode **target,
                             const char *component_name, struct device *device);
 static long _initramfs_get_size(struct vnode *vnode);
+static bool _initramfs_is_regular(struct vnode *vnode);
+static int _initramfs_direct_access(struct vnode *vnode, size_t index,
+                                    const void **page);
 
 static void _initramfs_sync_fs(struct mount *mount);
 
@@ -57,7 +66,9 @@ static struct vnode_operations _initramfs_vnode_operations = {
     .create = _initramfs_create,
     .mkdir = _initramfs_mkdir,
     .mknod = _initramfs_mknod,
-    .get_size = _initramfs_get_size};
+    .get_size = _initramfs_get_size,
+    .is_regular = _initramfs_is_regular,
+    .direct_access = _initramfs_direct_access};
 
 static struct super_operations _initramfs_super_operations = {
     .sync_fs = _initramfs_sync_fs};
@@ -70,12 +81,16 @@ static int _initramfs_cmp_child_vnode_entries_by_component_name(
   return strcmp(e1->component_name, e2->component_name);
 }
 
-static int _initramfs_cmp_component_name_and_child_vnode_entry(
-    const char *component_name,
+static int _initramfs_cmp_component_and_child_vnode_entry(
+    const initramfs_component_t *const component,
     const initramfs_child_vnode_entry_t *const entry, void *const _arg) {
   (void)_arg;
 
-  return strcmp(component_name, entry->component_name);
+  const int result =
+      strncmp(component->name, entry->component_name, component->len);
+  if (result != 0)
+    return result;
+  return entry->component_name[component->len] == '\0' ? 0 : -1;
 }
 
 static struct vnode *
@@ -100,6 +115,121 @@ _initramfs_create_vnode(struct mount *const mount, struct vnode *const parent,
   return result;
 }
 
+static void _initramfs_drop_vnode(struct vnode *vnode);
+
+static void _initramfs_drop_child_vnode_entry(void *const payload) {
+  const initramfs_child_vnode_entry_t *const entry = payload;
+  _initramfs_drop_vnode(entry->vnode);
+}
+
+/// \brief Frees a vnode and all of its descendants.
+static void _initramfs_drop_vnode(struct vnode *const vnode) {
+  initramfs_internal_t *const internal = vnode->internal;
+  rb_drop(internal->child_vnodes, _initramfs_drop_child_vnode_entry);
+  free(internal);
+  free(vnode);
+}
+
+static struct vnode *
+_initramfs_find_child_vnode(const struct vnode *const dir_node,
+                            const initramfs_component_t *const component) {
+  const initramfs_internal_t *const internal = dir_node->internal;
+  const initramfs_child_vnode_entry_t *const child_vnode_entry = rb_search(
+      internal->child_vnodes, component,
+      (int (*)(const void *, const void *,
+               void *))_initramfs_cmp_component_and_child_vnode_entry,
+      NULL);
+  return child_vnode_entry ? child_vnode_entry->vnode : NULL;
+}
+
+static bool _initramfs_is_self_component(const char *const name,
+                                         const size_t len) {
+  return len == 0 || (len == 1 && name[0] == '.');
+}
+
+static int _initramfs_add_entry(struct mount *mount,
+                                const cpio_newc_entry_t *entry);
+
+/// \brief Adds the entry for the directory \p dirname to the tree if it is in
+///        the archive but hasn't been added yet.
+///
+/// This is only needed when an archive lists an entry before its parent
+/// directory, which `find | cpio` never does.
+static int _initramfs_add_parent_entry(struct mount *const mount,
+                                       const char *const dirname,
+                                       const size_t dirname_len) {
+  char *const dirname_buf = malloc(dirname_len + 1);
+  if (!dirname_buf)
+    return -ENOMEM;
+  memcpy(dirname_buf, dirname, dirname_len);
+  dirname_buf[dirname_len] = '\0';
+
+  const cpio_newc_entry_t *const parent_entry =
+      initrd_find_entry_by_pathname(dirname_buf);
+  free(dirname_buf);
+
+  return parent_entry ? _initramfs_add_entry(mount, parent_entry) : 0;
+}
+
+/// \brief Adds a vnode for an archive entry to the directory tree.
+///
+/// Entries whose parent directory isn't in the archive are unreachable and are
+/// skipped, as are duplicate entries.
+static int _initramfs_add_entry(struct mount *const mount,
+                                const cpio_newc_entry_t *const entry) {
+  const char *const pathname = CPIO_NEWC_PATHNAME(entry);
+
+  // Walk down to the parent directory.
+
+  struct vnode *dir_node = mount->root;
+  const char *name = pathname;
+  for (const char *slash; (slash = strchr(name, '/')); name = slash + 1) {
+    const initramfs_component_t component = {.name = name,
+                                             .len = slash - name};
+    if (_initramfs_is_self_component(component.name, component.len))
+      continue;
+
+    struct vnode *child_node =
+        _initramfs_find_child_vnode(dir_node, &component);
+    if (!child_node) {
+      const int result =
+          _initramfs_add_parent_entry(mount, pathname, slash - pathname);
+      if (result < 0)
+        return result;
+
+      child_node = _initramfs_find_child_vnode(dir_node, &component);
+      if (!child_node)
+        return 0;
+    }
+    dir_node = child_node;
+  }
+
+  const initramfs_component_t component = {.name = name, .len = strlen(name)};
+  if (_initramfs_is_self_component(component.name, component.len) ||
+      _initramfs_find_child_vnode(dir_node, &component))
+    return 0;
+
+  // Create a new vnode.
+
+  struct vnode *const vnode = _initramfs_create_vnode(mount, dir_node, entry);
+  if (!vnode)
+    return -ENOMEM;
+
+  initramfs_internal_t *const dir_internal = dir_node->internal;
+  const initramfs_child_vnode_entry_t new_child_vnode_entry = {
+      .component_name = name, .vnode = vnode};
+  if (!rb_insert(&dir_internal->child_vnodes,
+                 sizeof(initramfs_child_vnode_entry_t), &new_child_vnode_entry,
+                 (int (*)(const void *, const void *, void *))
+                     _initramfs_cmp_child_vnode_entries_by_component_name,
+                 NULL)) {
+    _initramfs_drop_vnode(vnode);
+    return -ENOMEM;
+  }
+
+  return 0;
+}
+
 static int _initramfs_setup_mount(struct filesystem *const fs,
                                   struct mount *const mount) {
   if (!initrd_is_init())
@@ -112,8 +242,19 @@ static int _initramfs_setup_mount(struct filesystem *const fs,
   *mount = (struct mount){.fs = fs,
                           .root = root_vnode,
                           .s_ops = &_initramfs_super_operations,
+                          .is_read_only = true,
                           .internal = NULL};
 
+  // Index the whole archive once so that lookups never have to scan it.
+
+  INITRD_FOR_ENTRY(entry) {
+    const int result = _initramfs_add_entry(mount, entry);
+    if (result < 0) {
+      _initramfs_drop_vnode(root_vnode);
+      return result;
+    }
+  }
+
   return 0;
 }
 
@@ -179,7 +320,7 @@ static int _initramfs_open(struct vnode *const file_node,
     return -EIO;
   }
 
-  struct file *const file_handle = malloc(sizeof(struct file));
+  struct file *const file_handle = vfs_alloc_file();
   if (!file_handle)
     return -ENOMEM;
 
@@ -193,7 +334,7 @@ static int _initramfs_open(struct vnode *const file_node,
 }
 
 static int _initramfs_close(struct file *const file) {
-  free(file);
+  vfs_free_file(file);
   return 0;
 }
 
@@ -270,73 +411,15 @@ static int _initramfs_lookup(struct vnode *const dir_node,
     return 0;
   }
 
-  // Check if the vnode has been created before.
+  // The tree is immutable after mounting, so no critical section is needed.
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
-
-  const initramfs_child_vnode_entry_t *const child_vnode_entry = rb_search(
-      internal->child_vnodes, component_name,
-      (int (*)(const void *, const void *,
-               void *))_initramfs_cmp_component_name_and_child_vnode_entry,
-      NULL);
-
-  CRITICAL_SECTION_LEAVE(daif_val);
-
-  if (child_vnode_entry) {
-    *target = child_vnode_entry->vnode;
-    return 0;
-  }
-
-  // A vnode has not been created before. Check if the file/directory exists.
-
-  size_t dirname_len;
-  const cpio_newc_entry_t *child_initrd_entry;
-
-  if (dir_node != dir_node->mount->root) {
-    dirname_len = strlen(CPIO_NEWC_PATHNAME(entry));
-    char *const filename_buf =
-        malloc(dirname_len + 1 + strlen(component_name) + 1);
-    if (!filename_buf)
-      return -ENOMEM;
-    memcpy(filename_buf, CPIO_NEWC_PATHNAME(entry), dirname_len);
-    filename_buf[dirname_len] = '/';
-    strcpy(filename_buf + dirname_len + 1, component_name);
-
-    child_initrd_entry = initrd_find_entry_by_pathname(filename_buf);
-    free(filename_buf);
-  } else {
-    child_initrd_entry = initrd_find_entry_by_pathname(component_name);
-  }
-  if (!child_initrd_entry) {
-    return -ENOENT;
-  }
-
-  // Create a new vnode.
-
-  struct vnode *const vnode =
-      _initramfs_create_vnode(dir_node->mount, dir_node, child_initrd_entry);
+  const initramfs_component_t component = {.name = component_name,
+                                           .len = strlen(component_name)};
+  struct vnode *const vnode = _initramfs_find_child_vnode(dir_node, &component);
   if (!vnode)
-    return -ENOMEM;
-
-  const initramfs_child_vnode_entry_t new_child_vnode_entry = {
-      .component_name =
-          CPIO_NEWC_PATHNAME(child_initrd_entry) +
-          (dir_node != dir_node->mount->root ? dirname_len + 1 : 0),
-      .vnode = vnode};
-
-  CRITICAL_SECTION_ENTER(daif_val);
-
-  rb_insert(&internal->child_vnodes, sizeof(initramfs_child_vnode_entry_t),
-            &new_child_vnode_entry,
-            (int (*)(const void *, const void *, void *))
-                _initramfs_cmp_child_vnode_entries_by_component_name,
-            NULL);
-
-  CRITICAL_SECTION_LEAVE(daif_val);
+    return -ENOENT;
 
   *target = vnode;
-
   return 0;
 }
 
@@ -383,6 +466,40 @@ static long _initramfs_get_size(struct vnode *const vnode) {
              : -1;
 }
 
+static bool _initramfs_is_regular(struct vnode *const vnode) {
+  const initramfs_internal_t *const internal = vnode->internal;
+  const cpio_newc_entry_t *const entry = internal->entry;
+  if (!entry) // The root directory.
+    return false;
+
+  const uint32_t mode = CPIO_NEWC_HEADER_VALUE(entry, mode);
+  const uint32_t file_type = mode & CPIO_NEWC_MODE_FILE_TYPE_MASK;
+  return file_type == CPIO_NEWC_MODE_FILE_TYPE_REG;
+}
+
+static int _initramfs_direct_access(struct vnode *const vnode,
+                                    const size_t index,
+                                    const void **const page) {
+  const initramfs_internal_t *const internal = vnode->internal;
+  const cpio_newc_entry_t *const entry = internal->entry;
+
+  const uint32_t mode = CPIO_NEWC_HEADER_VALUE(entry, mode);
+  const uint32_t file_type = mode & CPIO_NEWC_MODE_FILE_TYPE_MASK;
+  if (file_type != CPIO_NEWC_MODE_FILE_TYPE_REG)
+    return -EINVAL;
+
+  // The file data is page-aligned only if the initial ramdisk is built with
+  // page-aligned file data and loaded at a page-aligned address.
+  const char *const file_data = CPIO_NEWC_FILE_DATA(entry);
+  if ((uintptr_t)file_data & ((1 << PAGE_ORDER) - 1))
+    return -EINVAL;
+  if ((index + 1) << PAGE_ORDER > CPIO_NEWC_FILESIZE(entry))
+    return -EINVAL;
+
+  *page = file_data + (index << PAGE_ORDER);
+  return 0;
+}
+
 static void _initramfs_sync_fs(struct mount *const mount) {
   // No-op.
   (void)mount;
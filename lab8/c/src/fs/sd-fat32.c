@@ -6,9 +6,10 @@
 #include "oscos/libc/ctype.h"
 #include "oscos/libc/string.h"
 #include "oscos/mem/malloc.h"
+#include "oscos/mem/page-alloc.h"
+#include "oscos/sync.h"
 #include "oscos/uapi/errno.h"
 #include "oscos/uapi/unistd.h"
-#include "oscos/utils/critical-section.h"
 #include "oscos/utils/rb.h"
 
 typedef struct {
@@ -96,6 +97,13 @@ typedef struct {
   block_cache_t block_cache;
 } sd_fat32_fs_internal_t;
 
+/// \brief Serializes access to the SD card, the block caches and the in-memory
+///        file system state.
+///
+/// A mutex, so that interrupts stay enabled and other threads keep running
+/// while the SD host controller is polled.
+static mutex_t _sd_fat32_lock = MUTEX_INIT(_sd_fat32_lock);
+
 static int _sd_fat32_setup_mount(struct filesystem *fs, struct mount *mount);
 
 static int _sd_fat32_write(struct file *file, const void *buf, size_t len);
@@ -115,6 +123,8 @@ static int _sd_fat32_mkdir(struct vnode *dir_node, struct vnode **target,
 static int _sd_fat32_mknod(struct vnode *dir_node, struct vnode **target,
                            const char *component_name, struct device *device);
 static long _sd_fat32_get_size(struct vnode *vnode);
+static bool _sd_fat32_is_regular(struct vnode *vnode);
+static int _sd_fat32_read_page(struct vnode *vnode, size_t index, void *page);
 
 static void _sd_fat32_sync_fs(struct mount *mount);
 
@@ -134,7 +144,9 @@ static struct vnode_operations _sd_fat32_vnode_operations = {
     .create = _sd_fat32_create,
     .mkdir = _sd_fat32_mkdir,
     .mknod = _sd_fat32_mknod,
-    .get_size = _sd_fat32_get_size};
+    .get_size = _sd_fat32_get_size,
+    .is_regular = _sd_fat32_is_regular,
+    .read_page = _sd_fat32_read_page};
 
 static struct super_operations _sd_fat32_super_operations = {
     .sync_fs = _sd_fat32_sync_fs};
@@ -191,6 +203,24 @@ static void readblock_cached(block_cache_t *const cache, const int block_idx,
             NULL);
 }
 
+/// \brief Reads a block through the block cache without caching it on a miss.
+static void readblock_peek_cached(block_cache_t *const cache,
+                                  const int block_idx, void *const buf) {
+  const size_t lba = block_idx;
+
+  const block_cache_entry_t *const entry =
+      rb_search(cache->root, &lba,
+                (int (*)(const void *, const void *,
+                         void *))_sd_fat32_cmp_lba_and_block_cache_entry,
+                NULL);
+
+  if (entry) {
+    memcpy(buf, entry->data, 512);
+  } else {
+    readblock(block_idx, buf);
+  }
+}
+
 static void writeblock_cached(block_cache_t *const cache, int block_idx,
                               void *buf) {
   const size_t lba = block_idx;
@@ -232,12 +262,11 @@ static void _flush_cache_rec(rb_node_t *const node) {
 }
 
 static void flush_cache(block_cache_t *const cache) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  mutex_lock(&_sd_fat32_lock);
 
   _flush_cache_rec(cache->root);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  mutex_unlock(&_sd_fat32_lock);
 }
 
 static size_t
@@ -455,6 +484,8 @@ static int _sd_fat32_setup_mount(struct filesystem *const fs,
     return -ENOMEM;
   }
 
+  mutex_lock(&_sd_fat32_lock);
+
   // Read MBR.
 
   readblock(0, block_buf);
@@ -468,6 +499,8 @@ static int _sd_fat32_setup_mount(struct filesystem *const fs,
 
   readblock(partition_lba, block_buf);
 
+  mutex_unlock(&_sd_fat32_lock);
+
   bpb_t *const bpb = (bpb_t *)block_buf;
   fs_internal->fsinfo = (fat32_fsinfo_t){
       .partition_lba = partition_lba,
@@ -500,6 +533,21 @@ static int _sd_fat32_setup_mount(struct filesystem *const fs,
   return 0;
 }
 
+/// \brief Faults in the pages of a buffer that is to be read with
+///        \ref _sd_fat32_lock held.
+///
+/// A user buffer may lie in a file-backed page that is not mapped yet. Mapping
+/// it may read this file system and thus take the lock again. Once mapped, the
+/// pages stay mapped until the process unmaps them, which it cannot do while
+/// it is in the middle of the write.
+static void _sd_fat32_prefault(const void *const buf, const size_t len) {
+  const uintptr_t end = (uintptr_t)buf + len;
+  for (uintptr_t va = (uintptr_t)buf; va < end;
+       va = (va | ((1 << PAGE_ORDER) - 1)) + 1) {
+    (void)*(const volatile char *)va;
+  }
+}
+
 static int _sd_fat32_write(struct file *const file, const void *const buf,
                            const size_t len) {
   sd_fat32_internal_t *const internal =
@@ -517,8 +565,9 @@ static int _sd_fat32_write(struct file *const file, const void *const buf,
   if (!block_buf)
     return -ENOMEM;
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  _sd_fat32_prefault(buf, len);
+
+  mutex_lock(&_sd_fat32_lock);
 
   const size_t write_end_offset = file->f_pos + len;
 
@@ -563,7 +612,7 @@ static int _sd_fat32_write(struct file *const file, const void *const buf,
           fsinfo, block_cache, curr_cluster_addr, block_buf);
       if (curr_cluster_addr == (size_t)-1) { // Out of space.
         free(block_buf);
-        CRITICAL_SECTION_LEAVE(daif_val);
+        mutex_unlock(&_sd_fat32_lock);
         return -ENOSPC;
       }
 
@@ -604,20 +653,21 @@ static int _sd_fat32_write(struct file *const file, const void *const buf,
   }
 
   free(block_buf);
-  CRITICAL_SECTION_LEAVE(daif_val);
+  mutex_unlock(&_sd_fat32_lock);
   return n_chars_written;
 }
 
-static int _sd_fat32_read(struct file *const file, void *const buf,
-                          const size_t len) {
-  sd_fat32_internal_t *const internal =
-      (sd_fat32_internal_t *)file->vnode->internal;
+/// \brief Reads from a regular file at the given offset.
+/// \return The number of bytes read, or a negative error number.
+static int _sd_fat32_read_at(struct vnode *const vnode, const size_t offset,
+                             void *const buf, const size_t len) {
+  sd_fat32_internal_t *const internal = (sd_fat32_internal_t *)vnode->internal;
   if (internal->type != TYPE_FILE)
     return -EISDIR;
 
   sd_fat32_internal_file_data_t *const file_data = &internal->file_data;
   sd_fat32_fs_internal_t *const fs_internal =
-      (sd_fat32_fs_internal_t *)file->vnode->mount->internal;
+      (sd_fat32_fs_internal_t *)vnode->mount->internal;
   const fat32_fsinfo_t *const fsinfo = &fs_internal->fsinfo;
   block_cache_t *const block_cache = &fs_internal->block_cache;
 
@@ -625,11 +675,10 @@ static int _sd_fat32_read(struct file *const file, void *const buf,
   if (!block_buf)
     return -ENOMEM;
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  mutex_lock(&_sd_fat32_lock);
 
   const size_t read_end_offset =
-      file->f_pos + len < file_data->size ? file->f_pos + len : file_data->size;
+      offset + len < file_data->size ? offset + len : file_data->size;
 
   size_t curr_cluster_addr = file_data->cluster_addr, file_offset = 0,
          n_chars_read = 0;
@@ -637,12 +686,12 @@ static int _sd_fat32_read(struct file *const file, void *const buf,
     for (size_t sector_of_cluster = 0;
          sector_of_cluster < fsinfo->cluster_n_sectors; sector_of_cluster++) {
       const size_t end_offset = file_offset + 512;
-      const size_t max_start =
-                       file_offset > file->f_pos ? file_offset : file->f_pos,
+      const size_t max_start = file_offset > offset ? file_offset : offset,
                    min_end = end_offset < read_end_offset ? end_offset
                                                           : read_end_offset;
       if (max_start < min_end) {
-        readblock_cached(
+        // File data is cached in the page cache rather than the block cache.
+        readblock_peek_cached(
             block_cache,
             _sd_fat32_cluster_addr_to_data_lba(fsinfo, curr_cluster_addr) +
                 sector_of_cluster,
@@ -664,7 +713,7 @@ static int _sd_fat32_read(struct file *const file, void *const buf,
         _sd_fat32_read_fat(fsinfo, block_cache, curr_cluster_addr, block_buf);
     if (!(0x2 <= fat_entry && fat_entry <= 0x0ffffff7)) { // No more chains.
       // The file has a hole, which should read zero.
-      memset(block_buf + n_chars_read, 0, read_end_offset - file_offset);
+      memset((char *)buf + n_chars_read, 0, read_end_offset - file_offset);
       n_chars_read += read_end_offset - file_offset;
       break;
     }
@@ -672,13 +721,20 @@ static int _sd_fat32_read(struct file *const file, void *const buf,
     curr_cluster_addr = fat_entry;
   }
 
-  file->f_pos += n_chars_read;
-
   free(block_buf);
-  CRITICAL_SECTION_LEAVE(daif_val);
+  mutex_unlock(&_sd_fat32_lock);
   return n_chars_read;
 }
 
+static int _sd_fat32_read(struct file *const file, void *const buf,
+                          const size_t len) {
+  const int result = _sd_fat32_read_at(file->vnode, file->f_pos, buf, len);
+  if (result > 0) {
+    file->f_pos += result;
+  }
+  return result;
+}
+
 static int _sd_fat32_open(struct vnode *const file_node,
                           struct file **const target) {
   sd_fat32_internal_t *const internal =
@@ -686,7 +742,7 @@ static int _sd_fat32_open(struct vnode *const file_node,
   if (internal->type != TYPE_FILE)
     return -EISDIR;
 
-  struct file *const file_handle = malloc(sizeof(struct file));
+  struct file *const file_handle = vfs_alloc_file();
   if (!file_handle)
     return -ENOMEM;
 
@@ -700,7 +756,7 @@ static int _sd_fat32_open(struct vnode *const file_node,
 }
 
 static int _sd_fat32_close(struct file *const file) {
-  free(file);
+  vfs_free_file(file);
   return 0;
 }
 
@@ -760,10 +816,10 @@ static int _sd_fat32_lookup(struct vnode *const dir_node,
     return 0;
   }
 
-  // Check if the vnode has been created before.
+  // Check if the vnode has been created before. The lock is held until the
+  // new vnode, if any, is inserted, so that no vnode is created twice.
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  mutex_lock(&_sd_fat32_lock);
 
   const sd_fat32_child_vnode_entry_t *const child_vnode_entry = rb_search(
       dir_data->child_vnodes, component_name,
@@ -771,10 +827,9 @@ static int _sd_fat32_lookup(struct vnode *const dir_node,
                void *))_sd_fat32_cmp_component_name_and_child_vnode_entry,
       NULL);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
-
   if (child_vnode_entry) {
     *target = child_vnode_entry->vnode;
+    mutex_unlock(&_sd_fat32_lock);
     return 0;
   }
 
@@ -783,12 +838,16 @@ static int _sd_fat32_lookup(struct vnode *const dir_node,
 
   char filename_buf[11];
   if (!_sd_fat32_check_and_map_filename(
-          component_name, filename_buf)) // Invalid component name.
+          component_name, filename_buf)) { // Invalid component name.
+    mutex_unlock(&_sd_fat32_lock);
     return -ENOENT;
+  }
 
   unsigned char *const block_buf = malloc(512);
-  if (!block_buf)
+  if (!block_buf) {
+    mutex_unlock(&_sd_fat32_lock);
     return -ENOMEM;
+  }
 
   size_t dir_table_cluster_addr = dir_data->cluster_addr,
          dir_table_sector_of_cluster, dir_entry_ix;
@@ -841,6 +900,7 @@ static int _sd_fat32_lookup(struct vnode *const dir_node,
 
   if (!dir_entry) {
     free(block_buf);
+    mutex_unlock(&_sd_fat32_lock);
     return -ENOENT;
   }
 
@@ -856,27 +916,28 @@ static int _sd_fat32_lookup(struct vnode *const dir_node,
           : _sd_fat32_create_file_vnode(dir_node->mount, dir_table_cluster_addr,
                                         dir_table_sector_of_cluster,
                                         dir_entry_ix, cluster_addr, file_size);
-  if (!vnode)
+  if (!vnode) {
+    mutex_unlock(&_sd_fat32_lock);
     return -ENOMEM;
+  }
 
   const char *const entry_component_name = strdup(component_name);
   if (!entry_component_name) {
     free(vnode);
+    mutex_unlock(&_sd_fat32_lock);
     return -ENOMEM;
   }
 
   const sd_fat32_child_vnode_entry_t new_child_vnode_entry = {
       .component_name = entry_component_name, .vnode = vnode};
 
-  CRITICAL_SECTION_ENTER(daif_val);
-
   rb_insert(&dir_data->child_vnodes, sizeof(sd_fat32_child_vnode_entry_t),
             &new_child_vnode_entry,
             (int (*)(const void *, const void *, void *))
                 _sd_fat32_cmp_child_vnode_entries_by_component_name,
             NULL);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  mutex_unlock(&_sd_fat32_lock);
 
   *target = vnode;
 
@@ -919,8 +980,7 @@ static int _sd_fat32_create_impl(struct vnode *const dir_node,
   if (!block_buf)
     return -ENOMEM;
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  mutex_lock(&_sd_fat32_lock);
 
   // Find an empty entry in the FAT.
 
@@ -928,7 +988,7 @@ static int _sd_fat32_create_impl(struct vnode *const dir_node,
       _sd_fat32_find_free_cluster_and_hold(fsinfo, block_cache, block_buf);
   if (new_file_cluster_addr == (size_t)-1) {
     free(block_buf);
-    CRITICAL_SECTION_LEAVE(daif_val);
+    mutex_unlock(&_sd_fat32_lock);
     return -ENOSPC;
   }
 
@@ -946,7 +1006,7 @@ static int _sd_fat32_create_impl(struct vnode *const dir_node,
   if (!vnode) {
     _sd_fat32_unhold_cluster();
     free(block_buf);
-    CRITICAL_SECTION_LEAVE(daif_val);
+    mutex_unlock(&_sd_fat32_lock);
     return -ENOMEM;
   }
 
@@ -955,7 +1015,7 @@ static int _sd_fat32_create_impl(struct vnode *const dir_node,
     free(vnode);
     _sd_fat32_unhold_cluster();
     free(block_buf);
-    CRITICAL_SECTION_LEAVE(daif_val);
+    mutex_unlock(&_sd_fat32_lock);
     return -ENOMEM;
   }
 
@@ -1021,7 +1081,7 @@ static int _sd_fat32_create_impl(struct vnode *const dir_node,
       free(vnode);
       _sd_fat32_unhold_cluster();
       free(block_buf);
-      CRITICAL_SECTION_LEAVE(daif_val);
+      mutex_unlock(&_sd_fat32_lock);
       return -ENOSPC;
     }
 
@@ -1077,7 +1137,7 @@ static int _sd_fat32_create_impl(struct vnode *const dir_node,
 
   *target = vnode;
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  mutex_unlock(&_sd_fat32_lock);
   return 0;
 }
 
@@ -1115,6 +1175,22 @@ static long _sd_fat32_get_size(struct vnode *const vnode) {
   return file_data->size;
 }
 
+static bool _sd_fat32_is_regular(struct vnode *const vnode) {
+  const sd_fat32_internal_t *const internal = vnode->internal;
+  return internal->type == TYPE_FILE;
+}
+
+static int _sd_fat32_read_page(struct vnode *const vnode, const size_t index,
+                               void *const page) {
+  const int result =
+      _sd_fat32_read_at(vnode, index << PAGE_ORDER, page, 1 << PAGE_ORDER);
+  if (result < 0)
+    return result;
+
+  memset((char *)page + result, 0, (1 << PAGE_ORDER) - result);
+  return 0;
+}
+
 static void _sd_fat32_sync_fs(struct mount *const mount) {
   sd_fat32_fs_internal_t *const fs_internal =
       (sd_fat32_fs_internal_t *)mount->internal;
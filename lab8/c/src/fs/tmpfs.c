@@ -4,6 +4,7 @@
 #include "oscos/mem/malloc.h"
 #include "oscos/mem/page-alloc.h"
 #include "oscos/mem/vm.h"
+#include "oscos/mem/zero-pool.h"
 #include "oscos/uapi/errno.h"
 #include "oscos/uapi/unistd.h"
 #include "oscos/utils/critical-section.h"
@@ -55,6 +56,7 @@ static int _tmpfs_mkdir(struct vnode *dir_node, struct vnode **target,
 static int _tmpfs_mknod(struct vnode *dir_node, struct vnode **target,
                         const char *component_name, struct device *device);
 static long _tmpfs_get_size(struct vnode *vnode);
+static bool _tmpfs_is_regular(struct vnode *vnode);
 
 static void _tmpfs_sync_fs(struct mount *mount);
 
@@ -73,7 +75,8 @@ static struct vnode_operations _tmpfs_vnode_operations = {
     .create = _tmpfs_create,
     .mkdir = _tmpfs_mkdir,
     .mknod = _tmpfs_mknod,
-    .get_size = _tmpfs_get_size};
+    .get_size = _tmpfs_get_size,
+    .is_regular = _tmpfs_is_regular};
 
 static struct super_operations _tmpfs_super_operations = {.sync_fs =
                                                               _tmpfs_sync_fs};
@@ -106,7 +109,9 @@ static struct vnode *_tmpfs_create_file_vnode(struct mount *const mount) {
     return NULL;
   }
 
-  const spage_id_t contents_page = alloc_pages(0);
+  // The contents page is zero-filled, so any gap left by writing past the end
+  // of the file reads as zeros.
+  const spage_id_t contents_page = alloc_zeroed_page();
   if (contents_page < 0) {
     free(internal);
     free(result);
@@ -179,10 +184,6 @@ static int _tmpfs_write(struct file *const file, const void *const buf,
   const size_t remaining_len = MAX_FILE_SZ - file->f_pos,
                cpy_len = len < remaining_len ? len : remaining_len;
 
-  if (file->f_pos > file_data->size) {
-    memset(file_data->contents, 0, file->f_pos - file_data->size);
-  }
-
   memcpy(file_data->contents + file->f_pos, buf, cpy_len);
   file->f_pos += cpy_len;
   if (file->f_pos > file_data->size) {
@@ -224,7 +225,7 @@ static int _tmpfs_open(struct vnode *const file_node,
   if (internal->type != TYPE_FILE)
     return -EISDIR;
 
-  struct file *const file_handle = malloc(sizeof(struct file));
+  struct file *const file_handle = vfs_alloc_file();
   if (!file_handle)
     return -ENOMEM;
 
@@ -238,7 +239,7 @@ static int _tmpfs_open(struct vnode *const file_node,
 }
 
 static int _tmpfs_close(struct file *const file) {
-  free(file);
+  vfs_free_file(file);
   return 0;
 }
 
@@ -482,6 +483,11 @@ static long _tmpfs_get_size(struct vnode *const vnode) {
   return file_data->size;
 }
 
+static bool _tmpfs_is_regular(struct vnode *const vnode) {
+  const tmpfs_internal_t *const internal = vnode->internal;
+  return internal->type == TYPE_FILE;
+}
+
 static void _tmpfs_sync_fs(struct mount *const mount) {
   // No-op.
   (void)mount;
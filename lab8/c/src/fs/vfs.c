@@ -1,11 +1,13 @@
 #include "oscos/fs/vfs.h"
 
+#include <stdalign.h>
 #include <stdint.h>
 
 #include "oscos/libc/string.h"
 #include "oscos/mem/malloc.h"
+#include "oscos/mem/page-cache.h"
 #include "oscos/uapi/errno.h"
-#include "oscos/utils/critical-section.h"
+#include "oscos/utils/lock.h"
 #include "oscos/utils/rb.h"
 
 typedef struct {
@@ -13,11 +15,30 @@ typedef struct {
   struct mount *mount;
 } mount_entry_t;
 
+/// \brief A mount created by vfs_mount_relative.
+typedef struct mount_node_t {
+  struct mount mount;
+  /// \brief The previously created mount.
+  struct mount_node_t *next;
+} mount_node_t;
+
 struct mount rootfs;
 
 static rb_node_t *_filesystems = NULL;
 static rb_node_t *_devices = NULL;
 static rb_node_t *_mounts_by_mountpoint = NULL, *_mounts_by_root = NULL;
+/// \brief The mounts, newest first. Mounts are never removed, so the list can
+///        be traversed without the lock once its head is read.
+static mount_node_t *_mounts = NULL;
+/// \brief Protects the registries of file systems and devices and the mount
+///        tables.
+///
+/// Looked up on every path lookup and rarely modified, hence a reader-writer
+/// lock.
+static rwlock_t _vfs_lock;
+/// \brief Protects the reference counts of the shared files.
+static spinlock_t _shared_file_lock;
+static obj_cache_t *_file_cache, *_shared_file_cache;
 
 static int _vfs_cmp_filesystems_by_name(const struct filesystem *const fs1,
                                         const struct filesystem *const fs2,
@@ -99,30 +120,45 @@ static int _vfs_cmp_root_and_mount(const struct vnode *const root,
   return 0;
 }
 
+bool vfs_init(void) {
+  rwlock_init(&_vfs_lock, "vfs");
+  spin_lock_init(&_shared_file_lock, "vfs: shared files");
+
+  _file_cache = obj_cache_create("file", sizeof(struct file),
+                                 alignof(struct file), NULL);
+  _shared_file_cache = obj_cache_create(
+      "shared_file_t", sizeof(shared_file_t), alignof(shared_file_t), NULL);
+  return _file_cache && _shared_file_cache;
+}
+
+struct file *vfs_alloc_file(void) { return obj_cache_alloc(_file_cache); }
+
+void vfs_free_file(struct file *const file) {
+  obj_cache_free(_file_cache, file);
+}
+
 int register_filesystem(struct filesystem *const fs) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  const uint64_t daif_val = write_lock_irqsave(&_vfs_lock);
 
   rb_insert(
       &_filesystems, sizeof(struct filesystem), fs,
       (int (*)(const void *, const void *, void *))_vfs_cmp_filesystems_by_name,
       NULL);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  write_unlock_irqrestore(&_vfs_lock, daif_val);
 
   return 0;
 }
 
 int register_device(struct device *const dev) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  const uint64_t daif_val = write_lock_irqsave(&_vfs_lock);
 
   rb_insert(
       &_devices, sizeof(struct device), dev,
       (int (*)(const void *, const void *, void *))_vfs_cmp_devices_by_name,
       NULL);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  write_unlock_irqrestore(&_vfs_lock, daif_val);
 
   return 0;
 }
@@ -136,15 +172,14 @@ static int _vfs_lookup_step(struct vnode *curr_vnode,
       *target = curr_vnode;
       return 0;
     } else {
-      uint64_t daif_val;
-      CRITICAL_SECTION_ENTER(daif_val);
+      const uint64_t daif_val = read_lock_irqsave(&_vfs_lock);
 
       const mount_entry_t *const entry = rb_search(
           _mounts_by_root, curr_vnode,
           (int (*)(const void *, const void *, void *))_vfs_cmp_root_and_mount,
           NULL);
 
-      CRITICAL_SECTION_LEAVE(daif_val);
+      read_unlock_irqrestore(&_vfs_lock, daif_val);
 
       curr_vnode = entry->mountpoint;
     }
@@ -158,8 +193,7 @@ static int _vfs_lookup_step(struct vnode *curr_vnode,
   // If the new node is the mountpoint of a mounted file system, jump to the
   // filesystem root.
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  const uint64_t daif_val = read_lock_irqsave(&_vfs_lock);
 
   const mount_entry_t *const entry =
       rb_search(_mounts_by_mountpoint, *target,
@@ -167,7 +201,7 @@ static int _vfs_lookup_step(struct vnode *curr_vnode,
                          void *))_vfs_cmp_mountpoint_and_mount,
                 NULL);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  read_unlock_irqrestore(&_vfs_lock, daif_val);
 
   if (entry) {
     *target = entry->mount->root;
@@ -234,17 +268,39 @@ int vfs_open_relative(struct vnode *const cwd, const char *const pathname,
   } else if (result < 0) {
     return result;
   }
-  return curr_vnode->f_ops->open(curr_vnode, target);
+  return vfs_open_vnode(curr_vnode, target);
+}
+
+int vfs_open_vnode(struct vnode *const vnode, struct file **const target) {
+  return vnode->f_ops->open(vnode, target);
+}
+
+bool vfs_is_regular(struct vnode *const vnode) {
+  return vnode->v_ops->is_regular && vnode->v_ops->is_regular(vnode);
 }
 
 int vfs_close(struct file *const file) { return file->f_ops->close(file); }
 
+// Only regular files ever have pages in the page cache, so device files and
+// files never read through the cache skip it without taking its lock.
+
 int vfs_write(struct file *const file, const void *const buf,
               const size_t len) {
-  return file->f_ops->write(file, buf, len);
+  const size_t offset = file->f_pos;
+  const int result = file->f_ops->write(file, buf, len);
+  if (result > 0 && file->vnode->n_cached_pages != 0) {
+    page_cache_update(file->vnode, offset, buf, result);
+  }
+  return result;
 }
 
 int vfs_read(struct file *const file, void *const buf, const size_t len) {
+  // Once pages of a file are cached, e.g., for a shared mapping, they may be
+  // newer than what the file system holds until they are written back, so the
+  // file is read through the cache.
+  if (file->vnode->v_ops->read_page || file->vnode->n_cached_pages != 0)
+    return page_cache_read(file, buf, len);
+
   return file->f_ops->read(file, buf, len);
 }
 
@@ -285,48 +341,45 @@ int vfs_mount_relative(struct vnode *const cwd, const char *const target,
   if (result < 0)
     return result;
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  uint64_t daif_val = read_lock_irqsave(&_vfs_lock);
 
   struct filesystem *fs = (struct filesystem *)rb_search(
       _filesystems, filesystem,
       (int (*)(const void *, const void *, void *))_vfs_cmp_name_and_filesystem,
       NULL);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  read_unlock_irqrestore(&_vfs_lock, daif_val);
 
   if (!fs)
     return -ENODEV;
 
-  struct mount *const mount = malloc(sizeof(struct mount));
-  if (!mount)
+  mount_node_t *const node = malloc(sizeof(mount_node_t));
+  if (!node)
     return -ENOMEM;
+  struct mount *const mount = &node->mount;
 
   const int setup_mount_result = fs->setup_mount(fs, mount);
   if (setup_mount_result < 0) {
-    free(mount);
+    free(node);
     return setup_mount_result;
   }
 
   const mount_entry_t entry = {.mountpoint = mountpoint, .mount = mount};
 
-  CRITICAL_SECTION_ENTER(daif_val);
+  daif_val = write_lock_irqsave(&_vfs_lock);
 
   rb_insert(&_mounts_by_mountpoint, sizeof(mount_entry_t), &entry,
             (int (*)(const void *, const void *,
                      void *))_vfs_cmp_mounts_by_mountpoint,
             NULL);
-
-  CRITICAL_SECTION_LEAVE(daif_val);
-
-  CRITICAL_SECTION_ENTER(daif_val);
-
   rb_insert(
       &_mounts_by_root, sizeof(mount_entry_t), &entry,
       (int (*)(const void *, const void *, void *))_vfs_cmp_mounts_by_root,
       NULL);
+  node->next = _mounts;
+  _mounts = node;
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  write_unlock_irqrestore(&_vfs_lock, daif_val);
 
   return 0;
 }
@@ -364,15 +417,14 @@ int vfs_mknod(const char *target, const char *device) {
 
   // Find the device struct.
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  const uint64_t daif_val = read_lock_irqsave(&_vfs_lock);
 
   struct device *dev = (struct device *)rb_search(
       _devices, device,
       (int (*)(const void *, const void *, void *))_vfs_cmp_name_and_device,
       NULL);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  read_unlock_irqrestore(&_vfs_lock, daif_val);
 
   if (!dev)
     return -ENODEV;
@@ -382,32 +434,25 @@ int vfs_mknod(const char *target, const char *device) {
                                   last_pathname_component, dev);
 }
 
-static void _vfs_sync_all_rec(rb_node_t *const node) {
-  if (!node)
-    return;
-
-  mount_entry_t *const entry = (mount_entry_t *)node->payload;
-  entry->mount->s_ops->sync_fs(entry->mount);
-
-  for (size_t i = 0; i < 2; i++) {
-    _vfs_sync_all_rec(node->children[i]);
-  }
-}
-
 void vfs_sync_all(void) {
-  // Enter critical section,
-  // since we require that the layout of the BST to be stable.
+  // Write back pages modified through shared mappings before the file systems
+  // flush their own buffers.
+  page_cache_sync();
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  // Syncing a file system may take long, so the lock is held only to read the
+  // head of the mount list.
 
-  _vfs_sync_all_rec(_mounts_by_mountpoint);
+  const uint64_t daif_val = read_lock_irqsave(&_vfs_lock);
+  mount_node_t *const mounts = _mounts;
+  read_unlock_irqrestore(&_vfs_lock, daif_val);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  for (mount_node_t *node = mounts; node; node = node->next) {
+    node->mount.s_ops->sync_fs(&node->mount);
+  }
 }
 
 shared_file_t *shared_file_new(struct file *const file) {
-  shared_file_t *const shared_file = malloc(sizeof(shared_file_t));
+  shared_file_t *const shared_file = obj_cache_alloc(_shared_file_cache);
   if (!shared_file)
     return NULL;
 
@@ -416,27 +461,25 @@ shared_file_t *shared_file_new(struct file *const file) {
 }
 
 shared_file_t *shared_file_clone(shared_file_t *const shared_file) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  const uint64_t daif_val = spin_lock_irqsave(&_shared_file_lock);
 
   shared_file->refcnt++;
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  spin_unlock_irqrestore(&_shared_file_lock, daif_val);
 
   return shared_file;
 }
 
 void shared_file_drop(shared_file_t *const shared_file) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  const uint64_t daif_val = spin_lock_irqsave(&_shared_file_lock);
 
   shared_file->refcnt--;
   const bool drop = shared_file->refcnt == 0;
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  spin_unlock_irqrestore(&_shared_file_lock, daif_val);
 
   if (drop) {
     vfs_close(shared_file->file);
-    free(shared_file);
+    obj_cache_free(_shared_file_cache, shared_file);
   }
 }
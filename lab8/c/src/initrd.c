@@ -44,54 +44,20 @@ static bool _initrd_is_valid(void) {
   return CPIO_NEWC_NEXT_ENTRY(entry) <= (cpio_newc_entry_t *)_initrd_end;
 }
 
-typedef struct {
-  bool start_done, end_done;
-} initrd_init_dtb_traverse_callback_arg_t;
-
-static control_flow_t _initrd_init_dtb_traverse_callback(
-    initrd_init_dtb_traverse_callback_arg_t *const arg,
-    const fdt_item_t *const node,
-    const fdt_traverse_parent_list_node_t *const parent) {
-  if (parent && !parent->parent &&
-      strcmp(FDT_NODE_NAME(node), "chosen") == 0) { // Current node is /chosen.
-    FDT_FOR_ITEM(node, item) {
-      if (FDT_TOKEN(item) == FDT_PROP) {
-        const fdt_prop_t *const prop = (const fdt_prop_t *)item->payload;
-        if (strcmp(FDT_PROP_NAME(prop), "linux,initrd-start") == 0) {
-          const uint32_t pa = rev_u32(*(const uint32_t *)FDT_PROP_VALUE(prop));
-          _initrd_start = pa_to_kernel_va(pa);
-          arg->start_done = true;
-        } else if (strcmp(FDT_PROP_NAME(prop), "linux,initrd-end") == 0) {
-          const uint32_t pa = rev_u32(*(const uint32_t *)FDT_PROP_VALUE(prop));
-          _initrd_end = pa_to_kernel_va(pa);
-          arg->end_done = true;
-        }
-
-        if (arg->start_done && arg->end_done)
-          break;
-      }
-    }
-    return CF_BREAK;
-  } else {
-    return CF_CONTINUE;
-  }
-}
-
 bool initrd_init(void) {
   _initrd_start = NULL;
 
   if (devicetree_is_init()) {
-    // Discover the initrd loading address through the devicetree.
-
-    initrd_init_dtb_traverse_callback_arg_t arg = {.start_done = false,
-                                                   .end_done = false};
-    fdt_traverse((fdt_traverse_callback_t *)_initrd_init_dtb_traverse_callback,
-                 &arg);
-    if (!(arg.start_done &&
-          arg.end_done)) { // Either the /chosen/linux,initrd-start or the
-                           // /chosen/linux,initrd-end property is missing from
-                           // the devicetree.
-      _initrd_start = NULL;
+    // Discover the initrd loading address through the devicetree. If either
+    // the /chosen/linux,initrd-start or the /chosen/linux,initrd-end property
+    // is missing, the initial ramdisk is left uninitialized.
+
+    const dt_node_t *const chosen = dt_find_node_by_path("/chosen");
+    uint32_t start_pa, end_pa;
+    if (chosen && dt_read_u32(chosen, "linux,initrd-start", &start_pa) &&
+        dt_read_u32(chosen, "linux,initrd-end", &end_pa)) {
+      _initrd_start = pa_to_kernel_va(start_pa);
+      _initrd_end = pa_to_kernel_va(end_pa);
     }
   }
 
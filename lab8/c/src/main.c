@@ -17,12 +17,15 @@
 #include "oscos/mem/malloc.h"
 #include "oscos/mem/page-alloc.h"
 #include "oscos/mem/startup-alloc.h"
+#include "oscos/mem/vm.h"
 #include "oscos/mem/vm/kernel-page-tables.h"
 #include "oscos/panic.h"
 #include "oscos/sched.h"
 #include "oscos/shell.h"
+#include "oscos/smp.h"
 #include "oscos/timer/delay.h"
 #include "oscos/timer/timeout.h"
+#include "oscos/utils/kernel-lock.h"
 #include "oscos/xcpt.h"
 
 static void _run_shell(void *const _arg) {
@@ -58,6 +61,9 @@ void main(const void *const dtb_start) {
   page_alloc_init();
   malloc_init();
   vm_setup_finer_granularity_linear_mapping();
+  if (!vm_init()) {
+    PANIC("Cannot initialize virtual memory: out of memory");
+  }
 
   // Initialize miscellaneous subsystems.
   mailbox_init();
@@ -71,6 +77,10 @@ void main(const void *const dtb_start) {
 
   // Initialize VFS.
 
+  if (!vfs_init()) {
+    PANIC("Cannot initialize VFS: out of memory");
+  }
+
   sd_init();
 
   int vfs_op_result;
@@ -121,6 +131,14 @@ void main(const void *const dtb_start) {
 
   thread_create(_run_shell, NULL);
 
+  // Start the secondary cores. From now on, kernel code runs with the kernel
+  // lock held.
+
+  XCPT_MASK_ALL();
+  kernel_lock_acquire();
+  XCPT_UNMASK_ALL();
+  smp_start_secondary_cores();
+
   sched_setup_periodic_scheduling();
   idle();
 }
@@ -0,0 +1,87 @@
+#include "oscos/mem/cache.h"
+
+#include <stdint.h>
+
+static size_t _dcache_line_size(void) {
+  uint64_t ctr_val;
+  __asm__("mrs %0, ctr_el0" : "=r"(ctr_val));
+
+  // CTR_EL0.DminLine is the log2 of the number of words in the smallest data
+  // cache line.
+  return (size_t)4 << ((ctr_val >> 16) & 0xf);
+}
+
+static size_t _icache_line_size(void) {
+  uint64_t ctr_val;
+  __asm__("mrs %0, ctr_el0" : "=r"(ctr_val));
+
+  // CTR_EL0.IminLine is the log2 of the number of words in the smallest
+  // instruction cache line.
+  return (size_t)4 << (ctr_val & 0xf);
+}
+
+void cache_clean_range(const void *const start, const size_t len) {
+  const size_t line_size = _dcache_line_size();
+  const uintptr_t end = (uintptr_t)start + len;
+
+  for (uintptr_t line = (uintptr_t)start & ~(line_size - 1); line < end;
+       line += line_size) {
+    __asm__ __volatile__("dc cvac, %0" : : "r"(line) : "memory");
+  }
+  __asm__ __volatile__("dsb sy" : : : "memory");
+}
+
+void cache_invalidate_range(void *const start, const size_t len) {
+  const size_t line_size = _dcache_line_size();
+  const uintptr_t end = (uintptr_t)start + len;
+
+  for (uintptr_t line = (uintptr_t)start & ~(line_size - 1); line < end;
+       line += line_size) {
+    if (line < (uintptr_t)start || line + line_size > end) {
+      // The cache line is only partially covered by the range. Clean it too so
+      // that the data outside of the range are not lost.
+      __asm__ __volatile__("dc civac, %0" : : "r"(line) : "memory");
+    } else {
+      __asm__ __volatile__("dc ivac, %0" : : "r"(line) : "memory");
+    }
+  }
+  __asm__ __volatile__("dsb sy" : : : "memory");
+}
+
+void cache_clean_invalidate_range(const void *const start, const size_t len) {
+  const size_t line_size = _dcache_line_size();
+  const uintptr_t end = (uintptr_t)start + len;
+
+  for (uintptr_t line = (uintptr_t)start & ~(line_size - 1); line < end;
+       line += line_size) {
+    __asm__ __volatile__("dc civac, %0" : : "r"(line) : "memory");
+  }
+  __asm__ __volatile__("dsb sy" : : : "memory");
+}
+
+void cache_sync_icache_range(const void *const start, const size_t len) {
+  const uintptr_t end = (uintptr_t)start + len;
+
+  // Clean the data cache to the point of unification, so that instruction
+  // fetches observe the new data.
+
+  const size_t dcache_line_size = _dcache_line_size();
+  for (uintptr_t line = (uintptr_t)start & ~(dcache_line_size - 1); line < end;
+       line += dcache_line_size) {
+    __asm__ __volatile__("dc cvau, %0" : : "r"(line) : "memory");
+  }
+  __asm__ __volatile__("dsb ish" : : : "memory");
+
+  // Invalidate stale instructions.
+
+  const size_t icache_line_size = _icache_line_size();
+  for (uintptr_t line = (uintptr_t)start & ~(icache_line_size - 1); line < end;
+       line += icache_line_size) {
+    __asm__ __volatile__("ic ivau, %0" : : "r"(line) : "memory");
+  }
+  __asm__ __volatile__("dsb ish\n"
+                       "isb"
+                       :
+                       :
+                       : "memory");
+}
@@ -4,17 +4,45 @@
 // first of the three principle aims, namely, to help eliminate internal
 // fragmentation.
 //
-// Each slab is backed by a single page. The first 32 bytes of the page are
+// Each slab is backed by a single page. The first 64 bytes of the page are
 // reserved for bookkeeping data, while the remaining area is split into
 // equally-sized chunks that are units of allocation. There are different kinds
-// of slabs for many different slot sizes. This allocator maintains free lists
-// of slabs, one for each kind, chaining slabs of the same kind and with at
-// least one available slot together.
+// of slabs for many different slot sizes, each kind managed by a slab cache.
+// A slab cache maintains a free list of slabs, chaining slabs of its kind with
+// at least one available slot and at least one reserved slot together.
 //
-// When the last reserved slot of a slab becomes available, the slab is
-// immediately destroyed and the underlying page is returned to the page frame
-// allocator. This design causes thrashing on certain allocation/deallocation
-// patterns, but it keeps the code simple.
+// When the last reserved slot of a slab becomes available, the slab is moved to
+// the slab cache's list of empty slabs instead of being destroyed immediately,
+// so that allocation/deallocation patterns that repeatedly create and destroy
+// a slab, e.g., forking and reaping processes, do not thrash the page frame
+// allocator. At most `MAX_N_EMPTY_SLABS` empty slabs are kept per slab cache;
+// beyond that, empty slabs are returned to the page frame allocator.
+//
+// In front of the slabs, each slab cache has a magazine, a small stack of
+// recently freed slots. The slots in the magazine remain marked as reserved in
+// their slabs. Freeing pushes the slot onto the magazine if there is room, and
+// allocation pops a slot from the magazine if it is nonempty, so the common
+// malloc/free pair touches neither the slab bitset nor the slab free list, and
+// tends to reuse memory that is still in the cache. When the page frame
+// allocator runs out of memory, the magazines are flushed and the empty slabs
+// are destroyed before giving up.
+//
+// Each slab cache is protected by a spinlock of its own, which also protects
+// the slabs belonging to the cache. Reclaiming memory while holding the lock of
+// one cache only takes the locks of the other caches opportunistically, since
+// waiting on them could deadlock with a core reclaiming the other way round.
+//
+// Besides the slab caches backing malloc, subsystems can create named object
+// caches (see obj_cache_t *obj_cache_create(const char *, size_t, size_t,
+// void (*)(void *))) for their hot objects. An object cache is a slab cache
+// whose slot size is the exact object size rounded up to the object alignment,
+// and whose slots are optionally initialized by a constructor when the slab is
+// created. As with Bonwick's slab allocator, objects must be returned to the
+// cache in their constructed state, so that they can be recycled without
+// re-initialization. Since a slab records the slab cache it belongs to,
+// void free(void *) works on objects allocated from an object cache as well.
+// Object caches are never destroyed, so the list of them is traversed without
+// locking.
 //
 // Large allocation requests bypass the slab allocator and goes directly to the
 // page frame allocator. The allocated memory is appropriately tagged so that
@@ -37,9 +65,17 @@
 #include "oscos/libc/string.h"
 #include "oscos/mem/page-alloc.h"
 #include "oscos/mem/vm.h"
+#include "oscos/utils/align.h"
 #include "oscos/utils/critical-section.h"
+#include "oscos/utils/lock.h"
 #include "oscos/utils/math.h"
 
+/// \brief The capacity of the magazine of each slab cache.
+#define MAGAZINE_SIZE 16
+
+/// \brief The maximum number of empty slabs each slab cache keeps.
+#define MAX_N_EMPTY_SLABS 2
+
 /// \brief A node of a doubly-linked list.
 typedef struct list_node_t {
   struct list_node_t *prev, *next;
@@ -53,9 +89,35 @@ typedef struct {
   uint8_t slot_size;
 } slab_metadata_t;
 
+/// \brief Slab cache.
+typedef struct slab_cache_t {
+  /// \brief Protects the slab cache and its slabs.
+  spinlock_t lock;
+  /// \brief Head of the free list of slabs.
+  list_node_t free_list;
+  /// \brief Head of the list of empty slabs.
+  list_node_t empty_list;
+  /// \brief The number of slabs on `empty_list`.
+  size_t n_empty_slabs;
+  /// \brief The metadata of the slabs.
+  slab_metadata_t metadata;
+  /// \brief The number of slots in `magazine`.
+  size_t magazine_len;
+  /// \brief Recently freed slots.
+  void *magazine[MAGAZINE_SIZE];
+  /// \brief Usage statistics.
+  malloc_class_stats_t stats;
+  /// \brief The name. NULL for the slab caches backing malloc.
+  const char *name;
+  /// \brief The constructor of the slots, or NULL.
+  void (*ctor)(void *obj);
+  /// \brief The next object cache.
+  struct slab_cache_t *next;
+} slab_cache_t;
+
 /// \brief Slab (or not).
 typedef struct {
-  /// \brief Node of the free list.
+  /// \brief Node of the free list or the list of empty slabs.
   ///
   /// If `free_list_node.prev` is NULL, then this "slab" is in fact not a slab
   /// but a memory allocated for a large allocation request.
@@ -63,10 +125,8 @@ typedef struct {
   /// This field is put in the first position, so that obtaining a slab_t * from
   /// a pointer to its `free_list_node` field is a no-op.
   list_node_t free_list_node;
-  /// \brief Pointer to the head of the free list of the slabs of the same kind.
-  ///
-  /// This is used when the slab adds itself to the free list.
-  list_node_t *free_list_head;
+  /// \brief The slab cache the slab belongs to.
+  slab_cache_t *cache;
   /// \brief Metadata.
   slab_metadata_t metadata;
   /// \brief The number of reserved slots.
@@ -105,11 +165,33 @@ static const slab_metadata_t SLAB_METADATA[] = {
 ///        size is more than which is considered a large allocation request.
 #define LARGE_ALLOC_THRESHOLD 126
 
-/// \brief Free lists of slabs for each slab type.
-static list_node_t _slab_free_lists[N_SLAB_TYPES];
+/// \brief The size of the area of a slab for the slots in bytes.
+#define SLAB_SLOTS_SIZE ((1 << PAGE_ORDER) - offsetof(slab_t, slots))
+
+/// \brief The maximum number of slots a slab can hold.
+#define SLAB_MAX_N_SLOTS 252
+
+/// \brief Slab caches for each slab type.
+static slab_cache_t _slab_caches[N_SLAB_TYPES];
+
+/// \brief Linked list of the object caches.
+///
+/// New object caches are published with a store-release, so readers must load
+/// the head with a load-acquire (see `_obj_caches_head`).
+static slab_cache_t *_obj_caches = NULL;
+
+/// \brief Serializes insertions into `_obj_caches`.
+static spinlock_t _obj_caches_lock;
+
+/// \brief Gets the head of the list of the object caches.
+static slab_cache_t *_obj_caches_head(void) {
+  slab_cache_t *head;
+  __asm__ __volatile__("ldar %0, %1" : "=r"(head) : "Q"(_obj_caches));
+  return head;
+}
 
 /// \brief Gets the slab type ID (the index that can be used to index
-///        `SLAB_METADATA` or the free list) from the size of the allocation
+///        `SLAB_METADATA` or the slab caches) from the size of the allocation
 ///        request.
 ///
 /// \param n_units The size of the allocation request in numbers of "allocation
@@ -121,39 +203,57 @@ static size_t _get_slab_type_id(const size_t n_units) {
   return n_units <= 16 ? n_units - 1 : N_SLAB_TYPES + 1 - 252 / n_units;
 }
 
-// Slab operations.
+// List operations.
 
-/// \brief Adds a slab to its free list.
-///
-/// The `free_list_head` field of \p slab must be initialized and \p slab must
-/// not have been on any free list.
+static void _list_init(list_node_t *const head) {
+  head->prev = head->next = head;
+}
+
+static bool _list_is_empty(const list_node_t *const head) {
+  return head->next == head;
+}
+
+/// \brief Adds a node to the front of a list.
 ///
 /// This function is safe to call only within a critical section.
-static void _add_slab_to_free_list(slab_t *const slab) {
-  list_node_t *const free_list_first_entry = slab->free_list_head->next;
-  slab->free_list_node.next = free_list_first_entry;
-  free_list_first_entry->prev = &slab->free_list_node;
-  slab->free_list_node.prev = slab->free_list_head;
-  slab->free_list_head->next = &slab->free_list_node;
+static void _list_push(list_node_t *const head, list_node_t *const node) {
+  list_node_t *const first_entry = head->next;
+  node->next = first_entry;
+  first_entry->prev = node;
+  node->prev = head;
+  head->next = node;
 }
 
-/// \brief Removes a slab from its free list.
-///
-/// \p slab must have been on a free list.
+/// \brief Removes a node from its list.
 ///
 /// This function is safe to call only within a critical section.
-static void _remove_slab_from_free_list(slab_t *const slab) {
-  slab->free_list_node.prev->next = slab->free_list_node.next;
-  slab->free_list_node.next->prev = slab->free_list_node.prev;
+static void _list_remove(list_node_t *const node) {
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
 }
 
-/// \brief Allocates a new slab and adds it onto its free list.
+// Slab operations.
+
+/// \brief Allocates a page for a slab or a large allocation request.
+///
+/// If the page frame allocator is out of memory, the memory cached by the slab
+/// caches is reclaimed and the allocation is retried.
 ///
 /// This function is safe to call only within a critical section.
-static slab_t *_alloc_slab(const size_t slab_type_id) {
+///
+/// \param order The order of the block.
+/// \param held_cache The slab cache whose lock the caller holds, or NULL.
+static spage_id_t _alloc_pages_reclaiming(size_t order,
+                                          slab_cache_t *held_cache);
+
+/// \brief Allocates a new slab and adds it onto the free list of its slab
+///        cache.
+///
+/// The lock of the slab cache must be held.
+static slab_t *_alloc_slab(slab_cache_t *const cache) {
   // Allocate space for the slab.
 
-  const spage_id_t page = alloc_pages_unlocked(0);
+  const spage_id_t page = _alloc_pages_reclaiming(0, cache);
   if (page < 0)
     return NULL;
 
@@ -166,7 +266,7 @@ static slab_t *_alloc_slab(const size_t slab_type_id) {
     // (In practice, this code path is never taken.)
 
     const spage_id_t another_page = alloc_pages_unlocked(0);
-    free_pages(page);
+    free_pages_unlocked(page);
     if (another_page < 0) {
       return NULL;
     }
@@ -176,34 +276,52 @@ static slab_t *_alloc_slab(const size_t slab_type_id) {
 
   // Initialize the fields.
 
-  slab->free_list_head = &_slab_free_lists[slab_type_id];
-  slab->metadata = SLAB_METADATA[slab_type_id];
+  slab->cache = cache;
+  slab->metadata = cache->metadata;
   slab->n_slots_reserved = 0;
   memset(slab->slots_reserved_bitset, 0, sizeof(slab->slots_reserved_bitset));
-  _add_slab_to_free_list(slab);
+  _list_push(&cache->free_list, &slab->free_list_node);
+
+  if (cache->ctor) {
+    for (size_t i = 0; i < slab->metadata.n_slots; i++) {
+      cache->ctor(slab->slots + i * (slab->metadata.slot_size * 16));
+    }
+  }
+
+  cache->stats.n_slabs++;
 
   return slab;
 }
 
-/// \brief Gets a slab of the given type with at least one free slot. If there
-///        is none, allocates a new one.
-static slab_t *_get_or_alloc_slab(const size_t slab_type_id) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+/// \brief Returns a slab to the page frame allocator.
+///
+/// \p slab must not be on any list.
+///
+/// The lock of the slab cache must be held.
+static void _free_slab(slab_t *const slab) {
+  slab->cache->stats.n_slabs--;
+  free_pages_unlocked(pa_to_page_id(kernel_va_to_pa(slab)));
+}
 
-  slab_t *result;
-  if (_slab_free_lists[slab_type_id].next ==
-      &_slab_free_lists[slab_type_id]) { // The free list is empty.
-    result = _alloc_slab(slab_type_id);
-  } else {
-    list_node_t *const free_list_first_entry =
-        _slab_free_lists[slab_type_id].next;
-    result = (slab_t *)((char *)free_list_first_entry -
-                        offsetof(slab_t, free_list_node));
+/// \brief Gets a slab of the given slab cache with at least one free slot. If
+///        there is none, reuses an empty slab or allocates a new one.
+///
+/// The lock of the slab cache must be held.
+static slab_t *_get_or_alloc_slab(slab_cache_t *const cache) {
+  if (!_list_is_empty(&cache->free_list))
+    return (slab_t *)((char *)cache->free_list.next -
+                      offsetof(slab_t, free_list_node));
+
+  if (!_list_is_empty(&cache->empty_list)) {
+    slab_t *const slab = (slab_t *)((char *)cache->empty_list.next -
+                                    offsetof(slab_t, free_list_node));
+    _list_remove(&slab->free_list_node);
+    cache->n_empty_slabs--;
+    _list_push(&cache->free_list, &slab->free_list_node);
+    return slab;
   }
 
-  CRITICAL_SECTION_LEAVE(daif_val);
-  return result;
+  return _alloc_slab(cache);
 }
 
 /// \brief Gets the index of the first free slot of the given slab.
@@ -227,11 +345,10 @@ static size_t _get_first_free_slot_ix(const slab_t *const slab) {
 
 /// \brief Allocates a slot from the given slab.
 ///
-/// \p slab must have at least one free slot.
+/// \p slab must be on the free list of its slab cache.
+///
+/// The lock of the slab cache must be held.
 static void *_alloc_from_slab(slab_t *const slab) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
-
   const size_t free_slot_ix = _get_first_free_slot_ix(slab);
 
   // Mark the `free_slot_ix`th slot as reserved.
@@ -240,31 +357,31 @@ static void *_alloc_from_slab(slab_t *const slab) {
   slab->slots_reserved_bitset[free_slot_ix / 64] |= (uint64_t)1
                                                     << (free_slot_ix % 64);
 
-  // Remove itself from its free list if there are no free slots.
+  // Remove itself from the free list if there are no free slots.
 
   if (slab->n_slots_reserved == slab->metadata.n_slots) {
-    _remove_slab_from_free_list(slab);
+    _list_remove(&slab->free_list_node);
   }
 
-  CRITICAL_SECTION_LEAVE(daif_val);
   return slab->slots + free_slot_ix * (slab->metadata.slot_size * 16);
 }
 
 /// \brief Frees a slot to the given slab.
 ///
+/// The lock of the slab cache must be held.
+///
 /// \param slab The slab.
 /// \param ptr The pointer to the slot.
 static void _free_to_slab(slab_t *const slab, void *const ptr) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  slab_cache_t *const cache = slab->cache;
 
   const size_t slot_ix = ((uintptr_t)ptr - (uintptr_t)slab->slots) /
                          (slab->metadata.slot_size * 16);
 
-  // Adds the slab to its free list if it wasn't on its free list.
+  // Adds the slab to the free list if it wasn't on the free list.
 
   if (slab->n_slots_reserved == slab->metadata.n_slots) {
-    _add_slab_to_free_list(slab);
+    _list_push(&cache->free_list, &slab->free_list_node);
   }
 
   // Mark the slot as available.
@@ -272,14 +389,138 @@ static void _free_to_slab(slab_t *const slab, void *const ptr) {
   slab->n_slots_reserved--;
   slab->slots_reserved_bitset[slot_ix / 64] &= ~(1ULL << (slot_ix % 64));
 
-  // Return the slab to the page frame allocator if it has no reserved slots.
+  // Keep the slab as an empty slab if there is room, or return it to the page
+  // frame allocator otherwise.
 
   if (slab->n_slots_reserved == 0) {
-    _remove_slab_from_free_list(slab);
-    free_pages(pa_to_page_id(kernel_va_to_pa(slab)));
+    _list_remove(&slab->free_list_node);
+    if (cache->n_empty_slabs < MAX_N_EMPTY_SLABS) {
+      _list_push(&cache->empty_list, &slab->free_list_node);
+      cache->n_empty_slabs++;
+    } else {
+      _free_slab(slab);
+    }
   }
+}
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+// Slab cache operations.
+
+static void _slab_cache_init(slab_cache_t *const cache,
+                             const slab_metadata_t metadata,
+                             const char *const lock_name) {
+  spin_lock_init(&cache->lock, lock_name);
+  _list_init(&cache->free_list);
+  _list_init(&cache->empty_list);
+  cache->n_empty_slabs = 0;
+  cache->metadata = metadata;
+  cache->magazine_len = 0;
+  cache->stats = (malloc_class_stats_t){.slot_size = metadata.slot_size * 16};
+  cache->name = NULL;
+  cache->ctor = NULL;
+  cache->next = NULL;
+}
+
+static void *_slab_cache_alloc(slab_cache_t *const cache) {
+  const uint64_t daif_val = spin_lock_irqsave(&cache->lock);
+
+  cache->stats.n_allocs++;
+
+  void *result;
+  if (cache->magazine_len > 0) {
+    cache->stats.n_magazine_hits++;
+    result = cache->magazine[--cache->magazine_len];
+  } else {
+    slab_t *const slab = _get_or_alloc_slab(cache);
+    result = slab ? _alloc_from_slab(slab) : NULL;
+  }
+
+  if (!result) {
+    cache->stats.n_failures++;
+  }
+
+  spin_unlock_irqrestore(&cache->lock, daif_val);
+  return result;
+}
+
+static malloc_class_stats_t
+_slab_cache_get_stats(slab_cache_t *const cache) {
+  const uint64_t daif_val = spin_lock_irqsave(&cache->lock);
+
+  malloc_class_stats_t result = cache->stats;
+  result.n_magazine_slots = cache->magazine_len;
+  result.n_empty_slabs = cache->n_empty_slabs;
+
+  spin_unlock_irqrestore(&cache->lock, daif_val);
+  return result;
+}
+
+static void _slab_cache_free(slab_cache_t *const cache, slab_t *const slab,
+                             void *const ptr) {
+  const uint64_t daif_val = spin_lock_irqsave(&cache->lock);
+
+  cache->stats.n_frees++;
+
+  if (cache->magazine_len < MAGAZINE_SIZE) {
+    cache->magazine[cache->magazine_len++] = ptr;
+  } else {
+    _free_to_slab(slab, ptr);
+  }
+
+  spin_unlock_irqrestore(&cache->lock, daif_val);
+}
+
+/// \brief Returns all memory cached by a slab cache to the page frame
+///        allocator.
+///
+/// The lock of the slab cache must be held.
+static void _slab_cache_reclaim(slab_cache_t *const cache) {
+  // Flush the magazine.
+
+  for (size_t i = 0; i < cache->magazine_len; i++) {
+    void *const ptr = cache->magazine[i];
+    _free_to_slab((slab_t *)((uintptr_t)ptr & ~((1 << PAGE_ORDER) - 1)), ptr);
+  }
+  cache->magazine_len = 0;
+
+  // Destroy the empty slabs.
+
+  while (!_list_is_empty(&cache->empty_list)) {
+    slab_t *const slab = (slab_t *)((char *)cache->empty_list.next -
+                                    offsetof(slab_t, free_list_node));
+    _list_remove(&slab->free_list_node);
+    _free_slab(slab);
+  }
+  cache->n_empty_slabs = 0;
+}
+
+/// \brief Reclaims the memory cached by a slab cache if its lock can be taken
+///        without waiting.
+///
+/// This function is safe to call only within a critical section.
+static void _slab_cache_try_reclaim(slab_cache_t *const cache,
+                                    slab_cache_t *const held_cache) {
+  if (cache == held_cache) {
+    _slab_cache_reclaim(cache);
+  } else if (spin_trylock(&cache->lock)) {
+    _slab_cache_reclaim(cache);
+    spin_unlock(&cache->lock);
+  }
+}
+
+static spage_id_t _alloc_pages_reclaiming(const size_t order,
+                                          slab_cache_t *const held_cache) {
+  const spage_id_t page = alloc_pages_unlocked(order);
+  if (page >= 0)
+    return page;
+
+  for (size_t i = 0; i < N_SLAB_TYPES; i++) {
+    _slab_cache_try_reclaim(&_slab_caches[i], held_cache);
+  }
+  for (slab_cache_t *cache = _obj_caches_head(); cache; cache = cache->next) {
+    _slab_cache_try_reclaim(cache, held_cache);
+  }
+
+  return alloc_pages_unlocked(order);
 }
 
 // Large allocation.
@@ -296,7 +537,13 @@ static void *_malloc_large(const size_t size) {
   const size_t n_pages = (actual_size + ((1 << PAGE_ORDER) - 1)) >> PAGE_ORDER;
   const size_t block_order = clog2(n_pages);
 
-  spage_id_t page = alloc_pages(block_order);
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  spage_id_t page = _alloc_pages_reclaiming(block_order, NULL);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+
   if (page < 0)
     return NULL;
 
@@ -317,11 +564,10 @@ static void _free_large(slab_t *const slab_ptr) {
 // Public functions.
 
 void malloc_init(void) {
-  // Initialize the free lists. (All free lists are initially empty.)
-
   for (size_t i = 0; i < N_SLAB_TYPES; i++) {
-    _slab_free_lists[i].prev = _slab_free_lists[i].next = &_slab_free_lists[i];
+    _slab_cache_init(&_slab_caches[i], SLAB_METADATA[i], "malloc");
   }
+  spin_lock_init(&_obj_caches_lock, "malloc: obj caches");
 }
 
 void *malloc(const size_t size) {
@@ -333,11 +579,7 @@ void *malloc(const size_t size) {
     return _malloc_large(size);
 
   const size_t slab_type_id = _get_slab_type_id(n_units);
-  slab_t *const slab = _get_or_alloc_slab(slab_type_id);
-  if (!slab)
-    return NULL;
-
-  return _alloc_from_slab(slab);
+  return _slab_cache_alloc(&_slab_caches[slab_type_id]);
 }
 
 void free(void *const ptr) {
@@ -348,6 +590,74 @@ void free(void *const ptr) {
   if (!ptr_s->free_list_node.prev) { // Not a slab.
     _free_large(ptr_s);
   } else {
-    _free_to_slab(ptr_s, ptr);
+    _slab_cache_free(ptr_s->cache, ptr_s, ptr);
+  }
+}
+
+size_t malloc_get_n_classes(void) { return N_SLAB_TYPES; }
+
+malloc_class_stats_t malloc_get_class_stats(const size_t class_id) {
+  return _slab_cache_get_stats(&_slab_caches[class_id]);
+}
+
+obj_cache_t *obj_cache_create(const char *const name, const size_t size,
+                              const size_t align, void (*const ctor)(void *)) {
+  const size_t effective_align =
+      align < alignof(max_align_t) ? alignof(max_align_t) : align;
+  if (size == 0 || (effective_align & (effective_align - 1)) != 0 ||
+      effective_align > offsetof(slab_t, slots))
+    return NULL;
+
+  const size_t slot_size = ALIGN(size, effective_align);
+  if (slot_size > SLAB_SLOTS_SIZE)
+    return NULL;
+
+  const size_t n_slots = SLAB_SLOTS_SIZE / slot_size;
+
+  slab_cache_t *const cache = malloc(sizeof(slab_cache_t));
+  if (!cache)
+    return NULL;
+
+  _slab_cache_init(
+      cache, (slab_metadata_t){.n_slots = n_slots < SLAB_MAX_N_SLOTS
+                                              ? n_slots
+                                              : SLAB_MAX_N_SLOTS,
+                               .slot_size = slot_size / 16},
+      name);
+  cache->name = name;
+  cache->ctor = ctor;
+
+  const uint64_t daif_val = spin_lock_irqsave(&_obj_caches_lock);
+
+  cache->next = _obj_caches;
+  // Publish the fully initialized cache to the lockless readers.
+  __asm__ __volatile__("stlr %1, %0"
+                       : "=Q"(_obj_caches)
+                       : "r"(cache)
+                       : "memory");
+
+  spin_unlock_irqrestore(&_obj_caches_lock, daif_val);
+
+  return cache;
+}
+
+void *obj_cache_alloc(obj_cache_t *const cache) {
+  return _slab_cache_alloc(cache);
+}
+
+void obj_cache_free(obj_cache_t *const cache, void *const obj) {
+  if (!obj)
+    return;
+
+  _slab_cache_free(
+      cache, (slab_t *)((uintptr_t)obj & ~((1 << PAGE_ORDER) - 1)), obj);
+}
+
+void obj_cache_for_each(void (*const callback)(const char *name,
+                                               malloc_class_stats_t stats,
+                                               void *arg),
+                        void *const arg) {
+  for (slab_cache_t *cache = _obj_caches_head(); cache; cache = cache->next) {
+    callback(cache->name, _slab_cache_get_stats(cache), arg);
   }
 }
@@ -33,6 +33,33 @@
 // placed right before the latter, and we use negative array indices to refer to
 // entries in the free list headers.
 //
+// Next to the page frame array, the page frame allocator also maintains the
+// page descriptor array, an array of `page_t` with one entry for each page
+// frame within the usable memory range. Unlike the page frame array, which is
+// private to the buddy system, the page descriptors are for the users of the
+// allocated pages to hang their per-page data on, e.g., reference counts. Every
+// page descriptor is zero-initialized, and the page frame allocator itself
+// never touches them after initialization.
+//
+// In front of the buddy system, each core has per-CPU page lists (PCP lists),
+// one for each order up to `PCP_MAX_ORDER`, caching blocks that the buddy
+// system considers reserved. Small allocations pop a block from the PCP list of
+// the current core and small frees push the block back, so the fast path
+// neither splits nor coalesces and touches only per-CPU data. A PCP list is
+// refilled from the buddy system `PCP_BATCH[order]` blocks at a time when it is
+// empty, and drained by the same amount when it reaches `PCP_HIGH[order]`
+// blocks. Blocks are allocated from and freed to the top of the list, so that
+// the most recently freed, and thus most likely cache-hot, blocks are reused
+// first, while draining returns the cold blocks at the bottom. Since blocks on
+// the PCP lists are not coalesced, all PCP lists are drained before an
+// allocation fails. So is the pool of pre-zeroed pages, which would otherwise
+// hold on to its pages under memory pressure.
+//
+// The buddy system and each PCP list are protected by spinlocks of their own,
+// so that the cores contend only when they fall back to the buddy system. A PCP
+// lock may be held while taking the buddy lock, but not the other way round,
+// and no one holds two PCP locks at once.
+//
 // [spec]: https://oscapstone.github.io/labs/lab4.html
 
 #include "oscos/mem/page-alloc.h"
@@ -40,10 +67,14 @@
 #include "oscos/console.h"
 #include "oscos/devicetree.h"
 #include "oscos/initrd.h"
+#include "oscos/libc/string.h"
 #include "oscos/mem/startup-alloc.h"
 #include "oscos/mem/vm.h"
+#include "oscos/mem/zero-pool.h"
 #include "oscos/panic.h"
+#include "oscos/utils/core-id.h"
 #include "oscos/utils/critical-section.h"
+#include "oscos/utils/lock.h"
 
 // `MAX_BLOCK_ORDER` can be changed to any positive integer up to and
 // including 25 without modification to the code.
@@ -60,6 +91,35 @@ typedef struct {
 
 static pa_t _pa_start;
 static page_frame_array_entry_t *_page_frame_array, *_free_list;
+static page_t *_pages;
+static size_t _n_pages;
+
+// Per-CPU page lists.
+
+/// \brief The maximum number of blocks on a PCP list of each order.
+static const size_t PCP_HIGH[PCP_MAX_ORDER + 1] = {64, 16, 8};
+/// \brief The number of blocks to move at once between a PCP list of each
+///        order and the buddy system.
+static const size_t PCP_BATCH[PCP_MAX_ORDER + 1] = {16, 4, 2};
+
+#define PCP_MAX_HIGH 64
+
+typedef struct {
+  size_t count;
+  /// \brief The blocks, bottom (coldest) first.
+  page_id_t pages[PCP_MAX_HIGH];
+} pcp_list_t;
+
+typedef struct {
+  spinlock_t lock;
+  pcp_list_t lists[PCP_MAX_ORDER + 1];
+  page_alloc_pcp_stats_t stats;
+} pcp_t;
+
+static pcp_t _pcps[N_CORES];
+
+/// \brief Protects the page frame array and the free lists.
+static spinlock_t _buddy_lock;
 
 // Utilities used by page_alloc_init.
 
@@ -86,60 +146,59 @@ static void _mark_region(const pa_range_t region_limit, const pa_range_t region,
   }
 }
 
-// _get_usable_pa_range
+// _dt_read_reg_pa_range
 
-typedef struct {
-  fdt_n_address_size_cells_t root_n_cells;
-  pa_range_t range;
-} get_usable_pa_range_fdt_traverse_arg_t;
-
-static control_flow_t _get_usable_pa_range_fdt_traverse_callback(
-    get_usable_pa_range_fdt_traverse_arg_t *const arg,
-    const fdt_item_t *const node,
-    const fdt_traverse_parent_list_node_t *const parent) {
-  if (!parent) { // Current node is the root node.
-    arg->root_n_cells = fdt_get_n_address_size_cells(node);
-  } else if (parent && !parent->parent &&
-             strncmp(FDT_NODE_NAME(node), "memory@", 7) ==
-                 0) { // Current node is /memory@...
-    FDT_FOR_ITEM(node, item) {
-      if (FDT_TOKEN(item) == FDT_PROP) {
-        const fdt_prop_t *const prop = (const fdt_prop_t *)item->payload;
-        if (strcmp(FDT_PROP_NAME(prop), "reg") == 0) {
-          const fdt_read_reg_result_t read_result =
-              fdt_read_reg(prop, arg->root_n_cells);
-          const pa_t start = read_result.value.address,
-                     end = start + read_result.value.size;
-          if (read_result.address_overflow || read_result.size_overflow ||
-              read_result.value.address > PA_MAX ||
-              read_result.value.size > PA_MAX || end < start)
-            PANIC(
-                "page-alloc: reg property value overflow in devicetree node %s",
-                FDT_NODE_NAME(node));
-
-          if (start < arg->range.start) {
-            arg->range.start = start;
-          }
-          if (end > arg->range.end) {
-            arg->range.end = end;
-          }
-        }
-      }
-    }
-  }
+/// \brief Reads an entry of the reg property of a devicetree node as a physical
+///        address range.
+///
+/// \param node The devicetree node.
+/// \param index The index of the entry.
+/// \param range Where to store the physical address range.
+/// \return Whether or not the entry exists.
+static bool _dt_read_reg_pa_range(const dt_node_t *const node,
+                                  const size_t index, pa_range_t *const range) {
+  fdt_read_reg_result_t read_result;
+  if (!dt_read_reg(node, index, &read_result))
+    return false;
+
+  const pa_t start = read_result.value.address,
+             end = start + read_result.value.size;
+  if (read_result.address_overflow || read_result.size_overflow ||
+      read_result.value.address > PA_MAX || read_result.value.size > PA_MAX ||
+      end < start)
+    PANIC("page-alloc: reg property value overflow in devicetree node %s",
+          node->name);
+
+  *range = (pa_range_t){.start = start, .end = end};
+  return true;
+}
 
-  return CF_CONTINUE;
+/// \brief Returns whether or not a devicetree node is a /memory@... node.
+static bool _dt_is_memory_node(const dt_node_t *const node) {
+  return strncmp(node->name, "memory@", 7) == 0;
 }
 
+// _get_usable_pa_range
+
 /// \brief Gets the physical address range containing all usable memory regions.
 static pa_range_t _get_usable_pa_range(void) {
   if (devicetree_is_init()) {
-    get_usable_pa_range_fdt_traverse_arg_t arg = {
-        .range = {.start = PA_MAX, .end = 0}};
-    fdt_traverse(
-        (fdt_traverse_callback_t *)_get_usable_pa_range_fdt_traverse_callback,
-        &arg);
-    return arg.range;
+    pa_range_t result = {.start = PA_MAX, .end = 0};
+    DT_FOR_CHILD(dt_get_root(), node) {
+      if (!_dt_is_memory_node(node))
+        continue;
+
+      pa_range_t range;
+      for (size_t i = 0; _dt_read_reg_pa_range(node, i, &range); i++) {
+        if (range.start < result.start) {
+          result.start = range.start;
+        }
+        if (range.end > result.end) {
+          result.end = range.end;
+        }
+      }
+    }
+    return result;
   } else {
     return (pa_range_t){.start = 0x0, .end = 0x3b400000};
   }
@@ -147,45 +206,6 @@ static pa_range_t _get_usable_pa_range(void) {
 
 // _mark_usable_regions
 
-typedef struct {
-  pa_range_t usable_pa_range;
-  fdt_n_address_size_cells_t root_n_cells;
-} mark_usable_regions_fdt_traverse_arg_t;
-
-static control_flow_t _mark_usable_regions_fdt_traverse_callback(
-    mark_usable_regions_fdt_traverse_arg_t *const arg,
-    const fdt_item_t *const node,
-    const fdt_traverse_parent_list_node_t *const parent) {
-  if (!parent) { // Current node is the root node.
-    arg->root_n_cells = fdt_get_n_address_size_cells(node);
-  } else if (parent && !parent->parent &&
-             strncmp(FDT_NODE_NAME(node), "memory@", 7) ==
-                 0) { // Current node is /memory@...
-    FDT_FOR_ITEM(node, item) {
-      if (FDT_TOKEN(item) == FDT_PROP) {
-        const fdt_prop_t *const prop = (const fdt_prop_t *)item->payload;
-        if (strcmp(FDT_PROP_NAME(prop), "reg") == 0) {
-          const fdt_read_reg_result_t read_result =
-              fdt_read_reg(prop, arg->root_n_cells);
-          const pa_t start = read_result.value.address,
-                     end = start + read_result.value.size;
-          if (read_result.address_overflow || read_result.size_overflow ||
-              read_result.value.address > PA_MAX ||
-              read_result.value.size > PA_MAX || end < start)
-            PANIC(
-                "page-alloc: reg property value overflow in devicetree node %s",
-                FDT_NODE_NAME(node));
-
-          _mark_region(arg->usable_pa_range,
-                       (pa_range_t){.start = start, .end = end}, true);
-        }
-      }
-    }
-  }
-
-  return CF_CONTINUE;
-}
-
 /// \brief Marks the usable memory regions as available.
 ///
 /// \param usable_pa_range The physical address range containing all usable
@@ -193,11 +213,15 @@ static control_flow_t _mark_usable_regions_fdt_traverse_callback(
 ///                        pa_range_t _get_usable_pa_range(void).
 static void _mark_usable_regions(const pa_range_t usable_pa_range) {
   if (devicetree_is_init()) {
-    mark_usable_regions_fdt_traverse_arg_t arg = {.usable_pa_range =
-                                                      usable_pa_range};
-    fdt_traverse(
-        (fdt_traverse_callback_t *)_mark_usable_regions_fdt_traverse_callback,
-        &arg);
+    DT_FOR_CHILD(dt_get_root(), node) {
+      if (!_dt_is_memory_node(node))
+        continue;
+
+      pa_range_t range;
+      for (size_t i = 0; _dt_read_reg_pa_range(node, i, &range); i++) {
+        _mark_region(usable_pa_range, range, true);
+      }
+    }
   } else {
     _mark_region(usable_pa_range, (pa_range_t){.start = 0x0, .end = 0x3b400000},
                  true);
@@ -206,55 +230,6 @@ static void _mark_usable_regions(const pa_range_t usable_pa_range) {
 
 // _mark_reserved_regions
 
-typedef struct {
-  pa_range_t usable_pa_range;
-  const fdt_item_t *reserved_memory_node;
-  fdt_n_address_size_cells_t reserved_memory_n_cells;
-} mark_reserved_regions_fdt_traverse_arg_t;
-
-static control_flow_t _mark_reserved_regions_fdt_traverse_callback(
-    mark_reserved_regions_fdt_traverse_arg_t *const arg,
-    const fdt_item_t *const node,
-    const fdt_traverse_parent_list_node_t *const parent) {
-  if (parent && !parent->parent &&
-      strcmp(FDT_NODE_NAME(node), "reserved-memory") ==
-          0) { // Current node is /reserved-memory.
-    arg->reserved_memory_node = node;
-    arg->reserved_memory_n_cells = fdt_get_n_address_size_cells(node);
-  } else if (arg->reserved_memory_node) { // The /reserved-memory node has been
-                                          // traversed.
-    if (parent->node ==
-        arg->reserved_memory_node) { // Current node is /reserved-memory/...
-      FDT_FOR_ITEM(node, item) {
-        if (FDT_TOKEN(item) == FDT_PROP) {
-          const fdt_prop_t *const prop = (const fdt_prop_t *)item->payload;
-          if (strcmp(FDT_PROP_NAME(prop), "reg") == 0) {
-            const fdt_read_reg_result_t read_result =
-                fdt_read_reg(prop, arg->reserved_memory_n_cells);
-            const pa_t start = read_result.value.address,
-                       end = start + read_result.value.size;
-            if (read_result.address_overflow || read_result.size_overflow ||
-                read_result.value.address > PA_MAX ||
-                read_result.value.size > PA_MAX || end < start)
-              PANIC("page-alloc: reg property value overflow in devicetree "
-                    "node %s",
-                    FDT_NODE_NAME(node));
-
-            _mark_region(arg->usable_pa_range,
-                         (pa_range_t){.start = start, .end = end}, false);
-
-            break;
-          }
-        }
-      }
-    } else { // All children of the /reserved-memory node has been traversed.
-      return CF_BREAK;
-    }
-  }
-
-  return CF_CONTINUE;
-}
-
 /// \brief Marks the reserved memory regions as reserved.
 ///
 /// \param usable_pa_range The physical address range containing all usable
@@ -282,11 +257,16 @@ static void _mark_reserved_regions(const pa_range_t usable_pa_range) {
 
     // Spin tables for multicore boot, etc.
 
-    mark_reserved_regions_fdt_traverse_arg_t arg = {.usable_pa_range =
-                                                        usable_pa_range};
-    fdt_traverse(
-        (fdt_traverse_callback_t *)_mark_reserved_regions_fdt_traverse_callback,
-        &arg);
+    const dt_node_t *const reserved_memory =
+        dt_find_node_by_path("/reserved-memory");
+    if (reserved_memory) {
+      DT_FOR_CHILD(reserved_memory, node) {
+        pa_range_t range;
+        for (size_t i = 0; _dt_read_reg_pa_range(node, i, &range); i++) {
+          _mark_region(usable_pa_range, range, false);
+        }
+      }
+    }
   } else {
     // Spin tables for multicore boot.
 
@@ -317,6 +297,11 @@ static void _mark_reserved_regions(const pa_range_t usable_pa_range) {
 }
 
 void page_alloc_init(void) {
+  spin_lock_init(&_buddy_lock, "page-alloc: buddy");
+  for (size_t core_id = 0; core_id < N_CORES; core_id++) {
+    spin_lock_init(&_pcps[core_id].lock, "page-alloc: pcp");
+  }
+
   // Determine the starting and ending physical address.
 
   pa_range_t usable_pa_range = _get_usable_pa_range();
@@ -339,6 +324,12 @@ void page_alloc_init(void) {
   _page_frame_array = entries + (MAX_BLOCK_ORDER + 1);
   _free_list = entries;
 
+  // Allocate the page descriptor array.
+
+  _n_pages = (usable_pa_range.end - usable_pa_range.start) >> PAGE_ORDER;
+  _pages = startup_alloc(_n_pages * sizeof(page_t));
+  memset(_pages, 0, _n_pages * sizeof(page_t));
+
   // Initialize the page frame array. (The entire memory region is initially
   // reserved.)
 
@@ -462,7 +453,10 @@ spage_id_t alloc_pages(const size_t order) {
   return result;
 }
 
-spage_id_t alloc_pages_unlocked(const size_t order) {
+/// \brief Allocates a block of page frames from the buddy system.
+///
+/// The buddy lock must be held.
+static spage_id_t _buddy_alloc_pages(const size_t order) {
 #ifdef PAGE_ALLOC_ENABLE_LOG
   console_printf("DEBUG: page-alloc: Allocating a block of order %zu\n", order);
 #endif
@@ -535,7 +529,10 @@ void free_pages(const page_id_t page) {
   CRITICAL_SECTION_LEAVE(daif_val);
 }
 
-void free_pages_unlocked(const page_id_t page) {
+/// \brief Frees a block of page frames to the buddy system.
+///
+/// The buddy lock must be held.
+static void _buddy_free_pages(const page_id_t page) {
   const size_t order = _page_frame_array[page].order;
 
 #ifdef PAGE_ALLOC_ENABLE_LOG
@@ -575,6 +572,151 @@ void free_pages_unlocked(const page_id_t page) {
   _add_block_to_free_list(curr_page);
 }
 
+// PCP list operations.
+
+/// \brief Returns the `n_blocks` coldest blocks of a PCP list, i.e., those at
+///        the bottom of the list, to the buddy system.
+///
+/// Fewer blocks are returned if the list holds fewer than `n_blocks` blocks.
+///
+/// The lock of the PCP list must be held.
+static void _pcp_drain(pcp_t *const pcp, const size_t order,
+                       const size_t n_blocks) {
+  pcp_list_t *const list = &pcp->lists[order];
+  const size_t n_drained = n_blocks < list->count ? n_blocks : list->count;
+
+  spin_lock(&_buddy_lock);
+  for (size_t i = 0; i < n_drained; i++) {
+    _buddy_free_pages(list->pages[i]);
+  }
+  spin_unlock(&_buddy_lock);
+  memmove(list->pages, list->pages + n_drained,
+          (list->count - n_drained) * sizeof(page_id_t));
+  list->count -= n_drained;
+
+  pcp->stats.n_drains++;
+}
+
+/// \brief Returns every block on every PCP list to the buddy system.
+///
+/// Interrupts must be masked, and no lock may be held.
+static void _pcp_drain_all(void) {
+  for (size_t core_id = 0; core_id < N_CORES; core_id++) {
+    pcp_t *const pcp = &_pcps[core_id];
+    spin_lock(&pcp->lock);
+    for (size_t order = 0; order <= PCP_MAX_ORDER; order++) {
+      if (pcp->lists[order].count != 0) {
+        _pcp_drain(pcp, order, pcp->lists[order].count);
+      }
+    }
+    spin_unlock(&pcp->lock);
+  }
+}
+
+/// \brief Refills an empty PCP list from the buddy system.
+///
+/// The lock of the PCP list must be held.
+static void _pcp_refill(pcp_t *const pcp, const size_t order) {
+  pcp_list_t *const list = &pcp->lists[order];
+
+  spin_lock(&_buddy_lock);
+  while (list->count < PCP_BATCH[order]) {
+    const spage_id_t page = _buddy_alloc_pages(order);
+    if (page < 0)
+      break;
+    list->pages[list->count++] = page;
+  }
+  spin_unlock(&_buddy_lock);
+
+  pcp->stats.n_refills++;
+}
+
+/// \brief Allocates a block of page frames from the buddy system, draining the
+///        zero pool and the PCP lists if it is exhausted.
+///
+/// Interrupts must be masked, and no lock may be held.
+static spage_id_t _buddy_alloc_pages_draining(const size_t order) {
+  spin_lock(&_buddy_lock);
+  spage_id_t result = _buddy_alloc_pages(order);
+  spin_unlock(&_buddy_lock);
+  if (result >= 0)
+    return result;
+
+  // The zero pool frees its pages onto the PCP lists, so drain it first.
+  zero_pool_drain();
+  _pcp_drain_all();
+
+  spin_lock(&_buddy_lock);
+  result = _buddy_alloc_pages(order);
+  spin_unlock(&_buddy_lock);
+  return result;
+}
+
+spage_id_t alloc_pages_unlocked(const size_t order) {
+  if (order > PCP_MAX_ORDER)
+    return _buddy_alloc_pages_draining(order);
+
+  pcp_t *const pcp = &_pcps[get_core_id()];
+  pcp_list_t *const list = &pcp->lists[order];
+
+  spin_lock(&pcp->lock);
+
+  pcp->stats.n_allocs++;
+
+  if (list->count != 0) {
+    pcp->stats.n_hits++;
+  } else {
+    _pcp_refill(pcp, order);
+    if (list->count == 0) {
+      // Draining locks every PCP list, including ours.
+      spin_unlock(&pcp->lock);
+      return _buddy_alloc_pages_draining(order);
+    }
+  }
+
+  const page_id_t result = list->pages[--list->count];
+  spin_unlock(&pcp->lock);
+  return result;
+}
+
+void free_pages_unlocked(const page_id_t page) {
+  // The order of a reserved block is stable until the block is freed.
+  const size_t order = _page_frame_array[page].order;
+  if (order > PCP_MAX_ORDER) {
+    spin_lock(&_buddy_lock);
+    _buddy_free_pages(page);
+    spin_unlock(&_buddy_lock);
+    return;
+  }
+
+  pcp_t *const pcp = &_pcps[get_core_id()];
+  pcp_list_t *const list = &pcp->lists[order];
+
+  spin_lock(&pcp->lock);
+
+  pcp->stats.n_frees++;
+
+  if (list->count == PCP_HIGH[order]) {
+    _pcp_drain(pcp, order, PCP_BATCH[order]);
+  }
+  list->pages[list->count++] = page;
+
+  spin_unlock(&pcp->lock);
+}
+
+page_alloc_pcp_stats_t page_alloc_get_pcp_stats(const size_t core_id) {
+  pcp_t *const pcp = &_pcps[core_id];
+  const uint64_t daif_val = spin_lock_irqsave(&pcp->lock);
+
+  page_alloc_pcp_stats_t result = pcp->stats;
+  for (size_t order = 0; order <= PCP_MAX_ORDER; order++) {
+    result.n_blocks[order] = pcp->lists[order].count;
+  }
+
+  spin_unlock_irqrestore(&pcp->lock, daif_val);
+  return result;
+}
+
 static void _mark_pages_rec(const page_id_range_t range, const bool is_avail,
                             const size_t order,
                             const page_id_range_t block_range) {
@@ -642,9 +784,15 @@ void mark_pages_unlocked(const page_id_range_t range, const bool is_avail) {
                  range.start, range.end, is_avail ? "available" : "reserved");
 #endif
 
+  spin_lock(&_buddy_lock);
   // TODO: Switch to a non-recursive implementation.
   _mark_pages_rec(range, is_avail, MAX_BLOCK_ORDER,
                   (page_id_range_t){.start = 0, .end = 1 << MAX_BLOCK_ORDER});
+  spin_unlock(&_buddy_lock);
+}
+
+page_t *page_get(const page_id_t page) {
+  return page < _n_pages ? &_pages[page] : NULL;
 }
 
 pa_t page_id_to_pa(const page_id_t page) {
@@ -0,0 +1,422 @@
+#include "oscos/mem/page-cache.h"
+
+#include <stdint.h>
+
+#include "oscos/libc/string.h"
+#include "oscos/mem/page-alloc.h"
+#include "oscos/mem/shared-page.h"
+#include "oscos/mem/vm.h"
+#include "oscos/sync.h"
+#include "oscos/uapi/errno.h"
+#include "oscos/uapi/unistd.h"
+#include "oscos/utils/critical-section.h"
+#include "oscos/utils/rb.h"
+
+typedef struct {
+  struct vnode *vnode;
+  size_t index;
+} page_cache_key_t;
+
+typedef struct {
+  page_cache_key_t key;
+  page_id_t page;
+  /// \brief The value of \ref _page_cache_clock when the page is last looked
+  ///        up. Used to pick the least recently used page for eviction.
+  uint64_t last_access;
+} page_cache_entry_t;
+
+/// \brief Protects the cache, which is held across file I/O.
+///
+/// Taken before the locks of the file systems. The flags of the cached pages
+/// are instead updated within critical sections, since the page fault handler
+/// marks pages dirty.
+///
+/// User buffers are never accessed with the lock held: touching one may fault
+/// in a file-backed page, and the fault handler takes the lock as well.
+static mutex_t _page_cache_lock = MUTEX_INIT(_page_cache_lock);
+
+static rb_node_t *_page_cache_entries = NULL;
+static uint64_t _page_cache_clock = 0;
+static page_cache_stats_t _page_cache_stats;
+
+static int _page_cache_cmp_keys(const page_cache_key_t *const k1,
+                                const page_cache_key_t *const k2) {
+  if (k1->vnode < k2->vnode)
+    return -1;
+  if (k1->vnode > k2->vnode)
+    return 1;
+  if (k1->index < k2->index)
+    return -1;
+  if (k1->index > k2->index)
+    return 1;
+  return 0;
+}
+
+static int _page_cache_cmp_entries(const page_cache_entry_t *const e1,
+                                   const page_cache_entry_t *const e2,
+                                   void *const _arg) {
+  (void)_arg;
+  return _page_cache_cmp_keys(&e1->key, &e2->key);
+}
+
+static int _page_cache_cmp_key_and_entry(const page_cache_key_t *const key,
+                                         const page_cache_entry_t *const entry,
+                                         void *const _arg) {
+  (void)_arg;
+  return _page_cache_cmp_keys(key, &entry->key);
+}
+
+static page_cache_entry_t *_page_cache_find(const page_cache_key_t *const key) {
+  return (page_cache_entry_t *)rb_search(
+      _page_cache_entries, key,
+      (int (*)(const void *, const void *,
+               void *))_page_cache_cmp_key_and_entry,
+      NULL);
+}
+
+/// \brief Reads a page of a file from the file system.
+static int _page_cache_fill(struct vnode *const vnode, const size_t index,
+                            void *const kernel_va) {
+  if (vnode->v_ops->read_page)
+    return vnode->v_ops->read_page(vnode, index, kernel_va);
+
+  // Fall back to reading through a file of our own, so that no file position
+  // visible to anyone else is moved.
+
+  struct file *file;
+  const int open_result = vfs_open_vnode(vnode, &file);
+  if (open_result < 0)
+    return open_result;
+
+  int result = 0;
+
+  const long seek_result =
+      vfs_lseek64(file, (long)(index << PAGE_ORDER), SEEK_SET);
+  if (seek_result < 0) {
+    result = seek_result;
+    goto end;
+  }
+
+  size_t n_bytes_read = 0;
+  while (n_bytes_read < 1 << PAGE_ORDER) {
+    const int n_bytes_just_read =
+        file->f_ops->read(file, (char *)kernel_va + n_bytes_read,
+                          (1 << PAGE_ORDER) - n_bytes_read);
+    if (n_bytes_just_read < 0) {
+      result = n_bytes_just_read;
+      goto end;
+    }
+    if (n_bytes_just_read == 0)
+      break;
+
+    n_bytes_read += n_bytes_just_read;
+  }
+
+  memset((char *)kernel_va + n_bytes_read, 0, (1 << PAGE_ORDER) - n_bytes_read);
+
+end:
+  vfs_close(file);
+  return result;
+}
+
+/// \brief Writes a page back to its file.
+static int _page_cache_write_page(const page_cache_entry_t *const entry) {
+  struct vnode *const vnode = entry->key.vnode;
+
+  // Don't extend the file with the zero-filled tail of its last page.
+  const long file_size = vnode->v_ops->get_size(vnode);
+  if (file_size < 0)
+    return file_size;
+  const size_t offset = entry->key.index << PAGE_ORDER;
+  if (offset >= (size_t)file_size)
+    return 0;
+  size_t len = (size_t)file_size - offset;
+  if (len > 1 << PAGE_ORDER) {
+    len = 1 << PAGE_ORDER;
+  }
+
+  struct file *file;
+  const int open_result = vfs_open_vnode(vnode, &file);
+  if (open_result < 0)
+    return open_result;
+
+  int result = 0;
+
+  const long seek_result = vfs_lseek64(file, (long)offset, SEEK_SET);
+  if (seek_result < 0) {
+    result = seek_result;
+    goto end;
+  }
+
+  // Call the file operation directly, since `vfs_write` would copy the data
+  // back into the very same page.
+  const char *const kernel_va = pa_to_kernel_va(page_id_to_pa(entry->page));
+  size_t n_bytes_written = 0;
+  while (n_bytes_written < len) {
+    const int n_bytes_just_written = file->f_ops->write(
+        file, kernel_va + n_bytes_written, len - n_bytes_written);
+    if (n_bytes_just_written < 0) {
+      result = n_bytes_just_written;
+      goto end;
+    }
+    if (n_bytes_just_written == 0) {
+      result = -EIO;
+      goto end;
+    }
+
+    n_bytes_written += n_bytes_just_written;
+  }
+
+  _page_cache_stats.n_write_backs++;
+
+end:
+  vfs_close(file);
+  return result;
+}
+
+static bool _page_cache_is_unused(const page_cache_entry_t *const entry) {
+  return shared_page_getref(entry->page) == 1; // Only the cache holds it.
+}
+
+static void _page_cache_find_lru_unused_rec(
+    const rb_node_t *const node, const page_cache_entry_t **const result) {
+  if (!node)
+    return;
+
+  const page_cache_entry_t *const entry =
+      (const page_cache_entry_t *)node->payload;
+  if (_page_cache_is_unused(entry) &&
+      (!*result || entry->last_access < (*result)->last_access)) {
+    *result = entry;
+  }
+
+  for (size_t i = 0; i < 2; i++) {
+    _page_cache_find_lru_unused_rec(node->children[i], result);
+  }
+}
+
+/// \brief Evicts a page from the cache, writing it back first if it is dirty.
+///
+/// \return Whether or not a page is evicted. false if all pages are in use or
+///         if the page cannot be written back.
+static bool _page_cache_evict(const page_cache_entry_t *const entry) {
+  if (page_get(entry->page)->flags & PAGE_FLAG_DIRTY &&
+      _page_cache_write_page(entry) < 0)
+    return false;
+
+  const page_cache_entry_t evicted = *entry;
+  rb_delete(&_page_cache_entries, &evicted.key,
+            (int (*)(const void *, const void *,
+                     void *))_page_cache_cmp_key_and_entry,
+            NULL);
+  shared_page_decref(evicted.page);
+  evicted.key.vnode->n_cached_pages--;
+
+  _page_cache_stats.n_pages--;
+  _page_cache_stats.n_evictions++;
+  return true;
+}
+
+static void _page_cache_evict_lru(void) {
+  const page_cache_entry_t *entry = NULL;
+  _page_cache_find_lru_unused_rec(_page_cache_entries, &entry);
+  if (entry) {
+    _page_cache_evict(entry);
+  }
+}
+
+/// \brief Gets the page caching a page of a file, reading it in on a miss.
+///
+/// This function is safe to call only with \ref _page_cache_lock held.
+static spage_id_t _page_cache_get_page_locked(struct vnode *const vnode,
+                                              const size_t index) {
+  const page_cache_key_t key = {.vnode = vnode, .index = index};
+
+  page_cache_entry_t *const entry = _page_cache_find(&key);
+  if (entry) {
+    _page_cache_stats.n_hits++;
+    entry->last_access = _page_cache_clock++;
+    shared_page_incref(entry->page);
+    return entry->page;
+  }
+
+  // Miss.
+
+  _page_cache_stats.n_misses++;
+
+  if (_page_cache_stats.n_pages >= PAGE_CACHE_MAX_PAGES) {
+    _page_cache_evict_lru();
+  }
+
+  const spage_id_t page = shared_page_alloc();
+  if (page < 0)
+    return page;
+
+  // Count the page before reading it in, so that a write to the file that
+  // `vfs_write` does not pass on to the cache is never missed by the read.
+  vnode->n_cached_pages++;
+
+  const int fill_result =
+      _page_cache_fill(vnode, index, pa_to_kernel_va(page_id_to_pa(page)));
+  if (fill_result < 0) {
+    vnode->n_cached_pages--;
+    shared_page_decref(page);
+    return fill_result;
+  }
+
+  const page_cache_entry_t new_entry = {
+      .key = key, .page = page, .last_access = _page_cache_clock++};
+  if (!rb_insert(&_page_cache_entries, sizeof(page_cache_entry_t), &new_entry,
+                 (int (*)(const void *, const void *,
+                          void *))_page_cache_cmp_entries,
+                 NULL)) {
+    vnode->n_cached_pages--;
+    shared_page_decref(page);
+    return -ENOMEM;
+  }
+  _page_cache_stats.n_pages++;
+
+  page_t *const page_desc = page_get(page);
+  page_desc->mapping = vnode;
+  page_desc->index = index;
+
+  // One reference for the cache and one for the caller.
+  shared_page_incref(page);
+
+  return page;
+}
+
+spage_id_t page_cache_get_page(struct vnode *const vnode, const size_t index) {
+  mutex_lock(&_page_cache_lock);
+  const spage_id_t page = _page_cache_get_page_locked(vnode, index);
+  mutex_unlock(&_page_cache_lock);
+  return page;
+}
+
+void page_cache_mark_dirty(const page_id_t page) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  // The page may be written through a writable mapping from now on.
+  page_get(page)->flags =
+      (page_get(page)->flags | PAGE_FLAG_DIRTY) & ~PAGE_FLAG_ICACHE_CLEAN;
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+int page_cache_read(struct file *const file, void *const buf,
+                    const size_t len) {
+  struct vnode *const vnode = file->vnode;
+
+  mutex_lock(&_page_cache_lock);
+  const long file_size = vnode->v_ops->get_size(vnode);
+  mutex_unlock(&_page_cache_lock);
+  if (file_size < 0)
+    return file_size;
+
+  const size_t read_end_offset =
+      file->f_pos >= (size_t)file_size ? file->f_pos
+      : len < (size_t)file_size - file->f_pos ? file->f_pos + len
+                                              : (size_t)file_size;
+
+  size_t n_bytes_read = 0;
+  while (file->f_pos < read_end_offset) {
+    const size_t index = file->f_pos >> PAGE_ORDER,
+                 page_offset = file->f_pos & ((1 << PAGE_ORDER) - 1),
+                 page_remaining_len = (1 << PAGE_ORDER) - page_offset,
+                 cpy_len = read_end_offset - file->f_pos < page_remaining_len
+                               ? read_end_offset - file->f_pos
+                               : page_remaining_len;
+
+    // The reference keeps the page alive while it is copied without the lock.
+    const spage_id_t page = page_cache_get_page(vnode, index);
+    if (page < 0)
+      return n_bytes_read == 0 ? page : (int)n_bytes_read;
+
+    memcpy((char *)buf + n_bytes_read,
+           (char *)pa_to_kernel_va(page_id_to_pa(page)) + page_offset,
+           cpy_len);
+    shared_page_decref(page);
+
+    file->f_pos += cpy_len;
+    n_bytes_read += cpy_len;
+  }
+
+  return n_bytes_read;
+}
+
+void page_cache_update(struct vnode *const vnode, const size_t offset,
+                       const void *const buf, const size_t len) {
+  if (len == 0)
+    return;
+
+  const size_t end_offset = offset + len;
+  for (size_t index = offset >> PAGE_ORDER;
+       index <= (end_offset - 1) >> PAGE_ORDER; index++) {
+    mutex_lock(&_page_cache_lock);
+
+    const page_cache_key_t key = {.vnode = vnode, .index = index};
+    const page_cache_entry_t *const entry = _page_cache_find(&key);
+    if (!entry) {
+      mutex_unlock(&_page_cache_lock);
+      continue;
+    }
+
+    // The reference keeps the page alive while it is copied without the lock.
+    const page_id_t page = entry->page;
+    shared_page_incref(page);
+
+    uint64_t daif_val;
+    CRITICAL_SECTION_ENTER(daif_val);
+    page_get(page)->flags &= ~PAGE_FLAG_ICACHE_CLEAN;
+    CRITICAL_SECTION_LEAVE(daif_val);
+
+    mutex_unlock(&_page_cache_lock);
+
+    const size_t page_start = index << PAGE_ORDER,
+                 page_end = page_start + (1 << PAGE_ORDER),
+                 max_start = offset > page_start ? offset : page_start,
+                 min_end = end_offset < page_end ? end_offset : page_end;
+    memcpy((char *)pa_to_kernel_va(page_id_to_pa(page)) +
+               (max_start - page_start),
+           (const char *)buf + (max_start - offset), min_end - max_start);
+    shared_page_decref(page);
+  }
+}
+
+static void _page_cache_write_back_rec(rb_node_t *const node) {
+  if (!node)
+    return;
+
+  page_cache_entry_t *const entry = (page_cache_entry_t *)node->payload;
+  if (page_get(entry->page)->flags & PAGE_FLAG_DIRTY &&
+      _page_cache_write_page(entry) >= 0 && _page_cache_is_unused(entry)) {
+    // With no mapping left, the page cannot be written without being marked
+    // dirty again.
+    uint64_t daif_val;
+    CRITICAL_SECTION_ENTER(daif_val);
+    page_get(entry->page)->flags &= ~PAGE_FLAG_DIRTY;
+    CRITICAL_SECTION_LEAVE(daif_val);
+  }
+
+  for (size_t i = 0; i < 2; i++) {
+    _page_cache_write_back_rec(node->children[i]);
+  }
+}
+
+void page_cache_sync(void) {
+  mutex_lock(&_page_cache_lock);
+
+  _page_cache_write_back_rec(_page_cache_entries);
+
+  mutex_unlock(&_page_cache_lock);
+}
+
+page_cache_stats_t page_cache_get_stats(void) {
+  mutex_lock(&_page_cache_lock);
+
+  const page_cache_stats_t stats = _page_cache_stats;
+
+  mutex_unlock(&_page_cache_lock);
+  return stats;
+}
@@ -3,40 +3,25 @@
 #include "oscos/libc/string.h"
 #include "oscos/mem/page-alloc.h"
 #include "oscos/mem/vm.h"
-#include "oscos/utils/critical-section.h"
-#include "oscos/utils/rb.h"
-
-static rb_node_t *_page_refcnts = NULL;
-
-typedef struct {
-  page_id_t page_id;
-  size_t refcnt;
-} page_refcnt_entry_t;
-
-static int
-_cmp_page_refcnt_entry_by_page_id(const page_refcnt_entry_t *const e1,
-                                  const page_refcnt_entry_t *const e2,
-                                  void *_arg) {
-  (void)_arg;
-
-  if (e1->page_id < e2->page_id)
-    return -1;
-  if (e1->page_id > e2->page_id)
-    return 1;
-  return 0;
-}
-
-static int
-_cmp_page_id_and_page_refcnt_entry(const page_id_t *const page,
-                                   const page_refcnt_entry_t *const entry,
-                                   void *const _arg) {
-  (void)_arg;
-
-  if (*page < entry->page_id)
-    return -1;
-  if (*page > entry->page_id)
-    return 1;
-  return 0;
+#include "oscos/mem/zero-pool.h"
+#include "oscos/utils/lock.h"
+
+// The reference counts live in the page descriptors. Pages not allocated by
+// `shared_page_alloc*()` do not have `PAGE_FLAG_SHARED` set and are ignored by
+// the reference counting functions, unless `shared_page_ref_foreign()` has set
+// the flag on them.
+
+/// \brief Protects the reference counts and the flags of the page descriptors.
+///
+/// Taken before the locks of the page frame allocator.
+static spinlock_t _shared_page_lock;
+
+/// \brief Gets the page descriptor of a page allocated by the shared page
+///        allocator.
+/// \return The page descriptor, or NULL if the page is not a shared page.
+static page_t *_get_shared_page(const page_id_t page_id) {
+  page_t *const page = page_get(page_id);
+  return page && page->flags & PAGE_FLAG_SHARED ? page : NULL;
 }
 
 spage_id_t shared_page_alloc(void) {
@@ -44,109 +29,102 @@ spage_id_t shared_page_alloc(void) {
   if (result < 0)
     return result;
 
-  const page_refcnt_entry_t new_entry = {.page_id = result, .refcnt = 1};
+  *page_get(result) = (page_t){.refcnt = 1, .flags = PAGE_FLAG_SHARED};
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  return result;
+}
 
-  rb_insert(&_page_refcnts, sizeof(page_refcnt_entry_t), &new_entry,
-            (int (*)(const void *, const void *,
-                     void *))_cmp_page_refcnt_entry_by_page_id,
-            NULL);
+spage_id_t shared_page_alloc_zeroed(void) {
+  spage_id_t result = alloc_zeroed_page();
+  if (result < 0)
+    return result;
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  *page_get(result) = (page_t){.refcnt = 1, .flags = PAGE_FLAG_SHARED};
 
   return result;
 }
 
-size_t shared_page_getref(const page_id_t page) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
-
-  const page_refcnt_entry_t *const entry =
-      rb_search(_page_refcnts, &page,
-                (int (*)(const void *, const void *,
-                         void *))_cmp_page_id_and_page_refcnt_entry,
-                NULL);
-  const size_t result = entry->refcnt;
+/// A block is reference-counted as a whole through its first page.
+spage_id_t shared_page_alloc_block(const size_t order) {
+  spage_id_t result = alloc_pages(order);
+  if (result < 0)
+    return result;
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  *page_get(result) = (page_t){.refcnt = 1, .flags = PAGE_FLAG_SHARED};
 
   return result;
 }
 
-void shared_page_incref(const page_id_t page) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
-
-  // It's safe to cast away const here, since every entry _page_refcnts points
-  // to is not const. Also, incrementing the reference count doesn't invalidate
-  // the BST invariant.
-  page_refcnt_entry_t *const entry = (page_refcnt_entry_t *)rb_search(
-      _page_refcnts, &page,
-      (int (*)(const void *, const void *,
-               void *))_cmp_page_id_and_page_refcnt_entry,
-      NULL);
+size_t shared_page_getref(const page_id_t page_id) {
+  const page_t *const page = _get_shared_page(page_id);
+  return page ? page->refcnt : 0;
+}
 
+void shared_page_incref(const page_id_t page_id) {
   // This function is sometimes called on a non-shared page; more specifically,
   // linearly-mapped pages.
-  if (entry) {
-    entry->refcnt++;
-  }
+  page_t *const page = _get_shared_page(page_id);
+  if (!page)
+    return;
 
-  CRITICAL_SECTION_LEAVE(daif_val);
-}
+  const uint64_t daif_val = spin_lock_irqsave(&_shared_page_lock);
 
-void shared_page_decref(const page_id_t page) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+  page->refcnt++;
 
-  // It's safe to cast away const here, since every entry _page_refcnts points
-  // to is not const. Also, incrementing the reference count doesn't invalidate
-  // the BST invariant.
-  page_refcnt_entry_t *const entry = (page_refcnt_entry_t *)rb_search(
-      _page_refcnts, &page,
-      (int (*)(const void *, const void *,
-               void *))_cmp_page_id_and_page_refcnt_entry,
-      NULL);
+  spin_unlock_irqrestore(&_shared_page_lock, daif_val);
+}
 
+void shared_page_decref(const page_id_t page_id) {
   // This function is sometimes called on a non-shared page; more specifically,
   // linearly-mapped pages.
-  if (entry) {
-    entry->refcnt--;
-
-    if (entry->refcnt == 0) {
-      rb_delete(&_page_refcnts, &page,
-                (int (*)(const void *, const void *,
-                         void *))_cmp_page_id_and_page_refcnt_entry,
-                NULL);
-      free_pages(page);
-    }
+  page_t *const page = _get_shared_page(page_id);
+  if (!page)
+    return;
+
+  const uint64_t daif_val = spin_lock_irqsave(&_shared_page_lock);
+
+  page->refcnt--;
+
+  if (page->refcnt == 0) {
+    *page = (page_t){0};
+    free_pages_unlocked(page_id);
   }
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  spin_unlock_irqrestore(&_shared_page_lock, daif_val);
 }
 
 spage_id_t shared_page_clone_unshare(const page_id_t page) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
-
-  if (shared_page_getref(page) == 1) { // No need to clone.
-    CRITICAL_SECTION_LEAVE(daif_val);
+  // Only the caller can add references to a page it holds the only reference
+  // to, so the count cannot go up behind our back.
+  if (shared_page_getref(page) == 1) // No need to clone.
     return page;
-  }
-
-  shared_page_decref(page);
 
   spage_id_t new_page_id = shared_page_alloc();
-  if (new_page_id < 0) {
-    CRITICAL_SECTION_LEAVE(daif_val);
+  if (new_page_id < 0)
     return new_page_id;
-  }
 
+  // Copy before dropping our reference, which keeps the page alive. The page is
+  // read-only while shared, so the copy needs no lock.
   memcpy(pa_to_kernel_va(page_id_to_pa(new_page_id)),
          pa_to_kernel_va(page_id_to_pa(page)), 1 << PAGE_ORDER);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  shared_page_decref(page);
   return new_page_id;
 }
+
+bool shared_page_ref_foreign(const page_id_t page_id) {
+  page_t *const page = page_get(page_id);
+  if (!page)
+    return false;
+
+  const uint64_t daif_val = spin_lock_irqsave(&_shared_page_lock);
+
+  if (page->flags & PAGE_FLAG_SHARED) {
+    page->refcnt++;
+  } else {
+    *page = (page_t){.refcnt = 2, .flags = PAGE_FLAG_SHARED};
+  }
+
+  spin_unlock_irqrestore(&_shared_page_lock, daif_val);
+  return true;
+}
@@ -4,16 +4,188 @@
 
 #include "oscos/console.h"
 #include "oscos/libc/string.h"
+#include "oscos/mem/cache.h"
 #include "oscos/mem/page-alloc.h"
+#include "oscos/mem/page-cache.h"
 #include "oscos/mem/shared-page.h"
+#include "oscos/mem/zero-pool.h"
 #include "oscos/sched.h"
+#include "oscos/uapi/errno.h"
 #include "oscos/uapi/unistd.h"
 #include "oscos/utils/align.h"
+#include "oscos/utils/core-id.h"
 #include "oscos/utils/critical-section.h"
 
 // Symbol defined in the linker script.
 extern char _kernel_vm_base[];
 
+// Blocks mapped by PMD entries.
+#define VM_BLOCK_ORDER 9
+#define VM_BLOCK_SIZE ((uintptr_t)1 << (VM_BLOCK_ORDER + PAGE_ORDER))
+
+/// \brief The page mapped read-only on read faults in anonymous regions.
+///
+/// The page holds a reference of its own, so it is never freed.
+static page_id_t _zero_page_id;
+
+#define ASID_BITS 16
+#define ASID_MASK ((UINT64_C(1) << ASID_BITS) - 1)
+
+// ASIDs are allocated in increasing order. When they run out, a new
+// generation begins: the whole TLB is flushed and address spaces with an ASID
+// from an older generation get a new one the next time they are switched to.
+// ASID 0 is never allocated.
+//
+// The first allocation starts a new generation, so that the global entries of
+// the identity mapping set up at boot time are flushed before any user address
+// space is switched to.
+//
+// The other cores keep running with their ASIDs across a rollover and refill
+// the TLB with them. Such ASIDs are reserved: they are not handed out again in
+// the new generation, and their address spaces keep them.
+static uint64_t _asid_generation = UINT64_C(1) << ASID_BITS;
+static uint64_t _next_asid = ASID_MASK + 1;
+/// \brief The ASID (with the generation) each core is running with, or 0.
+static uint64_t _active_asids[N_CORES];
+/// \brief The ASIDs (with the generations) active at the last rollover.
+static uint64_t _reserved_asids[N_CORES];
+
+static bool _vm_asid_is_reserved(const uint64_t asid) {
+  for (size_t i = 0; i < N_CORES; i++) {
+    if (_reserved_asids[i] == asid)
+      return true;
+  }
+  return false;
+}
+
+static bool _vm_asid_number_is_reserved(const uint64_t asid_number) {
+  for (size_t i = 0; i < N_CORES; i++) {
+    if ((_reserved_asids[i] & ASID_MASK) == asid_number)
+      return true;
+  }
+  return false;
+}
+
+/// \brief Gets the ASID of an address space, allocating one if it has none or
+///        one from an older generation, and marks it active on the current
+///        core.
+static uint64_t _vm_get_asid(vm_addr_space_t *const addr_space) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  if ((addr_space->asid & ~ASID_MASK) != _asid_generation) {
+    if (addr_space->asid && _vm_asid_is_reserved(addr_space->asid)) {
+      addr_space->asid = _asid_generation | (addr_space->asid & ASID_MASK);
+    } else {
+      do {
+        if (_next_asid > ASID_MASK) { // Rollover.
+          _asid_generation += UINT64_C(1) << ASID_BITS;
+          _next_asid = 1;
+          for (size_t i = 0; i < N_CORES; i++) {
+            _reserved_asids[i] = _active_asids[i];
+          }
+          __asm__ __volatile__("tlbi vmalle1is\n"
+                               "dsb ish"
+                               :
+                               :
+                               : "memory");
+        }
+      } while (_vm_asid_number_is_reserved(_next_asid++));
+      addr_space->asid = _asid_generation | (_next_asid - 1);
+    }
+  }
+  _active_asids[get_core_id()] = addr_space->asid;
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+  return addr_space->asid & ASID_MASK;
+}
+
+/// \brief Checks if the ASID of an address space may have TLB entries.
+static bool _vm_asid_is_live(const vm_addr_space_t *const addr_space) {
+  return (addr_space->asid & ~ASID_MASK) == _asid_generation ||
+         (addr_space->asid && _vm_asid_is_reserved(addr_space->asid));
+}
+
+/// \brief Invalidates all TLB entries of an address space.
+static void _vm_invalidate_asid(const vm_addr_space_t *const addr_space) {
+  if (!_vm_asid_is_live(addr_space))
+    return;
+
+  __asm__ __volatile__("dsb ishst\n"
+                       "tlbi aside1is, %0\n"
+                       "dsb ish\n"
+                       "isb"
+                       :
+                       : "r"((addr_space->asid & ASID_MASK) << 48)
+                       : "memory");
+}
+
+/// \brief Invalidates the TLB entries of a page of an address space.
+///
+/// \param addr_space The address space.
+/// \param va Any virtual address in the page.
+/// \param is_last_level_only Whether or not only the last-level entry has
+///                           changed. If false, cached intermediate entries
+///                           are invalidated as well.
+static void _vm_invalidate_page(const vm_addr_space_t *const addr_space,
+                                void *const va, const bool is_last_level_only) {
+  if (!_vm_asid_is_live(addr_space))
+    return;
+
+  const uint64_t operand =
+      (addr_space->asid & ASID_MASK) << 48 |
+      ((uintptr_t)va >> PAGE_ORDER & ((UINT64_C(1) << 44) - 1));
+  if (is_last_level_only) {
+    __asm__ __volatile__("dsb ishst\n"
+                         "tlbi vale1is, %0\n"
+                         "dsb ish\n"
+                         "isb"
+                         :
+                         : "r"(operand)
+                         : "memory");
+  } else {
+    __asm__ __volatile__("dsb ishst\n"
+                         "tlbi vae1is, %0\n"
+                         "dsb ish\n"
+                         "isb"
+                         :
+                         : "r"(operand)
+                         : "memory");
+  }
+}
+
+/// \brief The maximum number of pages in a region for which the TLB entries
+///        are invalidated page by page when the region is removed.
+#define VM_INVALIDATE_BY_PAGE_MAX_PAGES 32
+
+bool vm_init(void) {
+  const spage_id_t zero_page_id = shared_page_alloc_zeroed();
+  if (zero_page_id < 0)
+    return false;
+
+  // The page may be mapped into executable regions.
+  cache_sync_icache_range(pa_to_kernel_va(page_id_to_pa(zero_page_id)),
+                          1 << PAGE_ORDER);
+
+  _zero_page_id = zero_page_id;
+  return true;
+}
+
+void vm_init_secondary_core(void) {
+  // The core starts with the identity mapping set up at boot time in
+  // TTBR0_EL1, whose global TLB entries would shadow user mappings. Replace it
+  // with the zero page, in which every entry is invalid, and flush the TLB of
+  // the core.
+  __asm__ __volatile__("msr ttbr0_el1, %0\n"
+                       "isb\n"
+                       "tlbi vmalle1\n"
+                       "dsb nsh\n"
+                       "isb"
+                       :
+                       : "r"((uint64_t)page_id_to_pa(_zero_page_id))
+                       : "memory");
+}
+
 pa_t kernel_va_to_pa(const void *const va) {
   return (pa_t)((uintptr_t)va - (uintptr_t)_kernel_vm_base);
 }
@@ -51,12 +223,29 @@ static int _vm_cmp_va_and_mem_region(const void *const va,
   return 0;
 }
 
-void vm_mem_regions_insert_region(mem_regions_t *const regions,
-                                  const mem_region_t *const region) {
-  rb_insert(
-      &regions->root, sizeof(mem_region_t), region,
-      (int (*)(const void *, const void *, void *))_vm_cmp_mem_regions_by_start,
+int vm_mem_regions_insert_region(mem_regions_t *const regions,
+                                 const mem_region_t *const region) {
+  void *const end = (char *)region->start + region->len;
+
+  // Check for overlaps with the region containing the start and with the first
+  // region starting after it.
+
+  if (vm_mem_regions_find_region(regions, region->start))
+    return -EINVAL;
+
+  const mem_region_t *const successor = rb_successor(
+      regions->root, region->start,
+      (int (*)(const void *, const void *, void *))_vm_cmp_va_and_mem_region,
       NULL);
+  if (successor && successor->start < end)
+    return -EINVAL;
+
+  if (!rb_insert(&regions->root, sizeof(mem_region_t), region,
+                 (int (*)(const void *, const void *,
+                          void *))_vm_cmp_mem_regions_by_start,
+                 NULL))
+    return -ENOMEM;
+  return 0;
 }
 
 const mem_region_t *
@@ -71,16 +260,11 @@ vm_mem_regions_find_region(const mem_regions_t *const regions, void *const va) {
 }
 
 static page_table_entry_t *_vm_new_pgd(void) {
-  const spage_id_t new_pgd_page_id = shared_page_alloc();
+  const spage_id_t new_pgd_page_id = shared_page_alloc_zeroed();
   if (new_pgd_page_id < 0)
     return NULL;
 
-  page_table_entry_t *const result =
-      pa_to_kernel_va(page_id_to_pa(new_pgd_page_id));
-
-  memset(result, 0, 1 << PAGE_ORDER);
-
-  return result;
+  return pa_to_kernel_va(page_id_to_pa(new_pgd_page_id));
 }
 
 vm_addr_space_t vm_new_addr_space(void) {
@@ -132,6 +316,8 @@ vm_addr_space_t vm_clone_addr_space(const vm_addr_space_t addr_space) {
     return (vm_addr_space_t){.mem_regions = (mem_regions_t){.root = NULL}};
 
   _vm_clone_pgd(addr_space.pgd);
+  // The pages of the original address space are now copy-on-write.
+  _vm_invalidate_asid(&addr_space);
   return (vm_addr_space_t){.mem_regions =
                                (mem_regions_t){.root = new_regions_root},
                            .pgd = addr_space.pgd};
@@ -146,7 +332,7 @@ static void _vm_drop_page_table(page_table_entry_t *const page_table,
     for (size_t i = 0; i < 512; i++) {
       if (page_table[i].b0) {
         const pa_t next_level_pa = page_table[i].addr << PAGE_ORDER;
-        if (level == 0) {
+        if (level == 0 || !page_table[i].b1) { // Page or block.
           shared_page_decref(pa_to_page_id(next_level_pa));
         } else {
           page_table_entry_t *const next_level_page_table =
@@ -175,6 +361,15 @@ void vm_drop_addr_space(const vm_addr_space_t addr_space) {
           (void (*)(void *))_vm_mem_regions_deleter);
 }
 
+static void _set_page_read_only(page_table_entry_t *const pte_entry) {
+  union {
+    block_page_descriptor_lower_t s;
+    unsigned u;
+  } lower = {.u = pte_entry->lower};
+  lower.s.ap |= 0x2;
+  pte_entry->lower = lower.u;
+}
+
 static page_table_entry_t *
 _vm_clone_unshare_page_table(page_table_entry_t *const page_table) {
   const page_id_t page_table_page_id =
@@ -198,12 +393,16 @@ _vm_clone_unshare_page_table(page_table_entry_t *const page_table) {
 
       shared_page_incref(next_level_page_id);
 
-      union {
-        table_descriptor_upper_t s;
-        unsigned u;
-      } upper = {.u = page_table[i].upper};
-      upper.s.aptable = 0x2;
-      page_table[i].upper = upper.u;
+      if (page_table[i].b1) { // Table.
+        union {
+          table_descriptor_upper_t s;
+          unsigned u;
+        } upper = {.u = page_table[i].upper};
+        upper.s.aptable = 0x2;
+        page_table[i].upper = upper.u;
+      } else { // Block.
+        _set_page_read_only(&page_table[i]);
+      }
     }
   }
 
@@ -248,53 +447,215 @@ _vm_clone_unshare_pte(page_table_entry_t *const pte) {
   return new_pte;
 }
 
-static void _init_backed_page(const mem_region_t *const mem_region,
-                              void *const va, void *const kernel_va) {
-  void *const va_page_start =
-      (void *)((uintptr_t)va & ~((1 << PAGE_ORDER) - 1));
-  size_t offset = (char *)va_page_start - (char *)mem_region->start;
-
-  // We need to ensure that the seek-read sequence is atomic without using
-  // pread, hence the critical section.
+/// \brief Determines whether or not a region is a shared file mapping.
+static bool _is_shared_region(const mem_region_t *const mem_region) {
+  return mem_region->type == MEM_REGION_BACKED &&
+         mem_region->flags & MAP_SHARED;
+}
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
+/// \brief Computes the page offset within the backing file of the page of a
+///        backed region containing a virtual address.
+static size_t _backed_page_file_index(const mem_region_t *const mem_region,
+                                      void *const va) {
+  return (mem_region->file_offset +
+          ((uintptr_t)va - (uintptr_t)mem_region->start)) >>
+         PAGE_ORDER;
+}
 
-  const int seek_result =
-      vfs_lseek64(mem_region->backing_file->file, offset, SEEK_SET);
-  if (seek_result < 0) {
-    console_printf("ERROR: vm: (PID %zu) Cannot seek backing file: errno %d\n",
-                   current_thread()->process->id, -seek_result);
+/// \brief Fills consecutive pages of a backed region with the contents of the
+///        backing file, taken from the page cache.
+///
+/// \param mem_region The backed region.
+/// \param va Any virtual address in the first page.
+/// \param kernel_vas The kernel virtual addresses of the page frames to fill,
+///                   one for each page.
+/// \param n_pages The number of pages.
+static void _init_backed_pages(const mem_region_t *const mem_region,
+                               void *const va, void *const *const kernel_vas,
+                               const size_t n_pages) {
+  struct vnode *const vnode = mem_region->backing_file->file->vnode;
+
+  const long file_size = vnode->v_ops->get_size(vnode);
+  if (file_size < 0) {
+    console_printf(
+        "ERROR: vm: (PID %zu) Cannot get backing file size: errno %d\n",
+        current_thread()->process->id, (int)-file_size);
     thread_exit();
   }
+  const size_t file_n_pages =
+      ((size_t)file_size + ((1 << PAGE_ORDER) - 1)) >> PAGE_ORDER;
+
+  const size_t first_index = _backed_page_file_index(mem_region, va),
+               first_offset =
+                   ((uintptr_t)va & ~((1 << PAGE_ORDER) - 1)) -
+                   (uintptr_t)mem_region->start;
+  for (size_t i = 0; i < n_pages; i++) {
+    const size_t offset = first_offset + (i << PAGE_ORDER);
+
+    // Pages past the end of the file, e.g., .bss, are not worth caching.
+    if (first_index + i >= file_n_pages ||
+        (!_is_shared_region(mem_region) && offset >= mem_region->file_len)) {
+      memset(kernel_vas[i], 0, 1 << PAGE_ORDER);
+      continue;
+    }
 
-  size_t n_bytes_read = 0;
-  while (n_bytes_read < 1 << PAGE_ORDER) {
-    const int n_bytes_just_read = vfs_read(mem_region->backing_file->file,
-                                           (char *)kernel_va + n_bytes_read,
-                                           (1 << PAGE_ORDER) - n_bytes_read);
-    if (n_bytes_just_read < 0) {
+    const spage_id_t page_id = page_cache_get_page(vnode, first_index + i);
+    if (page_id < 0) {
       console_printf(
           "ERROR: vm: (PID %zu) Cannot read backing file: errno %d\n",
-          current_thread()->process->id, -n_bytes_just_read);
+          current_thread()->process->id, (int)-page_id);
       thread_exit();
     }
-    if (n_bytes_just_read == 0)
-      break;
 
-    n_bytes_read += n_bytes_just_read;
+    memcpy(kernel_vas[i], pa_to_kernel_va(page_id_to_pa(page_id)),
+           1 << PAGE_ORDER);
+    shared_page_decref(page_id);
+
+    if (!_is_shared_region(mem_region) &&
+        mem_region->file_len - offset < 1 << PAGE_ORDER) {
+      memset((char *)kernel_vas[i] + (mem_region->file_len - offset), 0,
+             (1 << PAGE_ORDER) - (mem_region->file_len - offset));
+    }
+  }
+}
+
+/// \brief Gets a page of a backed region to be mapped.
+///
+/// This is usually the page in the page cache, the file data itself for a page
+/// of a private region of a file system supporting direct access, or the zero
+/// page for a page of a private region past the mapped part of the file, e.g.,
+/// .bss. Either way, the page is shared. The exception is a page of a private
+/// region straddling the end of the mapped part of the file, which is a private
+/// copy with the rest zero-filled. In all cases, the page must be mapped
+/// read-only unless it is a page of a shared region being written.
+///
+/// \return The page number of the page, with a new reference for the caller,
+///         or a negative error number.
+static spage_id_t _get_backed_page(const mem_region_t *const mem_region,
+                                   void *const va) {
+  struct vnode *const vnode = mem_region->backing_file->file->vnode;
+  const size_t index = _backed_page_file_index(mem_region, va);
+
+  if (!_is_shared_region(mem_region)) {
+    const long file_size = vnode->v_ops->get_size(vnode);
+    if (file_size < 0)
+      return file_size;
+
+    const size_t offset = ((uintptr_t)va & ~((1 << PAGE_ORDER) - 1)) -
+                          (uintptr_t)mem_region->start;
+    if (offset >= mem_region->file_len ||
+        index >= ((size_t)file_size + ((1 << PAGE_ORDER) - 1)) >> PAGE_ORDER) {
+      shared_page_incref(_zero_page_id);
+      return _zero_page_id;
+    }
+
+    // The tail of the cached page is zero only if the file ends there, too.
+    if (mem_region->file_len - offset < 1 << PAGE_ORDER &&
+        mem_region->file_offset + mem_region->file_len < (size_t)file_size) {
+      const spage_id_t page_id = shared_page_alloc();
+      if (page_id < 0)
+        return page_id;
+
+      void *const kernel_va = pa_to_kernel_va(page_id_to_pa(page_id));
+      _init_backed_pages(mem_region, va, &kernel_va, 1);
+      return page_id;
+    }
+
+    // Map the file data in place if the file system keeps it in memory. Only
+    // private regions may do so, since the page is never written in place.
+    const void *direct_page;
+    if (vnode->v_ops->direct_access &&
+        vnode->v_ops->direct_access(vnode, index, &direct_page) == 0) {
+      const page_id_t page_id = pa_to_page_id(kernel_va_to_pa(direct_page));
+      if (shared_page_ref_foreign(page_id)) {
+        page_t *const page = page_get(page_id);
+        page->mapping = vnode;
+        page->index = index;
+        return page_id;
+      }
+    }
+  }
+
+  return page_cache_get_page(vnode, index);
+}
+
+/// \brief Makes the instruction cache coherent with a page returned by
+///        \ref _get_backed_page.
+///
+/// Since the page is shared, this is done only once for each change of its
+/// contents.
+static void _sync_backed_page_icache(const page_id_t page_id) {
+  if (page_id == _zero_page_id)
+    return;
+  if (!page_get(page_id)->mapping) { // A private copy.
+    cache_sync_icache_range(pa_to_kernel_va(page_id_to_pa(page_id)),
+                            1 << PAGE_ORDER);
+    return;
+  }
+
+  // The page cache updates the flags within critical sections as well.
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  page_t *const page = page_get(page_id);
+  if (!(page->flags & PAGE_FLAG_ICACHE_CLEAN)) {
+    cache_sync_icache_range(pa_to_kernel_va(page_id_to_pa(page_id)),
+                            1 << PAGE_ORDER);
+    page->flags |= PAGE_FLAG_ICACHE_CLEAN;
   }
 
   CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+static void _set_page_attrs(const mem_region_t *const mem_region,
+                            page_table_entry_t *const pte_entry) {
+  const bool is_accessible =
+      mem_region->prot & (PROT_READ | PROT_WRITE | PROT_EXEC);
+  const bool is_writable = mem_region->prot & PROT_WRITE;
+  const bool is_executable = mem_region->prot & PROT_EXEC;
 
-  memset((char *)kernel_va + n_bytes_read, 0, (1 << PAGE_ORDER) - n_bytes_read);
+  const unsigned ap = ((unsigned)!is_writable << 1) | (unsigned)is_accessible;
+
+  // Linearly-mapped regions map memory shared with the VideoCore, which
+  // doesn't snoop the caches of the ARM cores.
+  const bool is_cacheable = mem_region->type != MEM_REGION_LINEAR;
+
+  const union {
+    block_page_descriptor_lower_t s;
+    unsigned u;
+  } lower = {.s = (block_page_descriptor_lower_t){
+                 .attr_indx = is_cacheable ? ATTR_INDX_NORMAL_WB
+                                           : ATTR_INDX_NORMAL_NOCACHE,
+                 .ap = ap,
+                 .sh = is_cacheable ? SH_INNER_SHAREABLE : SH_NON_SHAREABLE,
+                 .af = 1,
+                 .ng = 1}}; // User mappings are tagged with the ASID.
+  pte_entry->lower = lower.u;
+  const union {
+    block_page_descriptor_upper_t s;
+    unsigned u;
+  } upper = {.s = (block_page_descriptor_upper_t){.pxn = !is_executable,
+                                                  .uxn = !is_executable}};
+  pte_entry->upper = upper.u;
 }
 
 static bool _map_page(const mem_region_t *const mem_region, void *const va,
-                      page_table_entry_t *const pte_entry) {
+                      page_table_entry_t *const pte_entry,
+                      const int access_mode) {
+  bool is_read_only = false;
+
   switch (mem_region->type) {
   case MEM_REGION_ANONYMOUS: {
-    const spage_id_t page_id = shared_page_alloc();
+    if (access_mode == PROT_READ) {
+      // Map the zero page read-only. A private page is allocated by the CoW
+      // path on the first write.
+      shared_page_incref(_zero_page_id);
+      pte_entry->addr = page_id_to_pa(_zero_page_id) >> PAGE_ORDER;
+      is_read_only = true;
+      break;
+    }
+
+    const spage_id_t page_id = shared_page_alloc_zeroed();
     if (page_id < 0) {
       return false;
     }
@@ -302,12 +663,37 @@ static bool _map_page(const mem_region_t *const mem_region, void *const va,
     const pa_t page_pa = page_id_to_pa(page_id);
     pte_entry->addr = page_pa >> PAGE_ORDER;
 
-    memset(pa_to_kernel_va(page_pa), 0, 1 << PAGE_ORDER);
-
     break;
   }
 
   case MEM_REGION_BACKED: {
+    if (access_mode != PROT_WRITE || _is_shared_region(mem_region)) {
+      const spage_id_t page_id = _get_backed_page(mem_region, va);
+      if (page_id < 0) {
+        return false;
+      }
+
+      // Without a hardware dirty bit, a page of a shared region is mapped
+      // writable only on a write access, so that the write can be recorded.
+      // A page of a private region is copied by the CoW path on the first
+      // write.
+      if (access_mode == PROT_WRITE) {
+        page_cache_mark_dirty(page_id);
+      } else {
+        is_read_only = true;
+      }
+
+      pte_entry->addr = page_id_to_pa(page_id) >> PAGE_ORDER;
+      if (mem_region->prot & PROT_EXEC) {
+        _sync_backed_page_icache(page_id);
+      }
+
+      break;
+    }
+
+    // A write to a private region. Copy the page right away rather than
+    // mapping the cached page only to take a permission fault.
+
     const spage_id_t page_id = shared_page_alloc();
     if (page_id < 0) {
       return false;
@@ -316,7 +702,11 @@ static bool _map_page(const mem_region_t *const mem_region, void *const va,
     const pa_t page_pa = page_id_to_pa(page_id);
     pte_entry->addr = page_pa >> PAGE_ORDER;
 
-    _init_backed_page(mem_region, va, pa_to_kernel_va(page_pa));
+    void *const kernel_va = pa_to_kernel_va(page_pa);
+    _init_backed_pages(mem_region, va, &kernel_va, 1);
+    if (mem_region->prot & PROT_EXEC) {
+      cache_sync_icache_range(kernel_va, 1 << PAGE_ORDER);
+    }
 
     break;
   }
@@ -331,54 +721,184 @@ static bool _map_page(const mem_region_t *const mem_region, void *const va,
     __builtin_unreachable();
   }
 
-  // Set attributes.
-
-  const bool is_accessible =
-      mem_region->prot & (PROT_READ | PROT_WRITE | PROT_EXEC);
-  const bool is_writable = mem_region->prot & PROT_WRITE;
-  const bool is_executable = mem_region->prot & PROT_EXEC;
-
-  const unsigned ap = ((unsigned)!is_writable << 1) | (unsigned)is_accessible;
-
   pte_entry->b0 = 1;
   pte_entry->b1 = 1;
-  const union {
-    block_page_descriptor_lower_t s;
-    unsigned u;
-  } lower = {.s = (block_page_descriptor_lower_t){
-                 .attr_indx = 0x1, .ap = ap, .af = 1}};
-  pte_entry->lower = lower.u;
-  const union {
-    block_page_descriptor_upper_t s;
-    unsigned u;
-  } upper = {.s = (block_page_descriptor_upper_t){.pxn = !is_executable,
-                                                  .uxn = !is_executable}};
-  pte_entry->upper = upper.u;
+  _set_page_attrs(mem_region, pte_entry);
+  if (is_read_only) {
+    _set_page_read_only(pte_entry);
+  }
 
   return true;
 }
 
+/// \brief Maps consecutive unmapped pages around a faulting page.
+///
+/// Pages of backed regions are the pages in the page cache, mapped read-only.
+/// This is best-effort: mapping stops at the first page that cannot be
+/// obtained.
+///
+/// \param mem_region The region containing the pages.
+/// \param va The virtual address of the first page.
+/// \param pte_entries The PTE entries of the pages. Must be in an unshared PTE.
+/// \param n_pages The number of pages.
+/// \return The number of pages mapped.
+static size_t _map_pages_around(const mem_region_t *const mem_region,
+                                void *const va,
+                                page_table_entry_t *const pte_entries,
+                                size_t n_pages) {
+  switch (mem_region->type) {
+  case MEM_REGION_BACKED: {
+    for (size_t i = 0; i < n_pages; i++) {
+      const spage_id_t page_id =
+          _get_backed_page(mem_region, (char *)va + (i << PAGE_ORDER));
+      if (page_id < 0) {
+        n_pages = i;
+        break;
+      }
+
+      pte_entries[i].addr = page_id_to_pa(page_id) >> PAGE_ORDER;
+      if (mem_region->prot & PROT_EXEC) {
+        _sync_backed_page_icache(page_id);
+      }
+    }
+
+    break;
+  }
+
+  case MEM_REGION_LINEAR: {
+    const size_t offset = (uintptr_t)va - (uintptr_t)mem_region->start;
+    for (size_t i = 0; i < n_pages; i++) {
+      pte_entries[i].addr =
+          (mem_region->pa_base + offset + (i << PAGE_ORDER)) >> PAGE_ORDER;
+    }
+    break;
+  }
+
+  default:
+    __builtin_unreachable();
+  }
+
+  for (size_t i = 0; i < n_pages; i++) {
+    pte_entries[i].b0 = 1;
+    pte_entries[i].b1 = 1;
+    _set_page_attrs(mem_region, &pte_entries[i]);
+    if (mem_region->type == MEM_REGION_BACKED) {
+      _set_page_read_only(&pte_entries[i]);
+    }
+  }
+
+  return n_pages;
+}
+
+/// \brief Maps the unmapped pages in the fault-around window of a faulting
+///        page.
+///
+/// The window is aligned to its size, so it never crosses a PTE. It is further
+/// clipped to the region containing the faulting page.
+///
+/// \param mem_region The region containing the faulting page.
+/// \param va The faulting virtual address.
+/// \param pte_entry The PTE entry of the faulting page. Must be in an unshared
+///                  PTE.
+/// \return The number of pages mapped, excluding the faulting page.
+static size_t _fault_around(const mem_region_t *const mem_region,
+                            void *const va,
+                            page_table_entry_t *const pte_entry) {
+  // Anonymous pages are not faulted around. Populating them would cost memory
+  // for pages that may never be touched.
+  if (mem_region->type == MEM_REGION_ANONYMOUS)
+    return 0;
+  // Pages of shared regions come from the page cache one at a time.
+  if (_is_shared_region(mem_region))
+    return 0;
+
+  const uintptr_t window_size = VM_FAULT_AROUND_PAGES << PAGE_ORDER;
+  const uintptr_t region_start = (uintptr_t)mem_region->start,
+                  region_end = ALIGN((uintptr_t)mem_region->start +
+                                         mem_region->len,
+                                     1 << PAGE_ORDER);
+
+  uintptr_t window_start = (uintptr_t)va & ~(window_size - 1),
+            window_end = window_start + window_size;
+  if (window_start < region_start) {
+    window_start = region_start;
+  }
+  if (window_end > region_end) {
+    window_end = region_end;
+  }
+
+  page_table_entry_t *const window_pte_entries =
+      pte_entry - (((uintptr_t)va - window_start) >> PAGE_ORDER);
+  const size_t n_window_pages = (window_end - window_start) >> PAGE_ORDER;
+
+  // Map each run of unmapped pages in one go, so that backed pages are read
+  // with a single seek.
+
+  size_t n_pages_mapped = 0;
+  for (size_t i = 0; i < n_window_pages;) {
+    if (window_pte_entries[i].b0) {
+      i++;
+      continue;
+    }
+
+    size_t run_len = 1;
+    while (i + run_len < n_window_pages &&
+           !window_pte_entries[i + run_len].b0) {
+      run_len++;
+    }
+
+    const size_t n_run_pages_mapped = _map_pages_around(
+        mem_region, (void *)(window_start + (i << PAGE_ORDER)),
+        &window_pte_entries[i], run_len);
+    n_pages_mapped += n_run_pages_mapped;
+    if (n_run_pages_mapped != run_len) // Out of memory.
+      break;
+
+    i += run_len;
+  }
+
+  return n_pages_mapped;
+}
+
+/// \brief Walks the page table to the PMD entry covering a page, unsharing
+///        every page table along the way and allocating missing ones.
+///
+/// \param addr_space The address space.
+/// \param va Any virtual address in the page.
+/// \param[out] is_table_cloned Set to true if any existing page table is
+///                             replaced by a copy, in which case the TLB may
+///                             hold stale intermediate entries.
+/// \param[out] is_aptable_cleared Set to true if the read-only bit of any
+///                                existing table descriptor is cleared in
+///                                place, in which case cached intermediate
+///                                entries of the page are stale.
+/// \return The PMD entry, or NULL if out of memory.
 static page_table_entry_t *
-_vm_clone_unshare_pte_entry(vm_addr_space_t *const addr_space, void *const va) {
+_vm_clone_unshare_pmd_entry(vm_addr_space_t *const addr_space, void *const va,
+                            bool *const is_table_cloned,
+                            bool *const is_aptable_cleared) {
   page_table_entry_t *page_table =
       _vm_clone_unshare_page_table(addr_space->pgd);
   if (!page_table)
     return NULL;
+  *is_table_cloned = page_table != addr_space->pgd;
+  *is_aptable_cleared = false;
   addr_space->pgd = page_table;
   page_table_entry_t *prev_level_entry = &page_table[(uintptr_t)va >> 39];
 
   for (size_t level = 2; level > 0; level--) {
     if (prev_level_entry->b0) {
-      page_table = _vm_clone_unshare_page_table(
-          pa_to_kernel_va(prev_level_entry->addr << PAGE_ORDER));
+      page_table_entry_t *const old_page_table =
+          pa_to_kernel_va(prev_level_entry->addr << PAGE_ORDER);
+      page_table = _vm_clone_unshare_page_table(old_page_table);
       if (!page_table)
         return NULL;
+      *is_table_cloned |= page_table != old_page_table;
     } else {
-      const spage_id_t page_table_page_id = shared_page_alloc();
+      const spage_id_t page_table_page_id = shared_page_alloc_zeroed();
       if (page_table_page_id < 0)
         return NULL;
       page_table = pa_to_kernel_va(page_id_to_pa(page_table_page_id));
-      memset(page_table, 0, 1 << PAGE_ORDER);
       prev_level_entry->b0 = 1;
       prev_level_entry->b1 = 1;
     }
@@ -389,6 +909,7 @@ _vm_clone_unshare_pte_entry(vm_addr_space_t *const addr_space, void *const va) {
       table_descriptor_upper_t s;
       unsigned u;
     } upper = {.u = prev_level_entry->upper};
+    *is_aptable_cleared |= upper.s.aptable != 0x0;
     upper.s.aptable = 0x0;
     prev_level_entry->upper = upper.u;
 
@@ -398,19 +919,37 @@ _vm_clone_unshare_pte_entry(vm_addr_space_t *const addr_space, void *const va) {
         &page_table[((uintptr_t)va >> (12 + level * 9)) & ((1 << 9) - 1)];
   }
 
-  if (prev_level_entry->b0) {
-    page_table = _vm_clone_unshare_pte(
-        pa_to_kernel_va(prev_level_entry->addr << PAGE_ORDER));
+  return prev_level_entry;
+}
+
+/// \brief Walks from a PMD entry to the PTE entry of a page, unsharing the PTE
+///        or allocating it if missing.
+///
+/// \param pmd_entry The PMD entry covering the page. Must not be a block.
+/// \param va Any virtual address in the page.
+/// \param[in,out] is_table_cloned Set to true if the PTE is replaced by a copy.
+/// \param[in,out] is_aptable_cleared Set to true if the read-only bit of the
+///                                   PMD entry is cleared in place.
+/// \return The PTE entry, or NULL if out of memory.
+static page_table_entry_t *
+_vm_clone_unshare_pte_entry(page_table_entry_t *const pmd_entry,
+                            void *const va, bool *const is_table_cloned,
+                            bool *const is_aptable_cleared) {
+  page_table_entry_t *page_table;
+  if (pmd_entry->b0) {
+    page_table_entry_t *const old_page_table =
+        pa_to_kernel_va(pmd_entry->addr << PAGE_ORDER);
+    page_table = _vm_clone_unshare_pte(old_page_table);
     if (!page_table)
       return NULL;
+    *is_table_cloned |= page_table != old_page_table;
   } else {
-    const spage_id_t page_table_page_id = shared_page_alloc();
+    const spage_id_t page_table_page_id = shared_page_alloc_zeroed();
     if (page_table_page_id < 0)
       return NULL;
     page_table = pa_to_kernel_va(page_id_to_pa(page_table_page_id));
-    memset(page_table, 0, 1 << PAGE_ORDER);
-    prev_level_entry->b0 = 1;
-    prev_level_entry->b1 = 1;
+    pmd_entry->b0 = 1;
+    pmd_entry->b1 = 1;
   }
 
   // Since the page table is not shared, we can remove the read-only bit now.
@@ -419,20 +958,86 @@ _vm_clone_unshare_pte_entry(vm_addr_space_t *const addr_space, void *const va) {
     union {
       table_descriptor_upper_t s;
       unsigned u;
-    } upper = {.u = prev_level_entry->upper};
+    } upper = {.u = pmd_entry->upper};
+    *is_aptable_cleared |= upper.s.aptable != 0x0;
     upper.s.aptable = 0x0;
-    prev_level_entry->upper = upper.u;
+    pmd_entry->upper = upper.u;
   }
 
   const pa_t page_table_pa = kernel_va_to_pa(page_table);
-  prev_level_entry->addr = page_table_pa >> 12;
-  prev_level_entry = &page_table[((uintptr_t)va >> 12) & ((1 << 9) - 1)];
+  pmd_entry->addr = page_table_pa >> 12;
 
-  return prev_level_entry;
+  return &page_table[((uintptr_t)va >> 12) & ((1 << 9) - 1)];
+}
+
+/// \brief Checks if a PMD entry is a valid block descriptor.
+static bool _is_block(const page_table_entry_t *const pmd_entry) {
+  return pmd_entry->b0 && !pmd_entry->b1;
+}
+
+/// \brief Tries to map the block containing a page with a block descriptor.
+///
+/// Only anonymous and linearly-mapped regions are mapped with blocks, and only
+/// if the whole block lies within the region. Anonymous blocks are mapped only
+/// on write and execute faults, since reads are served by the zero page.
+///
+/// \return Whether or not the block is mapped. If not, the caller should fall
+///         back to mapping a single page.
+static bool _map_block(const mem_region_t *const mem_region, void *const va,
+                       page_table_entry_t *const pmd_entry,
+                       const int access_mode) {
+  const uintptr_t block_start = (uintptr_t)va & ~(VM_BLOCK_SIZE - 1),
+                  block_end = block_start + VM_BLOCK_SIZE;
+  if (block_start < (uintptr_t)mem_region->start ||
+      block_end > (uintptr_t)mem_region->start + mem_region->len)
+    return false;
+
+  switch (mem_region->type) {
+  case MEM_REGION_ANONYMOUS: {
+    if (access_mode == PROT_READ)
+      return false;
+
+    const spage_id_t block_page_id = shared_page_alloc_block(VM_BLOCK_ORDER);
+    if (block_page_id < 0) // Fragmented. Fall back to pages.
+      return false;
+
+    void *const block_kernel_va = pa_to_kernel_va(page_id_to_pa(block_page_id));
+    for (size_t i = 0; i < 1 << VM_BLOCK_ORDER; i++) {
+      zero_page((char *)block_kernel_va + (i << PAGE_ORDER));
+    }
+    if (mem_region->prot & PROT_EXEC) {
+      cache_sync_icache_range(block_kernel_va, VM_BLOCK_SIZE);
+    }
+
+    pmd_entry->addr = page_id_to_pa(block_page_id) >> PAGE_ORDER;
+    break;
+  }
+
+  case MEM_REGION_LINEAR: {
+    const pa_t block_pa =
+        mem_region->pa_base + (block_start - (uintptr_t)mem_region->start);
+    if (block_pa & (VM_BLOCK_SIZE - 1))
+      return false;
+
+    pmd_entry->addr = block_pa >> PAGE_ORDER;
+    break;
+  }
+
+  default:
+    return false;
+  }
+
+  pmd_entry->b0 = 1;
+  pmd_entry->b1 = 0;
+  _set_page_attrs(mem_region, pmd_entry);
+
+  return true;
 }
 
 vm_map_page_result_t vm_map_page(vm_addr_space_t *const addr_space,
-                                 void *const va) {
+                                 void *const va, const int access_mode) {
+  addr_space->fault_stats.n_translation_faults++;
+
   // Check the validity of the VA.
 
   const mem_region_t *const region =
@@ -440,29 +1045,46 @@ vm_map_page_result_t vm_map_page(vm_addr_space_t *const addr_space,
   if (!region)
     return VM_MAP_PAGE_SEGV;
 
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
-
   // Walk the page table.
 
-  page_table_entry_t *const pte_entry =
-      _vm_clone_unshare_pte_entry(addr_space, va);
-  if (!pte_entry) {
-    CRITICAL_SECTION_LEAVE(daif_val);
+  bool is_table_cloned, is_aptable_cleared;
+  page_table_entry_t *const pmd_entry = _vm_clone_unshare_pmd_entry(
+      addr_space, va, &is_table_cloned, &is_aptable_cleared);
+  if (!pmd_entry)
     return VM_MAP_PAGE_NOMEM;
-  }
 
-  // Map the page.
+  // Map the block or the page.
 
-  if (!_map_page(region, va, pte_entry)) {
-    CRITICAL_SECTION_LEAVE(daif_val);
-    return VM_MAP_PAGE_NOMEM;
+  if (_is_block(pmd_entry)) {
+    // Already mapped.
+  } else if (!pmd_entry->b0 &&
+             _map_block(region, va, pmd_entry, access_mode)) {
+    addr_space->fault_stats.n_blocks_mapped++;
+  } else {
+    page_table_entry_t *const pte_entry =
+        _vm_clone_unshare_pte_entry(pmd_entry, va, &is_table_cloned,
+                                    &is_aptable_cleared);
+    if (!pte_entry)
+      return VM_MAP_PAGE_NOMEM;
+
+    if (!_map_page(region, va, pte_entry, access_mode))
+      return VM_MAP_PAGE_NOMEM;
+
+    addr_space->fault_stats.n_pages_faulted_around +=
+        _fault_around(region, va, pte_entry);
   }
 
   // Set ttbr0_el1 again, as the PGD may have changed.
   vm_switch_to_addr_space(addr_space);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  // Invalid entries are never cached, so the TLB needs maintenance only if
+  // cached intermediate entries may be stale: they may point to stale page
+  // tables or still carry the read-only bit of a table descriptor.
+  if (is_table_cloned) {
+    _vm_invalidate_asid(addr_space);
+  } else if (is_aptable_cleared) {
+    _vm_invalidate_page(addr_space, va, false);
+  }
 
   return VM_MAP_PAGE_SUCCESS;
 }
@@ -473,13 +1095,31 @@ static bool _cow_page(const mem_region_t *const mem_region,
   case MEM_REGION_ANONYMOUS:
   case MEM_REGION_BACKED: {
     const page_id_t src_page_id = pa_to_page_id(pte_entry->addr << PAGE_ORDER);
-    const spage_id_t page_id = shared_page_clone_unshare(src_page_id);
+    if (_is_shared_region(mem_region)) {
+      // Writes go to the page-cache page itself. The page is read-only either
+      // because it was read-faulted in or because of fork.
+      page_cache_mark_dirty(src_page_id);
+      break;
+    }
+
+    spage_id_t page_id;
+    if (src_page_id == _zero_page_id) {
+      // No need to copy the zero page.
+      shared_page_decref(src_page_id);
+      page_id = shared_page_alloc_zeroed();
+    } else {
+      page_id = shared_page_clone_unshare(src_page_id);
+    }
     if (page_id < 0)
       return false;
 
     const pa_t page_pa = page_id_to_pa(page_id);
     pte_entry->addr = page_pa >> PAGE_ORDER;
 
+    if (page_id != (spage_id_t)src_page_id && mem_region->prot & PROT_EXEC) {
+      cache_sync_icache_range(pa_to_kernel_va(page_pa), 1 << PAGE_ORDER);
+    }
+
     break;
   }
 
@@ -492,58 +1132,155 @@ static bool _cow_page(const mem_region_t *const mem_region,
     __builtin_unreachable();
   }
 
-  // Set attributes.
+  _set_page_attrs(mem_region, pte_entry);
 
-  const bool is_accessible =
-      mem_region->prot & (PROT_READ | PROT_WRITE | PROT_EXEC);
-  const bool is_writable = mem_region->prot & PROT_WRITE;
-  const bool is_executable = mem_region->prot & PROT_EXEC;
+  return true;
+}
 
-  const unsigned ap = ((unsigned)!is_writable << 1) | (unsigned)is_accessible;
+/// \brief Splits a block into pages.
+///
+/// A linearly-mapped block is split in place. An anonymous block is split into
+/// private copies of its pages, since a block is allocated and freed as a
+/// whole. This is the fallback for CoW when no free block is available for a
+/// copy, and is also used when only part of a block is unmapped or
+/// re-protected.
+///
+/// \param mem_region The region containing the block.
+/// \param pmd_entry The PMD entry of the block. Must be in an unshared PMD.
+/// \return Whether or not the split succeeds.
+static bool _split_block(const mem_region_t *const mem_region,
+                         page_table_entry_t *const pmd_entry) {
+  const spage_id_t pte_page_id = shared_page_alloc_zeroed();
+  if (pte_page_id < 0)
+    return false;
+  page_table_entry_t *const pte = pa_to_kernel_va(page_id_to_pa(pte_page_id));
 
-  const union {
-    block_page_descriptor_lower_t s;
-    unsigned u;
-  } lower = {.s = (block_page_descriptor_lower_t){
-                 .attr_indx = 0x1, .ap = ap, .af = 1}};
-  pte_entry->lower = lower.u;
-  const union {
-    block_page_descriptor_upper_t s;
-    unsigned u;
-  } upper = {.s = (block_page_descriptor_upper_t){.pxn = !is_executable,
-                                                  .uxn = !is_executable}};
-  pte_entry->upper = upper.u;
+  if (mem_region->type == MEM_REGION_LINEAR) {
+    for (size_t i = 0; i < 512; i++) {
+      pte[i].addr = pmd_entry->addr + i;
+      pte[i].b0 = 1;
+      pte[i].b1 = 1;
+      _set_page_attrs(mem_region, &pte[i]);
+    }
+
+    *pmd_entry = (page_table_entry_t){
+        .b0 = 1, .b1 = 1, .addr = kernel_va_to_pa(pte) >> PAGE_ORDER};
+    return true;
+  }
+
+  const page_id_t src_block_page_id =
+      pa_to_page_id(pmd_entry->addr << PAGE_ORDER);
+  const char *const src_block_kernel_va =
+      pa_to_kernel_va(page_id_to_pa(src_block_page_id));
+  for (size_t i = 0; i < 512; i++) {
+    const spage_id_t page_id = shared_page_alloc();
+    if (page_id < 0) {
+      // Roll back.
+      _vm_drop_page_table(pte, 0);
+      return false;
+    }
+
+    void *const page_kernel_va = pa_to_kernel_va(page_id_to_pa(page_id));
+    memcpy(page_kernel_va, src_block_kernel_va + (i << PAGE_ORDER),
+           1 << PAGE_ORDER);
+    if (mem_region->prot & PROT_EXEC) {
+      cache_sync_icache_range(page_kernel_va, 1 << PAGE_ORDER);
+    }
+
+    pte[i].addr = page_id_to_pa(page_id) >> PAGE_ORDER;
+    pte[i].b0 = 1;
+    pte[i].b1 = 1;
+    _set_page_attrs(mem_region, &pte[i]);
+  }
+
+  shared_page_decref(src_block_page_id);
+
+  *pmd_entry = (page_table_entry_t){
+      .b0 = 1, .b1 = 1, .addr = kernel_va_to_pa(pte) >> PAGE_ORDER};
+
+  return true;
+}
+
+static bool _cow_block(const mem_region_t *const mem_region,
+                       page_table_entry_t *const pmd_entry) {
+  switch (mem_region->type) {
+  case MEM_REGION_ANONYMOUS: {
+    const page_id_t src_block_page_id =
+        pa_to_page_id(pmd_entry->addr << PAGE_ORDER);
+    if (shared_page_getref(src_block_page_id) == 1) // No need to copy.
+      break;
+
+    const spage_id_t block_page_id = shared_page_alloc_block(VM_BLOCK_ORDER);
+    if (block_page_id < 0) // Fragmented. Fall back to pages.
+      return _split_block(mem_region, pmd_entry);
+
+    void *const block_kernel_va = pa_to_kernel_va(page_id_to_pa(block_page_id));
+    memcpy(block_kernel_va, pa_to_kernel_va(page_id_to_pa(src_block_page_id)),
+           VM_BLOCK_SIZE);
+    if (mem_region->prot & PROT_EXEC) {
+      cache_sync_icache_range(block_kernel_va, VM_BLOCK_SIZE);
+    }
+
+    shared_page_decref(src_block_page_id);
+    pmd_entry->addr = page_id_to_pa(block_page_id) >> PAGE_ORDER;
+    break;
+  }
+
+  case MEM_REGION_LINEAR: {
+    // No-op.
+    break;
+  }
+
+  default:
+    __builtin_unreachable();
+  }
+
+  _set_page_attrs(mem_region, pmd_entry);
 
   return true;
 }
 
 static vm_map_page_result_t _vm_cow(vm_addr_space_t *const addr_space,
                                     void *const va) {
-  uint64_t daif_val;
-  CRITICAL_SECTION_ENTER(daif_val);
-
   // Walk the page table.
 
-  page_table_entry_t *const pte_entry =
-      _vm_clone_unshare_pte_entry(addr_space, va);
-  if (!pte_entry) {
-    CRITICAL_SECTION_LEAVE(daif_val);
+  bool is_table_cloned, is_aptable_cleared;
+  page_table_entry_t *const pmd_entry = _vm_clone_unshare_pmd_entry(
+      addr_space, va, &is_table_cloned, &is_aptable_cleared);
+  if (!pmd_entry)
     return VM_MAP_PAGE_NOMEM;
-  }
 
-  // Map the page.
+  // Map the block or the page.
 
   const mem_region_t *const region =
       vm_mem_regions_find_region(&addr_space->mem_regions, va);
-  if (!_cow_page(region, pte_entry)) {
-    CRITICAL_SECTION_LEAVE(daif_val);
-    return VM_MAP_PAGE_NOMEM;
+  bool is_split = false;
+  if (_is_block(pmd_entry)) {
+    if (!_cow_block(region, pmd_entry))
+      return VM_MAP_PAGE_NOMEM;
+    is_split = pmd_entry->b1;
+  } else {
+    page_table_entry_t *const pte_entry =
+        _vm_clone_unshare_pte_entry(pmd_entry, va, &is_table_cloned,
+                                    &is_aptable_cleared);
+    if (!pte_entry)
+      return VM_MAP_PAGE_NOMEM;
+
+    if (!_cow_page(region, pte_entry))
+      return VM_MAP_PAGE_NOMEM;
   }
 
   // Set ttbr0_el1 again, as the PGD may have changed.
   vm_switch_to_addr_space(addr_space);
 
-  CRITICAL_SECTION_LEAVE(daif_val);
+  if (is_table_cloned) {
+    _vm_invalidate_asid(addr_space);
+  } else {
+    // A block entry caches the translations of the whole block, so any VA in
+    // it will do. A split block needs the cached block entry dropped as well,
+    // and so does a table descriptor whose read-only bit has been cleared.
+    _vm_invalidate_page(addr_space, va, !is_split && !is_aptable_cleared);
+  }
 
   return VM_MAP_PAGE_SUCCESS;
 }
@@ -551,6 +1288,8 @@ static vm_map_page_result_t _vm_cow(vm_addr_space_t *const addr_space,
 vm_map_page_result_t
 vm_handle_permission_fault(vm_addr_space_t *const addr_space, void *const va,
                            const int access_mode) {
+  addr_space->fault_stats.n_permission_faults++;
+
   const mem_region_t *const region =
       vm_mem_regions_find_region(&addr_space->mem_regions, va);
   if (access_mode & region->prot) {
@@ -574,21 +1313,27 @@ static page_table_entry_t *
 _vm_remove_region_from_pgd_rec(page_table_entry_t *const page_table,
                                void *const start_va, void *const end_va,
                                size_t level, void *const block_start,
-                               page_table_entry_t *const prev_level_entry) {
-  void *const block_end = (char *)block_start + (1 << (9 * level + PAGE_ORDER));
-
-  if (start_va == block_start && end_va == block_end) {
+                               page_table_entry_t *const prev_level_entry,
+                               bool *const is_oom) {
+  // A page table at level `level` covers 2^(9 * (level + 1)) pages.
+  void *const block_end =
+      (char *)block_start + ((size_t)1 << (9 * (level + 1) + PAGE_ORDER));
+
+  // The PGD itself is never dropped, so that NULL is returned only when out of
+  // memory.
+  if (prev_level_entry && start_va == block_start && end_va == block_end) {
     _vm_drop_page_table(page_table, level);
-    if (prev_level_entry) {
-      prev_level_entry->b0 = false;
-    }
+    prev_level_entry->b0 = false;
     return NULL;
   } else {
     page_table_entry_t *const new_page_table =
         level == 0 ? _vm_clone_unshare_pte(page_table)
                    : _vm_clone_unshare_page_table(page_table);
-    if (!new_page_table)
+    if (!new_page_table) {
+      // The entries under this table are left intact.
+      *is_oom = true;
       return NULL;
+    }
 
     if (prev_level_entry) {
       prev_level_entry->addr = kernel_va_to_pa(new_page_table) >> PAGE_ORDER;
@@ -604,7 +1349,7 @@ _vm_remove_region_from_pgd_rec(page_table_entry_t *const page_table,
       prev_level_entry->upper = upper.u;
     }
 
-    size_t subblock_stride = 1 << (9 * (level - 1) + PAGE_ORDER);
+    const size_t subblock_stride = (size_t)1 << (9 * level + PAGE_ORDER);
 
     for (size_t i = 0; i < 512; i++) {
       if (new_page_table[i].b0) {
@@ -618,16 +1363,19 @@ _vm_remove_region_from_pgd_rec(page_table_entry_t *const page_table,
                         end_va < subblock_end ? end_va : subblock_end;
 
         if (max_start < min_end) {
-          if (level == 0) {
+          if (level == 0 || !new_page_table[i].b1) { // Page or block.
+            // A block always lies entirely within a single region, so it is
+            // never partially removed.
             const page_id_t page_id =
                 pa_to_page_id(new_page_table[i].addr << PAGE_ORDER);
             shared_page_decref(page_id);
+            new_page_table[i].b0 = false;
           } else {
             page_table_entry_t *const next_level_page_table =
                 pa_to_kernel_va(new_page_table[i].addr << PAGE_ORDER);
             _vm_remove_region_from_pgd_rec(next_level_page_table, max_start,
                                            min_end, level - 1, subblock_start,
-                                           &new_page_table[i]);
+                                           &new_page_table[i], is_oom);
           }
         }
       }
@@ -639,72 +1387,406 @@ _vm_remove_region_from_pgd_rec(page_table_entry_t *const page_table,
 
 static page_table_entry_t *
 _vm_remove_region_from_pgd(page_table_entry_t *const pgd, void *const start_va,
-                           void *const end_va) {
+                           void *const end_va, bool *const is_oom) {
+  *is_oom = false;
   return _vm_remove_region_from_pgd_rec(pgd, start_va, end_va, 3, (void *)0,
-                                        NULL);
+                                        NULL, is_oom);
 }
 
-bool vm_remove_region(vm_addr_space_t *const addr_space, void *const start_va) {
+/// \brief Sets the attributes of the mappings within a range.
+///
+/// \param prot The new protection, or NULL to apply the protection of each
+///             region.
+/// \param is_oom Set if running out of memory. The entries under the page
+///               tables that cannot be unshared are left intact, and the rest
+///               of the range is still processed.
+/// \return The new page table, or NULL if it cannot be unshared.
+static page_table_entry_t *
+_vm_protect_range_rec(page_table_entry_t *const page_table,
+                      const mem_regions_t *const regions, void *const start_va,
+                      void *const end_va, size_t level, void *const block_start,
+                      page_table_entry_t *const prev_level_entry,
+                      const int *const prot, bool *const is_oom) {
+  page_table_entry_t *const new_page_table =
+      level == 0 ? _vm_clone_unshare_pte(page_table)
+                 : _vm_clone_unshare_page_table(page_table);
+  if (!new_page_table) {
+    *is_oom = true;
+    return NULL;
+  }
+
+  if (prev_level_entry) {
+    prev_level_entry->addr = kernel_va_to_pa(new_page_table) >> PAGE_ORDER;
+
+    // Since the page table is not shared, we can remove the read-only bit now.
+
+    union {
+      table_descriptor_upper_t s;
+      unsigned u;
+    } upper = {.u = prev_level_entry->upper};
+    upper.s.aptable = 0x0;
+    prev_level_entry->upper = upper.u;
+  }
+
+  const size_t subblock_stride = (size_t)1 << (9 * level + PAGE_ORDER);
+
+  for (size_t i = 0; i < 512; i++) {
+    if (new_page_table[i].b0) {
+      void *const subblock_start = (char *)block_start + i * subblock_stride,
+                  *const subblock_end =
+                      (char *)subblock_start + subblock_stride;
+
+      void *const max_start =
+                      start_va > subblock_start ? start_va : subblock_start,
+                  *const min_end =
+                      end_va < subblock_end ? end_va : subblock_end;
+
+      if (max_start < min_end) {
+        if (level == 0 || !new_page_table[i].b1) { // Page or block.
+          mem_region_t region =
+              *vm_mem_regions_find_region(regions, subblock_start);
+          if (prot) {
+            region.prot = *prot;
+          }
+
+          // Pages becoming executable may have been written through the data
+          // cache.
+          const union {
+            block_page_descriptor_upper_t s;
+            unsigned u;
+          } old_upper = {.u = new_page_table[i].upper};
+          if (region.prot & PROT_EXEC && old_upper.s.uxn &&
+              region.type != MEM_REGION_LINEAR) {
+            cache_sync_icache_range(
+                pa_to_kernel_va(new_page_table[i].addr << PAGE_ORDER),
+                subblock_stride);
+          }
+
+          _set_page_attrs(&region, &new_page_table[i]);
+
+          // Pages that are still shared stay read-only, so that writes to them
+          // are caught by the CoW path.
+          const page_id_t page_id =
+              pa_to_page_id(new_page_table[i].addr << PAGE_ORDER);
+          if (region.type != MEM_REGION_LINEAR &&
+              shared_page_getref(page_id) != 1) {
+            _set_page_read_only(&new_page_table[i]);
+          }
+        } else {
+          page_table_entry_t *const next_level_page_table =
+              pa_to_kernel_va(new_page_table[i].addr << PAGE_ORDER);
+          _vm_protect_range_rec(next_level_page_table, regions, max_start,
+                                min_end, level - 1, subblock_start,
+                                &new_page_table[i], prot, is_oom);
+        }
+      }
+    }
+  }
+
+  return new_page_table;
+}
+
+/// \brief Splits the region containing a virtual address into two at that
+///        address, unless the address is the start of the region or is not
+///        covered by any region.
+static bool _vm_split_region_at(mem_regions_t *const regions, void *const va) {
+  mem_region_t *const region =
+      (mem_region_t *)vm_mem_regions_find_region(regions, va);
+  if (!region || region->start == va)
+    return true;
+
+  const size_t left_len = (char *)va - (char *)region->start;
+
+  mem_region_t right = *region;
+  right.start = va;
+  right.len = region->len - left_len;
+  switch (region->type) {
+  case MEM_REGION_BACKED:
+    right.file_offset += left_len;
+    right.file_len =
+        region->file_len > left_len ? region->file_len - left_len : 0;
+    right.backing_file = shared_file_clone(region->backing_file);
+    break;
+
+  case MEM_REGION_LINEAR:
+    right.pa_base += left_len;
+    break;
+
+  default:
+    break;
+  }
+
+  // Shrinking the region doesn't change its position in the tree.
+  region->len = left_len;
+  if (!rb_insert(&regions->root, sizeof(mem_region_t), &right,
+                 (int (*)(const void *, const void *,
+                          void *))_vm_cmp_mem_regions_by_start,
+                 NULL)) {
+    region->len += right.len;
+    _vm_mem_regions_deleter(&right);
+    return false;
+  }
+
+  return true;
+}
+
+/// \brief Gets the PMD entry covering a virtual address without modifying the
+///        page table.
+/// \return The PMD entry, or NULL if a page table on the way is missing.
+static page_table_entry_t *_vm_find_pmd_entry(page_table_entry_t *const pgd,
+                                              void *const va) {
+  page_table_entry_t *entry = &pgd[(uintptr_t)va >> 39];
+  for (size_t level = 2; level > 0; level--) {
+    if (!entry->b0)
+      return NULL;
+    page_table_entry_t *const page_table =
+        pa_to_kernel_va(entry->addr << PAGE_ORDER);
+    entry = &page_table[((uintptr_t)va >> (12 + level * 9)) & ((1 << 9) - 1)];
+  }
+  return entry;
+}
+
+/// \brief Splits the block mapping a virtual address into pages, unless the
+///        address is block-aligned or is not mapped by a block.
+///
+/// This keeps every block within a single region when regions are split.
+static bool _vm_split_block_at(vm_addr_space_t *const addr_space,
+                               void *const va) {
+  if (((uintptr_t)va & (VM_BLOCK_SIZE - 1)) == 0)
+    return true;
+
+  const page_table_entry_t *const pmd_entry =
+      _vm_find_pmd_entry(addr_space->pgd, va);
+  if (!pmd_entry || !_is_block(pmd_entry))
+    return true;
+
+  bool is_table_cloned, is_aptable_cleared;
+  page_table_entry_t *const unshared_pmd_entry = _vm_clone_unshare_pmd_entry(
+      addr_space, va, &is_table_cloned, &is_aptable_cleared);
+  if (!unshared_pmd_entry)
+    return false;
+
+  // The address may lie just past the range, whose invalidation then misses the
+  // intermediate entries changed on the way to it.
+  if (is_table_cloned || is_aptable_cleared) {
+    vm_switch_to_addr_space(addr_space);
+    if (is_table_cloned) {
+      _vm_invalidate_asid(addr_space);
+    } else {
+      _vm_invalidate_page(addr_space, va, false);
+    }
+  }
+
+  return _split_block(vm_mem_regions_find_region(&addr_space->mem_regions, va),
+                      unshared_pmd_entry);
+}
+
+/// \brief Splits the regions and blocks straddling the boundaries of a range,
+///        so that the range can be operated on as a whole.
+static bool _vm_isolate_range(vm_addr_space_t *const addr_space,
+                              void *const start_va, void *const end_va) {
+  return _vm_split_block_at(addr_space, start_va) &&
+         _vm_split_block_at(addr_space, end_va) &&
+         _vm_split_region_at(&addr_space->mem_regions, start_va) &&
+         _vm_split_region_at(&addr_space->mem_regions, end_va);
+}
+
+/// \brief Invalidates the TLB entries of a range of an address space.
+///
+/// Small ranges are invalidated page by page. Larger ones are invalidated by
+/// ASID, which is cheaper than issuing many per-page invalidations.
+static void _vm_invalidate_range(const vm_addr_space_t *const addr_space,
+                                 void *const start_va, void *const end_va) {
+  const size_t n_pages = ((char *)end_va - (char *)start_va) >> PAGE_ORDER;
+  if (n_pages <= VM_INVALIDATE_BY_PAGE_MAX_PAGES) {
+    for (size_t i = 0; i < n_pages; i++) {
+      _vm_invalidate_page(addr_space, (char *)start_va + (i << PAGE_ORDER),
+                          false);
+    }
+  } else {
+    _vm_invalidate_asid(addr_space);
+  }
+}
+
+int vm_unmap_range(vm_addr_space_t *const addr_space, void *const start_va,
+                   const size_t len) {
+  void *const end_va = (char *)start_va + len;
+
   uint64_t daif_val;
   CRITICAL_SECTION_ENTER(daif_val);
 
-  const mem_region_t *const mem_region = rb_search(
-      addr_space->mem_regions.root, start_va,
-      (int (*)(const void *, const void *, void *))_vm_cmp_va_and_mem_region,
-      NULL);
-  void *const end_va = (char *)start_va + mem_region->len;
+  if (!_vm_isolate_range(addr_space, start_va, end_va)) {
+    CRITICAL_SECTION_LEAVE(daif_val);
+    return -ENOMEM;
+  }
 
-  rb_delete(
-      &addr_space->mem_regions.root, start_va,
-      (int (*)(const void *, const void *, void *))_vm_cmp_va_and_mem_region,
-      NULL);
+  // Remove the mappings before the regions, so that running out of memory
+  // never leaves pages mapped outside of any region. The regions are kept on
+  // failure, and whatever has already been unmapped is simply faulted in
+  // again.
 
+  bool is_oom;
   page_table_entry_t *const new_pgd =
-      _vm_remove_region_from_pgd(addr_space->pgd, start_va, end_va);
-  // Note: `_vm_remove_region_from_pgd` returns NULL when the last region is
-  // removed, i.e., a new page table need not be allocated. However, in all
-  // places where `vm_remove_region` is used, the region to be removed is never
-  // the last one. Therefore, checking for an out-of-memory condition in this
-  // way is fine.
+      _vm_remove_region_from_pgd(addr_space->pgd, start_va, end_va, &is_oom);
   if (!new_pgd) {
     CRITICAL_SECTION_LEAVE(daif_val);
-    return false;
+    return -ENOMEM;
   }
 
   addr_space->pgd = new_pgd;
 
+  // Set ttbr0_el1 again, as the PGD may have changed.
+  vm_switch_to_addr_space(addr_space);
+
+  _vm_invalidate_range(addr_space, start_va, end_va);
+
+  if (is_oom) {
+    CRITICAL_SECTION_LEAVE(daif_val);
+    return -ENOMEM;
+  }
+
+  // Remove the regions.
+
+  for (;;) {
+    mem_region_t *const region = (mem_region_t *)rb_successor(
+        addr_space->mem_regions.root, start_va,
+        (int (*)(const void *, const void *, void *))_vm_cmp_va_and_mem_region,
+        NULL);
+    if (!region || region->start >= end_va)
+      break;
+
+    void *const region_start = region->start;
+    _vm_mem_regions_deleter(region);
+    rb_delete(
+        &addr_space->mem_regions.root, region_start,
+        (int (*)(const void *, const void *, void *))_vm_cmp_va_and_mem_region,
+        NULL);
+  }
+
   CRITICAL_SECTION_LEAVE(daif_val);
-  return true;
+  return 0;
 }
 
-void vm_switch_to_addr_space(const vm_addr_space_t *const addr_space) {
+int vm_protect_range(vm_addr_space_t *const addr_space, void *const start_va,
+                     const size_t len, const int prot) {
+  void *const end_va = (char *)start_va + len;
+
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  // Check that the whole range is mapped, and that no shared mapping of a file
+  // that can never be written back becomes writable.
+
+  for (void *va = start_va; va < end_va;) {
+    const mem_region_t *const region =
+        vm_mem_regions_find_region(&addr_space->mem_regions, va);
+    if (!region) {
+      CRITICAL_SECTION_LEAVE(daif_val);
+      return -ENOMEM;
+    }
+    if (prot & PROT_WRITE && region->type == MEM_REGION_BACKED &&
+        region->flags & MAP_SHARED &&
+        region->backing_file->file->vnode->mount->is_read_only) {
+      CRITICAL_SECTION_LEAVE(daif_val);
+      return -EACCES;
+    }
+    va = (char *)region->start + region->len;
+  }
+
+  if (!_vm_isolate_range(addr_space, start_va, end_va)) {
+    CRITICAL_SECTION_LEAVE(daif_val);
+    return -ENOMEM;
+  }
+
+  // Update the mappings, and then the regions only if that succeeds, so that
+  // no mapping ever grants more than its region.
+
+  bool is_oom = false;
+  page_table_entry_t *const new_pgd =
+      _vm_protect_range_rec(addr_space->pgd, &addr_space->mem_regions,
+                            start_va, end_va, 3, (void *)0, NULL, &prot,
+                            &is_oom);
+  if (!new_pgd) {
+    CRITICAL_SECTION_LEAVE(daif_val);
+    return -ENOMEM;
+  }
+
+  addr_space->pgd = new_pgd;
+
+  if (is_oom) {
+    // Restore the old protection of the entries already changed. Their page
+    // tables have all been unshared, so this needs no memory for them.
+    _vm_protect_range_rec(addr_space->pgd, &addr_space->mem_regions, start_va,
+                          end_va, 3, (void *)0, NULL, NULL, &is_oom);
+  } else {
+    for (void *va = start_va; va < end_va;) {
+      mem_region_t *const region = (mem_region_t *)vm_mem_regions_find_region(
+          &addr_space->mem_regions, va);
+      region->prot = prot;
+      va = (char *)region->start + region->len;
+    }
+  }
+
+  // Set ttbr0_el1 again, as the PGD may have changed.
+  vm_switch_to_addr_space(addr_space);
+
+  _vm_invalidate_range(addr_space, start_va, end_va);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+  return is_oom ? -ENOMEM : 0;
+}
+
+bool vm_remove_region(vm_addr_space_t *const addr_space, void *const start_va) {
+  const mem_region_t *const mem_region = rb_search(
+      addr_space->mem_regions.root, start_va,
+      (int (*)(const void *, const void *, void *))_vm_cmp_va_and_mem_region,
+      NULL);
+
+  return vm_unmap_range(addr_space, start_va, mem_region->len) == 0;
+}
+
+void vm_switch_to_addr_space(vm_addr_space_t *const addr_space) {
+  // Don't migrate between getting the ASID and switching to it.
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
   const pa_t pgd_pa = kernel_va_to_pa(addr_space->pgd);
+  const uint64_t asid = _vm_get_asid(addr_space);
   __asm__ __volatile__(
       "dsb ish           // Ensure writes have completed.\n"
-      "msr ttbr0_el1, %0 // Switch page table.\n"
-      "tlbi vmalle1is    // Invalidate all TLB entries.\n"
-      "dsb ish           // Ensure completion of TLB invalidatation.\n"
+      "msr ttbr0_el1, %0 // Switch page table and ASID.\n"
       "isb               // Clear pipeline."
       :
-      : "r"((uint64_t)pgd_pa)
+      : "r"(asid << 48 | (uint64_t)pgd_pa)
       : "memory");
+
+  CRITICAL_SECTION_LEAVE(daif_val);
 }
 
 static void *_vm_find_mmap_addr(const vm_addr_space_t addr_space,
                                 const size_t len) {
+  // Regions that can hold a block are block-aligned so that they can actually
+  // be mapped with blocks.
+  const uintptr_t align =
+      len >= VM_BLOCK_SIZE ? VM_BLOCK_SIZE : (uintptr_t)1 << PAGE_ORDER;
+
   void *addr = (void *)(1 << PAGE_ORDER);
-  const mem_region_t *const first_predecessor = rb_predecessor(
-      addr_space.mem_regions.root, addr,
-      (int (*)(const void *, const void *, void *))_vm_cmp_va_and_mem_region,
-      NULL);
-  if (first_predecessor &&
-      addr < (void *)((char *)first_predecessor->start +
-                      first_predecessor
-                          ->len)) { // The initial address (0x1000) is taken.
-    addr = (char *)first_predecessor->start + first_predecessor->len;
-  }
+  for (;;) {
+    addr = (void *)ALIGN((uintptr_t)addr, align);
+    if (addr >= (void *)(0x1000000000000ULL - len))
+      break;
+
+    const mem_region_t *const begin_predecessor = rb_predecessor(
+        addr_space.mem_regions.root, addr,
+        (int (*)(const void *, const void *, void *))_vm_cmp_va_and_mem_region,
+        NULL);
+    if (begin_predecessor &&
+        addr < (void *)((char *)begin_predecessor->start +
+                        begin_predecessor->len)) { // The address is taken.
+      addr = (char *)begin_predecessor->start + begin_predecessor->len;
+      continue;
+    }
 
-  while (addr < (void *)(0x1000000000000ULL - len)) {
     const mem_region_t *const begin_successor = rb_successor(
         addr_space.mem_regions.root, addr,
         (int (*)(const void *, const void *, void *))_vm_cmp_va_and_mem_region,
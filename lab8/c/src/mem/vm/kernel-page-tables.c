@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #include "oscos/drivers/board.h"
+#include "oscos/drivers/mailbox.h"
 #include "oscos/mem/page-alloc.h"
 #include "oscos/mem/types.h"
 #include "oscos/mem/vm.h"
@@ -97,6 +98,11 @@ static void _map_region_as_rec(const page_id_range_t range,
   }
 }
 
+/// \brief Maps a range of page frames linearly into the kernel address space.
+///
+/// The range is mapped with the largest blocks that fit: 1 GiB and 2 MiB
+/// blocks where the range is suitably aligned, and pages only at unaligned
+/// ends.
 static void _map_region_as(const page_id_range_t range,
                            const block_page_descriptor_lower_t lower_attr,
                            const block_page_descriptor_upper_t upper_attr) {
@@ -104,11 +110,55 @@ static void _map_region_as(const page_id_range_t range,
 }
 
 void vm_setup_finer_granularity_linear_mapping(void) {
-  // Map RAM as normal memory.
+  const page_id_t peripheral_start_page_id =
+      kernel_va_to_pa(PERIPHERAL_BASE) >> 12;
+
+  // The memory above the ARM memory is owned by the VideoCore, which doesn't
+  // snoop the caches of the ARM cores. (The framebuffer lives there.)
+  const arm_memory_t arm_memory = mailbox_get_arm_memory();
+  page_id_t arm_memory_end_page_id =
+      (arm_memory.base + arm_memory.size) >> 12;
+  if (arm_memory_end_page_id == 0 ||
+      arm_memory_end_page_id > peripheral_start_page_id) {
+    arm_memory_end_page_id = peripheral_start_page_id;
+  }
+
+  // Map RAM as write-back cacheable normal memory.
   _map_region_as(
-      (page_id_range_t){.start = 0x0,
-                        .end = kernel_va_to_pa(PERIPHERAL_BASE) >> 12},
-      (block_page_descriptor_lower_t){
-          .attr_indx = 1, .ap = 0x0, .sh = 0x0, .af = 1, .ng = 0},
+      (page_id_range_t){.start = 0x0, .end = arm_memory_end_page_id},
+      (block_page_descriptor_lower_t){.attr_indx = ATTR_INDX_NORMAL_WB,
+                                      .ap = 0x0,
+                                      .sh = SH_INNER_SHAREABLE,
+                                      .af = 1,
+                                      .ng = 0},
       (block_page_descriptor_upper_t){.contiguous = 0, .pxn = 0, .uxn = 0});
+
+  // Map VideoCore memory as non-cacheable normal memory.
+  if (arm_memory_end_page_id < peripheral_start_page_id) {
+    _map_region_as(
+        (page_id_range_t){.start = arm_memory_end_page_id,
+                          .end = peripheral_start_page_id},
+        (block_page_descriptor_lower_t){.attr_indx = ATTR_INDX_NORMAL_NOCACHE,
+                                        .ap = 0x0,
+                                        .sh = SH_NON_SHAREABLE,
+                                        .af = 1,
+                                        .ng = 0},
+        (block_page_descriptor_upper_t){.contiguous = 0, .pxn = 0, .uxn = 0});
+  }
+
+  // Drop stale translations and enable the data cache.
+  //
+  // The data cache has been disabled until now, so it holds no lines that
+  // could be stale with respect to memory.
+  __asm__ __volatile__("dsb ish\n"
+                       "tlbi vmalle1is\n"
+                       "dsb ish\n"
+                       "isb\n"
+                       "mrs x0, sctlr_el1\n"
+                       "orr x0, x0, 1 << 2\n" // SCTLR_EL1.C.
+                       "msr sctlr_el1, x0\n"
+                       "isb"
+                       :
+                       :
+                       : "x0", "memory");
 }
@@ -0,0 +1,139 @@
+#include "oscos/mem/zero-pool.h"
+
+#include <stdint.h>
+
+#include "oscos/libc/string.h"
+#include "oscos/mem/page-alloc.h"
+#include "oscos/mem/vm.h"
+#include "oscos/utils/lock.h"
+
+static page_id_t _pool[ZERO_POOL_CAPACITY];
+static zero_pool_stats_t _stats;
+/// \brief The timer counter value before which the pool is not refilled.
+static uint64_t _refill_resume_time;
+
+/// \brief Protects `_pool`, `_stats` and `_refill_resume_time`.
+///
+/// A sequence lock, so that reading the statistics never holds up the
+/// allocation path.
+static seqlock_t _lock;
+
+void zero_page(void *const page) {
+  uint64_t dczid_val;
+  __asm__("mrs %0, dczid_el0" : "=r"(dczid_val));
+
+  if (dczid_val & (1 << 4)) { // DC ZVA is prohibited.
+    memset(page, 0, 1 << PAGE_ORDER);
+    return;
+  }
+
+  // DCZID_EL0.BS is the log2 of the block size in words.
+  const size_t block_size = (size_t)4 << (dczid_val & 0xf);
+  for (char *block = page; block < (char *)page + (1 << PAGE_ORDER);
+       block += block_size) {
+    __asm__ __volatile__("dc zva, %0" : : "r"(block) : "memory");
+  }
+}
+
+static uint64_t _now(void) {
+  uint64_t timestamp;
+  __asm__ __volatile__("mrs %0, cntpct_el0" : "=r"(timestamp));
+  return timestamp;
+}
+
+/// \brief Holds off refilling for a while.
+///
+/// The lock must be held.
+static void _back_off_refilling(void) {
+  uint64_t core_timer_freq_hz;
+  __asm__("mrs %0, cntfrq_el0" : "=r"(core_timer_freq_hz));
+  core_timer_freq_hz &= 0xffffffff;
+
+  _refill_resume_time =
+      _now() + core_timer_freq_hz * ZERO_POOL_REFILL_BACKOFF_SECS;
+}
+
+spage_id_t alloc_zeroed_page(void) {
+  const uint64_t daif_val = write_seqlock_irqsave(&_lock);
+
+  _stats.n_allocs++;
+  if (_stats.n_pages != 0) {
+    _stats.n_hits++;
+    const page_id_t result = _pool[--_stats.n_pages];
+    write_sequnlock_irqrestore(&_lock, daif_val);
+    return result;
+  }
+
+  write_sequnlock_irqrestore(&_lock, daif_val);
+
+  const spage_id_t result = alloc_pages(0);
+  if (result < 0)
+    return result;
+
+  zero_page(pa_to_kernel_va(page_id_to_pa(result)));
+  return result;
+}
+
+bool zero_pool_refill(void) {
+  // Racy checks to avoid allocating a page only to free it again most of the
+  // time. The pool is checked again under the lock before the page is added.
+  if (*(const volatile size_t *)&_stats.n_pages == ZERO_POOL_CAPACITY ||
+      (int64_t)(_now() - *(const volatile uint64_t *)&_refill_resume_time) < 0)
+    return false;
+
+  const spage_id_t page = alloc_pages(0);
+  if (page < 0) {
+    const uint64_t daif_val = write_seqlock_irqsave(&_lock);
+    _back_off_refilling();
+    write_sequnlock_irqrestore(&_lock, daif_val);
+    return false;
+  }
+
+  // Zero the page without blocking interrupts. The page is not visible to
+  // anyone else yet.
+  zero_page(pa_to_kernel_va(page_id_to_pa(page)));
+
+  const uint64_t daif_val = write_seqlock_irqsave(&_lock);
+
+  const bool is_added = _stats.n_pages != ZERO_POOL_CAPACITY;
+  if (is_added) {
+    _pool[_stats.n_pages++] = page;
+    _stats.n_refills++;
+  }
+
+  write_sequnlock_irqrestore(&_lock, daif_val);
+
+  if (!is_added) {
+    free_pages(page);
+  }
+  return is_added;
+}
+
+void zero_pool_drain(void) {
+  page_id_t pages[ZERO_POOL_CAPACITY];
+
+  write_seqlock(&_lock);
+
+  const size_t n_pages = _stats.n_pages;
+  memcpy(pages, _pool, n_pages * sizeof(page_id_t));
+  _stats.n_pages = 0;
+  _stats.n_drains++;
+  // Don't take the pages right back.
+  _back_off_refilling();
+
+  write_sequnlock(&_lock);
+
+  for (size_t i = 0; i < n_pages; i++) {
+    free_pages_unlocked(pages[i]);
+  }
+}
+
+zero_pool_stats_t zero_pool_get_stats(void) {
+  zero_pool_stats_t result;
+  uint32_t seq;
+  do {
+    seq = read_seqbegin(&_lock);
+    result = _stats;
+  } while (read_seqretry(&_lock, seq));
+  return result;
+}
@@ -1,8 +1,30 @@
 #include "oscos/sched.h"
 
+#include "oscos/mem/zero-pool.h"
+#include "oscos/utils/kernel-lock.h"
+#include "oscos/xcpt.h"
+
+/// \brief Waits for an interrupt without holding the kernel lock, so that the
+///        other cores can run meanwhile.
+static void _wait_for_interrupt(void) {
+  // A pending interrupt wakes up the core even if it is masked. It is taken
+  // once the lock is reacquired.
+  XCPT_MASK_ALL();
+  kernel_lock_release();
+  __asm__ __volatile__("wfi");
+  kernel_lock_acquire();
+  XCPT_UNMASK_ALL();
+}
+
 void idle(void) {
   for (;;) {
     kill_zombies();
+    // Zero at most one page per iteration, so that runnable threads are not
+    // kept waiting.
+    const bool has_zeroed_page = zero_pool_refill();
     schedule();
+    if (!has_zeroed_page && !sched_has_ready_threads()) {
+      _wait_for_interrupt();
+    }
   }
 }
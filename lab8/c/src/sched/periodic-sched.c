@@ -10,6 +10,7 @@ static void _periodic_sched(void *const _arg) {
   (void)_arg;
 
   sched_setup_periodic_scheduling();
+  sched_balance_load();
 
   // Save spsr_el1 and elr_el1, since they can be clobbered by other threads.
 
@@ -1,13 +1,32 @@
-// This module implements a round-robin scheduler.
+// This module implements a weighted fair scheduler with a run queue per core.
+//
+// Each core runs the queued thread that has received the least CPU time
+// relative to its weight, which is set by its nice value. A thread woken up
+// from a wait is credited for part of its sleep and may preempt the running
+// thread, so that interactive threads respond quickly.
+//
+// A thread is queued on a single core at a time. A woken-up thread goes to the
+// core it last ran on, where its data may still be cached, or to the waking
+// core if that one is less busy. A core with nothing to run steals a thread
+// from the busiest core, and every core periodically pulls threads from the
+// busiest core to even out the loads.
 
 #include "oscos/sched.h"
 
+#include <stdalign.h>
+
+#include "oscos/console.h"
+#include "oscos/elf.h"
 #include "oscos/libc/string.h"
 #include "oscos/mem/malloc.h"
 #include "oscos/mem/page-alloc.h"
 #include "oscos/mem/vm.h"
+#include "oscos/uapi/errno.h"
+#include "oscos/uapi/sys/resource.h"
 #include "oscos/utils/align.h"
+#include "oscos/utils/core-id.h"
 #include "oscos/utils/critical-section.h"
+#include "oscos/utils/lock.h"
 #include "oscos/utils/math.h"
 #include "oscos/utils/rb.h"
 
@@ -17,21 +36,85 @@
 #define USER_STACK_ORDER 23 // 8MB.
 #define USER_STACK_BLOCK_ORDER (USER_STACK_ORDER - PAGE_ORDER)
 
+#define AFFINITY_ALL ((UINT64_C(1) << N_CORES) - 1)
+
+/// \brief The number of scheduler ticks between load balancing rounds.
+#define BALANCE_INTERVAL_TICKS 8 // 250ms.
+
+/// \brief The weight of a thread with nice value 0.
+#define NICE_0_WEIGHT 1024
+
 void _suspend_to_wait_queue(thread_list_node_t *wait_queue);
 void _sched_run_thread(thread_t *thread);
+void _sched_save_fp_simd_ctx(thread_fp_simd_ctx_t *ctx);
+void _sched_load_fp_simd_ctx(const thread_fp_simd_ctx_t *ctx);
 void thread_main(void);
 noreturn void user_program_main(const void *init_pc, const void *init_user_sp,
                                 const void *init_kernel_sp);
 noreturn void fork_child_ret(void);
 void run_signal_handler(sighandler_t handler);
 
+/// \brief The run queue of a core.
+typedef struct {
+  spinlock_t lock;
+  /// \brief The queued threads, ordered by virtual runtime.
+  rb_node_t *threads;
+  /// \brief The thread running on the core.
+  thread_t *curr_thread;
+  /// \brief The idle thread of the core, or NULL if the core is offline. The
+  ///        idle thread is never queued.
+  thread_t *idle_thread;
+  /// \brief A monotonic lower bound of the virtual runtimes of the running and
+  ///        queued threads.
+  uint64_t min_vruntime;
+  /// \brief The timer counter value when the running thread was last charged.
+  uint64_t exec_start;
+  /// \brief Whether or not a woken-up thread should preempt the running one.
+  bool need_resched;
+  size_t n_ticks_since_balance;
+  sched_run_queue_stats_t stats;
+} run_queue_t;
+
+/// \brief The weights of the nice values from PRIO_MIN to PRIO_MAX - 1.
+///
+/// Each nice level changes the share of CPU time by about 10% relative to a
+/// thread one level away.
+static const uint32_t _nice_to_weight[PRIO_MAX - PRIO_MIN] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,    36,    29,    23,    18,    15};
+
 static size_t _sched_next_tid = 1, _sched_next_pid = 1;
-static thread_list_node_t _run_queue = {.prev = &_run_queue,
-                                        .next = &_run_queue},
-                          _zombies = {.prev = &_zombies, .next = &_zombies},
+static run_queue_t _run_queues[N_CORES];
+static thread_list_node_t _zombies = {.prev = &_zombies, .next = &_zombies},
                           _stopped_threads = {.prev = &_stopped_threads,
                                               .next = &_stopped_threads};
 static rb_node_t *_processes = NULL;
+static obj_cache_t *_thread_cache, *_process_cache, *_fp_simd_ctx_cache,
+    *_run_queue_node_cache;
+
+/// \brief How far before the minimum virtual runtime of a run queue a
+///        woken-up thread is placed, in timer counter ticks.
+static uint64_t _wakeup_bonus;
+/// \brief How far ahead of a woken-up thread the running thread must be for
+///        the former to preempt the latter, in timer counter ticks.
+static uint64_t _wakeup_preemption_granularity;
+
+/// \brief The thread whose FP/SIMD context is live in the registers of each
+///        core, if any.
+static thread_t *_fp_simd_owners[N_CORES];
+static sched_fp_simd_stats_t _fp_simd_stats;
+
+/// \brief Constructor of process_t.
+///
+/// A process_t returned to its cache must have all its file descriptor slots
+/// closed.
+static void _process_ctor(process_t *const process) {
+  for (size_t i = 0; i < N_FDS; i++) {
+    process->fds[i] = NULL;
+  }
+}
 
 static int _cmp_processes_by_pid(const process_t *const *const p1,
                                  const process_t *const *const p2, void *_arg) {
@@ -86,10 +169,6 @@ static void _add_thread_to_queue(thread_t *const thread,
   CRITICAL_SECTION_LEAVE(daif_val);
 }
 
-static void _add_thread_to_run_queue(thread_t *const thread) {
-  _add_thread_to_queue(thread, &_run_queue);
-}
-
 void _remove_thread_from_queue(thread_t *const thread) {
   thread_list_node_t *const thread_node = &thread->list_node;
 
@@ -121,34 +200,783 @@ thread_t *_remove_first_thread_from_queue(thread_list_node_t *const queue) {
   return result;
 }
 
-bool sched_init(void) {
-  // Create the idle thread.
+// Run queues.
+//
+// Each run queue orders its threads by virtual runtime, i.e., the CPU time a
+// thread has received scaled by the inverse of its weight, and runs the thread
+// that has received the least. The virtual runtimes on different cores are not
+// comparable, so a thread moving between cores is rebased from the minimum
+// virtual runtime of one run queue to that of the other. Virtual runtimes are
+// compared by their difference, so that wrapping around does no harm.
+
+static uint64_t _sched_now(void) {
+  uint64_t timestamp;
+  __asm__ __volatile__("mrs %0, cntpct_el0" : "=r"(timestamp));
+  return timestamp;
+}
 
-  thread_t *const idle_thread = malloc(sizeof(thread_t));
-  if (!idle_thread)
+static bool _vruntime_before(const uint64_t v1, const uint64_t v2) {
+  return (int64_t)(v1 - v2) < 0;
+}
+
+static int _cmp_threads_by_vruntime(const thread_t *const *const t1,
+                                    const thread_t *const *const t2,
+                                    void *const _arg) {
+  (void)_arg;
+
+  const thread_t *const thread1 = *t1, *const thread2 = *t2;
+  if (_vruntime_before(thread1->vruntime, thread2->vruntime))
+    return -1;
+  if (_vruntime_before(thread2->vruntime, thread1->vruntime))
+    return 1;
+  return thread1->id < thread2->id ? -1 : thread1->id > thread2->id ? 1 : 0;
+}
+
+static thread_t *_thread_of_rb_node(const rb_node_t *const node) {
+  return *(thread_t *const *)node->payload;
+}
+
+static bool _core_is_online(const size_t core_id) {
+  return _run_queues[core_id].idle_thread;
+}
+
+static bool _core_is_allowed(const thread_t *const thread,
+                             const size_t core_id) {
+  return thread->affinity >> core_id & 1 && _core_is_online(core_id);
+}
+
+/// \brief Gets the number of threads running or waiting to run on a core.
+static size_t _core_load(const size_t core_id) {
+  const run_queue_t *const run_queue = &_run_queues[core_id];
+  return run_queue->stats.n_ready_threads +
+         (run_queue->curr_thread && !run_queue->curr_thread->status.is_idle);
+}
+
+/// \brief Checks if a core is running its idle thread.
+static bool _core_is_idle(const size_t core_id) {
+  const run_queue_t *const run_queue = &_run_queues[core_id];
+  return run_queue->curr_thread && run_queue->curr_thread->status.is_idle;
+}
+
+/// \brief Finds the queued thread with the least virtual runtime that is
+///        allowed to run on a core.
+static thread_t *_find_first_allowed_rec(const rb_node_t *const node,
+                                         const size_t core_id) {
+  if (!node)
+    return NULL;
+
+  thread_t *const result = _find_first_allowed_rec(node->children[0], core_id);
+  if (result)
+    return result;
+
+  thread_t *const thread = _thread_of_rb_node(node);
+  if (thread->affinity >> core_id & 1)
+    return thread;
+
+  return _find_first_allowed_rec(node->children[1], core_id);
+}
+
+/// \brief Links a thread into a run queue.
+///
+/// This function is safe to call only with the lock of the run queue held.
+static void _run_queue_link(run_queue_t *const run_queue,
+                            thread_t *const thread) {
+  rb_insert_node(&run_queue->threads, thread->run_queue_node,
+                 (int (*)(const void *, const void *,
+                          void *))_cmp_threads_by_vruntime,
+                 NULL);
+  run_queue->stats.n_ready_threads++;
+}
+
+/// \brief Unlinks a thread from a run queue.
+///
+/// This function is safe to call only with the lock of the run queue held.
+static void _run_queue_unlink(run_queue_t *const run_queue,
+                              thread_t *const thread) {
+  const thread_t *const key = thread;
+  rb_remove_node(&run_queue->threads, &key,
+                 (int (*)(const void *, const void *,
+                          void *))_cmp_threads_by_vruntime,
+                 NULL);
+  run_queue->stats.n_ready_threads--;
+}
+
+/// \brief Advances the minimum virtual runtime of a run queue to the least
+///        virtual runtime among its running and queued threads.
+///
+/// The minimum never goes backwards, so that a thread cannot gain CPU time by
+/// leaving and rejoining a run queue.
+///
+/// This function is safe to call only with the lock of the run queue held.
+static void _run_queue_update_min_vruntime(run_queue_t *const run_queue) {
+  const thread_t *const curr_thread = run_queue->curr_thread;
+  const rb_node_t *first_node = run_queue->threads;
+  while (first_node && first_node->children[0]) {
+    first_node = first_node->children[0];
+  }
+  const thread_t *const first_thread =
+      first_node ? _thread_of_rb_node(first_node) : NULL;
+
+  bool has_candidate = false;
+  uint64_t candidate = 0;
+  if (curr_thread && !curr_thread->status.is_idle &&
+      curr_thread->status.is_running) {
+    candidate = curr_thread->vruntime;
+    has_candidate = true;
+  }
+  if (first_thread &&
+      (!has_candidate || _vruntime_before(first_thread->vruntime, candidate))) {
+    candidate = first_thread->vruntime;
+    has_candidate = true;
+  }
+
+  if (has_candidate && _vruntime_before(run_queue->min_vruntime, candidate)) {
+    run_queue->min_vruntime = candidate;
+  }
+}
+
+/// \brief Rebases the virtual runtime of a thread not in any run queue onto
+///        the run queue of a core.
+///
+/// This function must be called within a critical section.
+static void _rebase_vruntime(thread_t *const thread, const size_t core_id) {
+  if (thread->core_id == core_id)
+    return;
+
+  run_queue_t *const run_queue = &_run_queues[core_id];
+  thread->vruntime = thread->vruntime -
+                     _run_queues[thread->core_id].min_vruntime +
+                     run_queue->min_vruntime;
+  thread->core_id = core_id;
+  run_queue->stats.n_migrations++;
+}
+
+/// \brief Charges the CPU time since the last call to the thread running on the
+///        current core.
+///
+/// This function must be called within a critical section.
+static void _account_curr_thread(void) {
+  run_queue_t *const run_queue = &_run_queues[get_core_id()];
+  thread_t *const curr_thread = run_queue->curr_thread;
+
+  const uint64_t now = _sched_now(), delta = now - run_queue->exec_start;
+  run_queue->exec_start = now;
+
+  curr_thread->cpu_time += delta;
+  if (curr_thread->status.is_idle)
+    return;
+
+  curr_thread->vruntime +=
+      delta * NICE_0_WEIGHT / _nice_to_weight[curr_thread->nice - PRIO_MIN];
+
+  spin_lock(&run_queue->lock);
+  _run_queue_update_min_vruntime(run_queue);
+  spin_unlock(&run_queue->lock);
+}
+
+/// \brief Adds a thread to the run queue of a core.
+///
+/// \param is_waking_up Whether or not the thread is woken up from a wait. Such
+///                     a thread is placed at most \ref _wakeup_bonus before the
+///                     minimum virtual runtime of the run queue, and it
+///                     preempts the running thread if it is due to run before
+///                     it by a margin.
+static void _run_queue_add(const size_t core_id, thread_t *const thread,
+                           const bool is_waking_up) {
+  run_queue_t *const run_queue = &_run_queues[core_id];
+
+  const uint64_t daif_val = spin_lock_irqsave(&run_queue->lock);
+
+  _rebase_vruntime(thread, core_id);
+
+  if (is_waking_up) {
+    // Credit the thread for its sleep, but only so much, so that sleeping
+    // often does not let it monopolize the core.
+    const uint64_t min_vruntime = run_queue->min_vruntime - _wakeup_bonus;
+    if (_vruntime_before(thread->vruntime, min_vruntime)) {
+      thread->vruntime = min_vruntime;
+    }
+
+    const thread_t *const curr_thread = run_queue->curr_thread;
+    if (curr_thread &&
+        (curr_thread->status.is_idle ||
+         _vruntime_before(thread->vruntime + _wakeup_preemption_granularity,
+                          curr_thread->vruntime))) {
+      run_queue->need_resched = true;
+    }
+  }
+
+  _run_queue_link(run_queue, thread);
+
+  spin_unlock_irqrestore(&run_queue->lock, daif_val);
+}
+
+/// \brief Removes a thread from the run queue it is in.
+static void _run_queue_remove(thread_t *const thread) {
+  run_queue_t *const run_queue = &_run_queues[thread->core_id];
+
+  const uint64_t daif_val = spin_lock_irqsave(&run_queue->lock);
+
+  _run_queue_unlink(run_queue, thread);
+
+  spin_unlock_irqrestore(&run_queue->lock, daif_val);
+}
+
+/// \brief Removes the first thread allowed to run on a core from the run queue
+///        of a possibly different core.
+/// \return The thread, or NULL if there is none.
+static thread_t *_run_queue_remove_first_allowed(const size_t queue_core_id,
+                                                 const size_t core_id) {
+  run_queue_t *const run_queue = &_run_queues[queue_core_id];
+
+  const uint64_t daif_val = spin_lock_irqsave(&run_queue->lock);
+
+  thread_t *const result = _find_first_allowed_rec(run_queue->threads, core_id);
+  if (result) {
+    _run_queue_unlink(run_queue, result);
+  }
+
+  spin_unlock_irqrestore(&run_queue->lock, daif_val);
+  return result;
+}
+
+/// \brief Checks if the run queue of a core has a thread allowed to run on a
+///        possibly different core.
+static bool _run_queue_has_allowed(const size_t queue_core_id,
+                                   const size_t core_id) {
+  run_queue_t *const run_queue = &_run_queues[queue_core_id];
+
+  const uint64_t daif_val = spin_lock_irqsave(&run_queue->lock);
+
+  const bool result = _find_first_allowed_rec(run_queue->threads, core_id);
+
+  spin_unlock_irqrestore(&run_queue->lock, daif_val);
+  return result;
+}
+
+/// \brief Finds the other core with the most queued threads that a core can
+///        take over.
+/// \return The core, or N_CORES if there is none.
+static size_t _find_busiest_core(const size_t core_id) {
+  size_t result = N_CORES, max_n_ready_threads = 0;
+  for (size_t i = 0; i < N_CORES; i++) {
+    const size_t n_ready_threads = _run_queues[i].stats.n_ready_threads;
+    if (i != core_id && n_ready_threads > max_n_ready_threads &&
+        _run_queue_has_allowed(i, core_id)) {
+      result = i;
+      max_n_ready_threads = n_ready_threads;
+    }
+  }
+  return result;
+}
+
+/// \brief Finds the least loaded core a thread is allowed to run on.
+static size_t _select_least_loaded_core(const thread_t *const thread) {
+  size_t result = get_core_id(), min_load = SIZE_MAX;
+  for (size_t i = 0; i < N_CORES; i++) {
+    if (!_core_is_allowed(thread, i))
+      continue;
+
+    const size_t load = _core_load(i);
+    if (load < min_load) {
+      result = i;
+      min_load = load;
+    }
+  }
+  return result;
+}
+
+/// \brief Selects the core to run a woken-up thread on.
+///
+/// The core the thread last ran on is preferred, since its caches may still
+/// hold the data of the thread, unless the waking core is less loaded. An idle
+/// core other than the waking one is only woken up by its next timer tick, as
+/// no IPI is sent, so the waking core is also preferred over such a core.
+static size_t _select_core_for_wake_up(const thread_t *const thread) {
+  const size_t last_core_id = thread->core_id, curr_core_id = get_core_id();
+  const bool is_last_core_allowed = _core_is_allowed(thread, last_core_id),
+             is_curr_core_allowed = _core_is_allowed(thread, curr_core_id);
+
+  if (is_last_core_allowed &&
+      !(is_curr_core_allowed &&
+        (_core_load(curr_core_id) < _core_load(last_core_id) ||
+         (last_core_id != curr_core_id && _core_is_idle(last_core_id)))))
+    return last_core_id;
+  if (is_curr_core_allowed)
+    return curr_core_id;
+  return _select_least_loaded_core(thread);
+}
+
+/// \brief Adds a newly-created thread to the run queue of the least loaded
+///        core.
+static void _run_queue_add_new_thread(thread_t *const thread) {
+  const size_t core_id = _select_least_loaded_core(thread);
+  run_queue_t *const run_queue = &_run_queues[core_id];
+
+  const uint64_t daif_val = spin_lock_irqsave(&run_queue->lock);
+
+  thread->core_id = core_id;
+  thread->vruntime = run_queue->min_vruntime;
+  _run_queue_link(run_queue, thread);
+
+  spin_unlock_irqrestore(&run_queue->lock, daif_val);
+}
+
+static void _add_thread_to_run_queue(thread_t *const thread) {
+  _run_queue_add(_select_core_for_wake_up(thread), thread, true);
+}
+
+/// \brief Removes a thread that is not running from the run queue or the wait
+///        queue it is in.
+static void _dequeue_thread(thread_t *const thread) {
+  if (thread->status.is_waiting) {
+    _remove_thread_from_queue(thread);
+  } else {
+    _run_queue_remove(thread);
+  }
+}
+
+/// \brief Picks the next thread to run on the current core, stealing one from
+///        the busiest core if the run queue of the current core is empty.
+///
+/// This function must be called within a critical section.
+static thread_t *_pick_next_thread(void) {
+  const size_t core_id = get_core_id();
+  run_queue_t *const run_queue = &_run_queues[core_id];
+
+  thread_t *next_thread =
+      _run_queue_remove_first_allowed(core_id, core_id);
+  if (!next_thread) {
+    const size_t busiest_core_id = _find_busiest_core(core_id);
+    if (busiest_core_id != N_CORES &&
+        (next_thread =
+             _run_queue_remove_first_allowed(busiest_core_id, core_id))) {
+      _rebase_vruntime(next_thread, core_id);
+      run_queue->stats.n_steals++;
+    }
+  }
+  if (!next_thread) {
+    next_thread = run_queue->idle_thread;
+  }
+
+  next_thread->core_id = core_id;
+  run_queue->curr_thread = next_thread;
+  run_queue->exec_start = _sched_now();
+  run_queue->need_resched = false;
+  return next_thread;
+}
+
+void sched_balance_load(void) {
+  const size_t core_id = get_core_id();
+  run_queue_t *const run_queue = &_run_queues[core_id];
+
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  if (++run_queue->n_ticks_since_balance < BALANCE_INTERVAL_TICKS) {
+    CRITICAL_SECTION_LEAVE(daif_val);
+    return;
+  }
+  run_queue->n_ticks_since_balance = 0;
+
+  // Pull half of the excess load of the busiest core, so that the two cores
+  // end up even.
+
+  const size_t busiest_core_id = _find_busiest_core(core_id);
+  if (busiest_core_id != N_CORES) {
+    const size_t busiest_load = _core_load(busiest_core_id),
+                 load = _core_load(core_id),
+                 n_threads_to_pull =
+                     busiest_load > load ? (busiest_load - load) / 2 : 0;
+    for (size_t i = 0; i < n_threads_to_pull; i++) {
+      thread_t *const thread =
+          _run_queue_remove_first_allowed(busiest_core_id, core_id);
+      if (!thread)
+        break;
+
+      _run_queue_add(core_id, thread, false);
+      run_queue->stats.n_balance_pulls++;
+    }
+  }
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+int sched_set_affinity(process_t *const process, const uint64_t affinity) {
+  thread_t *const thread = process->main_thread;
+
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  bool is_any_core_allowed = false;
+  for (size_t i = 0; i < N_CORES; i++) {
+    if (affinity >> i & 1 && _core_is_online(i)) {
+      is_any_core_allowed = true;
+    }
+  }
+  if (!is_any_core_allowed) {
+    CRITICAL_SECTION_LEAVE(daif_val);
+    return -EINVAL;
+  }
+
+  thread->affinity = affinity & AFFINITY_ALL;
+
+  // A waiting thread moves once it is woken up, and a thread running on
+  // another core moves once it is switched from.
+  if (!thread->status.is_running && !thread->status.is_waiting &&
+      !_core_is_allowed(thread, thread->core_id)) {
+    _run_queue_remove(thread);
+    _run_queue_add(_select_least_loaded_core(thread), thread, false);
+  }
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+
+  if (thread == current_thread() &&
+      !_core_is_allowed(thread, thread->core_id)) {
+    schedule();
+  }
+
+  return 0;
+}
+
+sched_run_queue_stats_t sched_get_run_queue_stats(const size_t core_id) {
+  run_queue_t *const run_queue = &_run_queues[core_id];
+
+  const uint64_t daif_val = spin_lock_irqsave(&run_queue->lock);
+
+  sched_run_queue_stats_t result = run_queue->stats;
+  result.idle_time =
+      run_queue->idle_thread ? run_queue->idle_thread->cpu_time : 0;
+
+  spin_unlock_irqrestore(&run_queue->lock, daif_val);
+  return result;
+}
+
+void sched_set_nice(process_t *const process, const int nice) {
+  // The weight only affects how fast the virtual runtime grows, so a queued
+  // thread need not be requeued.
+  process->main_thread->nice = nice < PRIO_MIN       ? PRIO_MIN
+                               : nice > PRIO_MAX - 1 ? PRIO_MAX - 1
+                                                     : nice;
+}
+
+int sched_get_nice(const process_t *const process) {
+  return process->main_thread->nice;
+}
+
+// Lazy FP/SIMD context switching.
+//
+// EL0 accesses to the FP/SIMD registers trap unless the current thread owns
+// the registers of its core. A thread acquires them on the first access after
+// being switched to, so threads that never use FP/SIMD never pay for it. Since
+// threads migrate between cores, the owner saves its context when switched
+// from, but it keeps the ownership: if it is switched back to on the same core
+// before another thread acquires the registers, no restore is needed. The
+// kernel itself is built without FP/SIMD and never clobbers the registers.
+
+/// \brief Sets whether or not EL0 can access the FP/SIMD registers without
+///        trapping.
+static void _fp_simd_set_el0_access(const bool enabled) {
+  // CPACR_EL1.FPEN: 0b11 traps nothing; 0b01 traps EL0 accesses.
+  const uint64_t cpacr_val = enabled ? 0x300000 : 0x100000;
+  __asm__ __volatile__("msr cpacr_el1, %0" : : "r"(cpacr_val));
+}
+
+/// \brief Saves the FP/SIMD registers to the context of a thread if it owns
+///        the registers of the current core.
+///
+/// This function must be called within a critical section, on the thread or on
+/// the core switching from it.
+static void _fp_simd_write_back(const thread_t *const thread) {
+  if (_fp_simd_owners[get_core_id()] == thread) {
+    _sched_save_fp_simd_ctx(thread->ctx.fp_simd_ctx);
+    _fp_simd_stats.n_saves++;
+  }
+}
+
+/// \brief Revokes the ownership of the FP/SIMD registers of every core from a
+///        thread.
+///
+/// This function must be called within a critical section.
+static void _fp_simd_disown(const thread_t *const thread) {
+  for (size_t i = 0; i < N_CORES; i++) {
+    if (_fp_simd_owners[i] == thread) {
+      _fp_simd_owners[i] = NULL;
+    }
+  }
+  if (thread == current_thread()) {
+    _fp_simd_set_el0_access(false);
+  }
+}
+
+/// \brief Drops the FP/SIMD context of a thread without saving it.
+static void _fp_simd_discard(thread_t *const thread) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  _fp_simd_disown(thread);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+
+  obj_cache_free(_fp_simd_ctx_cache, thread->ctx.fp_simd_ctx);
+  thread->ctx.fp_simd_ctx = NULL;
+}
+
+/// \brief Prepares the FP/SIMD context of the current thread for running a
+///        signal handler.
+///
+/// The signal handler starts with zeroed FP/SIMD registers.
+///
+/// \param saved_ctx Where to save the FP/SIMD context of the interrupted code.
+/// \return Whether or not the interrupted code has an FP/SIMD context.
+static bool
+_fp_simd_enter_signal_handler(thread_fp_simd_ctx_t *const saved_ctx) {
+  thread_t *const curr_thread = current_thread();
+  thread_fp_simd_ctx_t *const fp_simd_ctx = curr_thread->ctx.fp_simd_ctx;
+  if (!fp_simd_ctx)
     return false;
 
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  _fp_simd_write_back(curr_thread);
+  _fp_simd_disown(curr_thread);
+  memcpy(saved_ctx, fp_simd_ctx, sizeof(thread_fp_simd_ctx_t));
+  memset(fp_simd_ctx, 0, sizeof(thread_fp_simd_ctx_t));
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+
+  return true;
+}
+
+/// \brief Restores the FP/SIMD context of the current thread after running a
+///        signal handler.
+///
+/// \param saved_ctx The FP/SIMD context saved by
+///                  _fp_simd_enter_signal_handler, or NULL if the interrupted
+///                  code has no FP/SIMD context.
+static void
+_fp_simd_leave_signal_handler(const thread_fp_simd_ctx_t *const saved_ctx) {
+  thread_t *const curr_thread = current_thread();
+
+  if (!saved_ctx) {
+    _fp_simd_discard(curr_thread);
+    return;
+  }
+
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  _fp_simd_disown(curr_thread);
+  memcpy(curr_thread->ctx.fp_simd_ctx, saved_ctx,
+         sizeof(thread_fp_simd_ctx_t));
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+/// \brief Saves the FP/SIMD context of a thread being switched from, so that
+///        it can be resumed on any core.
+///
+/// This function must be called within a critical section.
+static void _fp_simd_switch_from(const thread_t *const thread) {
+  if (_fp_simd_owners[get_core_id()] == thread) {
+    _fp_simd_write_back(thread);
+  } else if (thread->ctx.fp_simd_ctx) {
+    _fp_simd_stats.n_saves_avoided++;
+  }
+}
+
+/// \brief Switches the FP/SIMD access permission to the given thread.
+///
+/// This function is called by _sched_run_thread with interrupts masked.
+void _sched_fp_simd_switch_to(const thread_t *const thread) {
+  const bool is_owner = thread == _fp_simd_owners[get_core_id()];
+  if (is_owner) {
+    _fp_simd_stats.n_restores_avoided++;
+  }
+  _fp_simd_set_el0_access(is_owner);
+}
+
+bool thread_fp_simd_acquire(void) {
+  thread_t *const curr_thread = current_thread();
+
+  if (!curr_thread->ctx.fp_simd_ctx) {
+    thread_fp_simd_ctx_t *const fp_simd_ctx =
+        obj_cache_alloc(_fp_simd_ctx_cache);
+    if (!fp_simd_ctx)
+      return false;
+
+    memset(fp_simd_ctx, 0, sizeof(thread_fp_simd_ctx_t));
+    curr_thread->ctx.fp_simd_ctx = fp_simd_ctx;
+  }
+
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  // The context of the previous owner has been saved when it was switched
+  // from. The registers of other cores that the current thread still owns
+  // become stale.
+  _fp_simd_stats.n_traps++;
+  thread_t **const owner = &_fp_simd_owners[get_core_id()];
+  if (*owner != curr_thread) {
+    _fp_simd_disown(curr_thread);
+    _sched_load_fp_simd_ctx(curr_thread->ctx.fp_simd_ctx);
+    _fp_simd_stats.n_restores++;
+    *owner = curr_thread;
+  }
+  _fp_simd_set_el0_access(true);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+
+  return true;
+}
+
+sched_fp_simd_stats_t sched_get_fp_simd_stats(void) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  const sched_fp_simd_stats_t result = _fp_simd_stats;
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+  return result;
+}
+
+static void _init_idle_thread(thread_t *const idle_thread) {
   idle_thread->id = 0;
+  idle_thread->status.is_waiting = false;
+  idle_thread->status.is_stopped = false;
+  idle_thread->status.is_waken_up_by_signal = false;
+  idle_thread->status.is_handling_signal = false;
+  idle_thread->status.is_idle = true;
+  idle_thread->status.is_running = false;
+  idle_thread->status.is_killed = false;
+  idle_thread->n_mutexes_held = 0;
+  idle_thread->affinity = AFFINITY_ALL;
+  idle_thread->core_id = 0;
+  idle_thread->nice = 0;
+  idle_thread->vruntime = 0;
+  idle_thread->cpu_time = 0;
+  idle_thread->run_queue_node = NULL;
   idle_thread->process = NULL;
   idle_thread->ctx.fp_simd_ctx = NULL;
+}
+
+bool sched_init(void) {
+  // Create the object caches.
+
+  _thread_cache =
+      obj_cache_create("thread_t", sizeof(thread_t), alignof(thread_t), NULL);
+  _process_cache = obj_cache_create("process_t", sizeof(process_t),
+                                    alignof(process_t),
+                                    (void (*)(void *))_process_ctor);
+  _fp_simd_ctx_cache = obj_cache_create("thread_fp_simd_ctx_t",
+                                        sizeof(thread_fp_simd_ctx_t),
+                                        alignof(thread_fp_simd_ctx_t), NULL);
+  _run_queue_node_cache = obj_cache_create(
+      "run_queue_node", sizeof(rb_node_t) + sizeof(thread_t *),
+      alignof(rb_node_t), NULL);
+  if (!(_thread_cache && _process_cache && _fp_simd_ctx_cache &&
+        _run_queue_node_cache))
+    return false;
+
+  // Set the tunables, which depend on the timer frequency.
+
+  uint64_t core_timer_freq_hz;
+  __asm__("mrs %0, cntfrq_el0" : "=r"(core_timer_freq_hz));
+  core_timer_freq_hz &= 0xffffffff;
+
+  _wakeup_bonus = core_timer_freq_hz >> 5; // One scheduler tick.
+  _wakeup_preemption_granularity = core_timer_freq_hz >> 8;
+
+  // Initialize the run queues.
+
+  for (size_t i = 0; i < N_CORES; i++) {
+    run_queue_t *const run_queue = &_run_queues[i];
+    spin_lock_init(&run_queue->lock, "run_queue");
+    run_queue->threads = NULL;
+    run_queue->curr_thread = run_queue->idle_thread = NULL;
+    run_queue->min_vruntime = 0;
+    run_queue->exec_start = 0;
+    run_queue->need_resched = false;
+    run_queue->n_ticks_since_balance = 0;
+    run_queue->stats = (sched_run_queue_stats_t){0};
+  }
+
+  // Create the idle thread.
+
+  thread_t *const idle_thread = obj_cache_alloc(_thread_cache);
+  if (!idle_thread)
+    return false;
+
+  _init_idle_thread(idle_thread);
 
   // Name the current thread the idle thread.
 
-  __asm__ __volatile__("msr tpidr_el1, %0" : : "r"(idle_thread));
+  sched_init_secondary_core(idle_thread);
 
   return true;
 }
 
+thread_t *sched_create_idle_thread(void) {
+  thread_t *const idle_thread = obj_cache_alloc(_thread_cache);
+  if (!idle_thread)
+    return NULL;
+
+  const spage_id_t stack_page_id = alloc_pages(THREAD_STACK_BLOCK_ORDER);
+  if (stack_page_id < 0) {
+    obj_cache_free(_thread_cache, idle_thread);
+    return NULL;
+  }
+
+  _init_idle_thread(idle_thread);
+  idle_thread->stack_page_id = stack_page_id;
+  void *const init_sp = (char *)pa_to_kernel_va(page_id_to_pa(stack_page_id)) +
+                        (1 << (THREAD_STACK_BLOCK_ORDER + PAGE_ORDER));
+  idle_thread->ctx.kernel_sp = (uint64_t)(uintptr_t)init_sp;
+
+  return idle_thread;
+}
+
+void sched_init_secondary_core(thread_t *const idle_thread) {
+  const size_t core_id = get_core_id();
+  run_queue_t *const run_queue = &_run_queues[core_id];
+
+  idle_thread->status.is_running = true;
+  idle_thread->core_id = core_id;
+  run_queue->idle_thread = run_queue->curr_thread = idle_thread;
+  run_queue->exec_start = _sched_now();
+  __asm__ __volatile__("msr tpidr_el1, %0" : : "r"(idle_thread));
+}
+
+bool sched_has_ready_threads(void) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  const size_t core_id = get_core_id();
+  const bool result = _run_queue_has_allowed(core_id, core_id) ||
+                      _find_busiest_core(core_id) != N_CORES;
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+  return result;
+}
+
 bool thread_create(void (*const task)(void *), void *const arg) {
   // Allocate memory.
 
-  thread_t *const thread = malloc(sizeof(thread_t));
+  thread_t *const thread = obj_cache_alloc(_thread_cache);
   if (!thread)
     return false;
 
+  rb_node_t *const run_queue_node = obj_cache_alloc(_run_queue_node_cache);
+  if (!run_queue_node) {
+    obj_cache_free(_thread_cache, thread);
+    return false;
+  }
+
   const spage_id_t stack_page_id = alloc_pages(THREAD_STACK_BLOCK_ORDER);
   if (stack_page_id < 0) {
-    free(thread);
+    obj_cache_free(_run_queue_node_cache, run_queue_node);
+    obj_cache_free(_thread_cache, thread);
     return false;
   }
 
@@ -159,6 +987,15 @@ bool thread_create(void (*const task)(void *), void *const arg) {
   thread->status.is_stopped = false;
   thread->status.is_waken_up_by_signal = false;
   thread->status.is_handling_signal = false;
+  thread->status.is_idle = false;
+  thread->status.is_running = false;
+  thread->status.is_killed = false;
+  thread->n_mutexes_held = 0;
+  thread->affinity = AFFINITY_ALL;
+  thread->nice = 0;
+  thread->cpu_time = 0;
+  thread->run_queue_node = run_queue_node;
+  memcpy(run_queue_node->payload, &thread, sizeof(thread_t *));
   thread->process = NULL;
   thread->ctx.r19 = (uint64_t)(uintptr_t)task;
   thread->ctx.r20 = (uint64_t)(uintptr_t)arg;
@@ -170,18 +1007,43 @@ bool thread_create(void (*const task)(void *), void *const arg) {
                         (1 << (THREAD_STACK_BLOCK_ORDER + PAGE_ORDER));
   thread->ctx.kernel_sp = (uint64_t)(uintptr_t)init_sp;
 
-  // Put the thread into the end of the run queue.
+  // Put the thread into the run queue of the least loaded core.
 
-  _add_thread_to_run_queue(thread);
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  _run_queue_add_new_thread(thread);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
 
   return true;
 }
 
+/// \brief Moves the current thread into a queue and picks the next thread to
+///        run.
+///
+/// This function is called by _suspend_to_wait_queue with interrupts masked.
+///
+/// \param queue The wait queue, or NULL for the run queue.
 thread_t *
 _sched_move_thread_to_queue_and_pick_thread(thread_t *const thread,
                                             thread_list_node_t *const queue) {
-  _add_thread_to_queue(thread, queue);
-  return _remove_first_thread_from_queue(&_run_queue);
+  _account_curr_thread();
+  _fp_simd_switch_from(thread);
+  thread->status.is_running = false;
+  if (queue) {
+    _add_thread_to_queue(thread, queue);
+  } else if (!thread->status.is_idle) {
+    // Stay on the current core unless the affinity of the thread has changed.
+    _run_queue_add(_core_is_allowed(thread, thread->core_id)
+                       ? thread->core_id
+                       : _select_least_loaded_core(thread),
+                   thread, false);
+  }
+
+  thread_t *const next_thread = _pick_next_thread();
+  next_thread->status.is_running = true;
+  return next_thread;
 }
 
 void thread_exit(void) {
@@ -190,6 +1052,9 @@ void thread_exit(void) {
 
   XCPT_MASK_ALL();
 
+  // The FP/SIMD context of a dying thread need not be saved.
+  _fp_simd_disown(curr_thread);
+
   if (curr_process) {
     rb_delete(&_processes, &curr_process->id,
               (int (*)(const void *, const void *,
@@ -211,21 +1076,13 @@ thread_t *current_thread(void) {
 bool process_create(void) {
   // Allocate memory.
 
-  process_t *const process = malloc(sizeof(process_t));
+  process_t *const process = obj_cache_alloc(_process_cache);
   if (!process) // Out of memory.
     return false;
 
-  thread_fp_simd_ctx_t *const fp_simd_ctx =
-      malloc(sizeof(thread_fp_simd_ctx_t));
-  if (!fp_simd_ctx) {
-    free(process);
-    return false;
-  }
-
   vm_addr_space_t addr_space = vm_new_addr_space();
   if (!addr_space.pgd) {
-    free(fp_simd_ctx);
-    free(process);
+    obj_cache_free(_process_cache, process);
     return false;
   }
 
@@ -235,8 +1092,7 @@ bool process_create(void) {
   const int open_stdin_result = vfs_open("/dev/uart", 0, &stdin);
   if (open_stdin_result < 0) {
     vm_drop_addr_space(addr_space);
-    free(fp_simd_ctx);
-    free(process);
+    obj_cache_free(_process_cache, process);
     return false;
   }
 
@@ -244,8 +1100,7 @@ bool process_create(void) {
   if (!shared_stdin) {
     vfs_close(stdin);
     vm_drop_addr_space(addr_space);
-    free(fp_simd_ctx);
-    free(process);
+    obj_cache_free(_process_cache, process);
     return false;
   }
 
@@ -254,8 +1109,7 @@ bool process_create(void) {
   if (open_stdout_result < 0) {
     shared_file_drop(shared_stdin);
     vm_drop_addr_space(addr_space);
-    free(fp_simd_ctx);
-    free(process);
+    obj_cache_free(_process_cache, process);
     return false;
   }
 
@@ -264,8 +1118,7 @@ bool process_create(void) {
     vfs_close(stdout);
     shared_file_drop(shared_stdin);
     vm_drop_addr_space(addr_space);
-    free(fp_simd_ctx);
-    free(process);
+    obj_cache_free(_process_cache, process);
     return false;
   }
 
@@ -275,8 +1128,7 @@ bool process_create(void) {
     shared_file_drop(shared_stdout);
     shared_file_drop(shared_stdin);
     vm_drop_addr_space(addr_space);
-    free(fp_simd_ctx);
-    free(process);
+    obj_cache_free(_process_cache, process);
     return false;
   }
 
@@ -286,8 +1138,7 @@ bool process_create(void) {
     shared_file_drop(shared_stdout);
     shared_file_drop(shared_stdin);
     vm_drop_addr_space(addr_space);
-    free(fp_simd_ctx);
-    free(process);
+    obj_cache_free(_process_cache, process);
     return false;
   }
 
@@ -297,19 +1148,9 @@ bool process_create(void) {
 
   process->id = _alloc_pid();
   process->addr_space = addr_space;
+  mutex_init(&process->addr_space_lock);
 
-  const mem_region_t stack_region = {.start = (void *)0xffffffffb000ULL,
-                                     .len = 4 << PAGE_ORDER,
-                                     .type = MEM_REGION_ANONYMOUS,
-                                     .prot = PROT_READ | PROT_WRITE};
-  vm_mem_regions_insert_region(&process->addr_space.mem_regions, &stack_region);
-
-  const mem_region_t vc_region = {.start = (void *)0x3b400000ULL,
-                                  .len = 0x3f000000ULL - 0x3b400000ULL,
-                                  .type = MEM_REGION_LINEAR,
-                                  .pa_base = 0x3b400000,
-                                  .prot = PROT_READ | PROT_WRITE};
-  vm_mem_regions_insert_region(&process->addr_space.mem_regions, &vc_region);
+  // The regions are set up by `exec`.
 
   process->main_thread = curr_thread;
   process->pending_signals = 0;
@@ -321,11 +1162,8 @@ bool process_create(void) {
   process->fds[0] = shared_stdin;
   process->fds[1] = shared_stdout;
   process->fds[2] = shared_stderr;
-  for (size_t i = 3; i < N_FDS; i++) {
-    process->fds[i] = NULL;
-  }
+  // The rest of `process->fds` are set to NULL by the constructor.
   curr_thread->process = process;
-  curr_thread->ctx.fp_simd_ctx = fp_simd_ctx;
 
   // Add the process to the process BST.
 
@@ -347,76 +1185,161 @@ void switch_vm(const thread_t *const thread) {
   }
 }
 
-static void _exec_generic(struct file *const text_file,
-                          const bool remove_text_region) {
+/// \brief The regions every user program starts with.
+static const mem_region_t _exec_initial_regions[] = {
+    {.start = (void *)0xffffffffb000ULL,
+     .len = 4 << PAGE_ORDER,
+     .type = MEM_REGION_ANONYMOUS,
+     .prot = PROT_READ | PROT_WRITE},
+    {.start = (void *)0x3b400000ULL,
+     .len = 0x3f000000ULL - 0x3b400000ULL,
+     .type = MEM_REGION_LINEAR,
+     .pa_base = 0x3b400000,
+     .prot = PROT_READ | PROT_WRITE}};
+
+#define N_EXEC_INITIAL_REGIONS                                                 \
+  (sizeof(_exec_initial_regions) / sizeof(mem_region_t))
+
+/// \brief Checks if a segment of a user program overlaps any of the regions
+///        every user program starts with.
+static bool
+_exec_overlaps_initial_regions(const elf_load_segment_t *const segment) {
+  for (size_t i = 0; i < N_EXEC_INITIAL_REGIONS; i++) {
+    const mem_region_t *const region = &_exec_initial_regions[i];
+    if ((char *)segment->start < (char *)region->start + region->len &&
+        (char *)region->start < (char *)segment->start + segment->len)
+      return true;
+  }
+  return false;
+}
+
+int exec(struct file *const text_file) {
   thread_t *const curr_thread = current_thread();
   process_t *const curr_process = curr_thread->process;
 
-  const long text_len = text_file->vnode->v_ops->get_size(text_file->vnode);
-  if (text_len < 0)
-    return;
+  elf_image_t image;
+  const int elf_result = elf_read_image(text_file, &image);
+  if (elf_result == -ENOEXEC) {
+    // A raw binary, loaded at address 0.
 
-  shared_file_t *const shared_text_file = shared_file_new(text_file);
-  if (!shared_text_file)
-    return;
+    const long text_len = text_file->vnode->v_ops->get_size(text_file->vnode);
+    if (text_len < 0) {
+      vfs_close(text_file);
+      return text_len;
+    }
 
-  // Remove old text region.
+    // We don't know exactly how large the .bss section of a raw binary is, so
+    // we have to use a heuristic. We speculate that the .bss section is at
+    // most as large as the remaining parts (.text, .rodata, and .data
+    // sections) of the user program.
+
+    image = (elf_image_t){
+        .entry = (void *)0x0,
+        .n_segments = 1,
+        .segments = {{.start = (void *)0x0,
+                      .len = ALIGN(text_len * 2, 1 << PAGE_ORDER),
+                      .file_offset = 0,
+                      .file_len = text_len,
+                      .prot = PROT_READ | PROT_WRITE | PROT_EXEC}}};
+  } else if (elf_result < 0) {
+    vfs_close(text_file);
+    return elf_result;
+  }
 
-  if (remove_text_region) {
-    shared_file_t *const old_text_file =
-        vm_mem_regions_find_region(&curr_process->addr_space.mem_regions,
-                                   (void *)0x0)
-            ->backing_file;
+  for (size_t i = 0; i < image.n_segments; i++) {
+    if (_exec_overlaps_initial_regions(&image.segments[i])) {
+      vfs_close(text_file);
+      return -EINVAL;
+    }
+  }
 
-    if (!vm_remove_region(&curr_process->addr_space, (void *)0x0))
-      return;
+  shared_file_t *const shared_text_file = shared_file_new(text_file);
+  if (!shared_text_file) {
+    vfs_close(text_file);
+    return -ENOMEM;
+  }
 
-    // Set ttbr0_el1 again, as it might have changed.
-    vm_switch_to_addr_space(&curr_process->addr_space);
+  // Replace the address space contents. There is no going back from here, so
+  // failures kill the process.
 
-    shared_file_drop(old_text_file);
+  if (vm_unmap_range(&curr_process->addr_space, (void *)0x0, VM_USER_VA_END) <
+      0) {
+    console_printf("ERROR: exec: (PID %zu) Cannot clear address space\n",
+                   curr_process->id);
+    shared_file_drop(shared_text_file);
+    thread_exit();
   }
 
-  // We don't know exactly how large the .bss section of a user program is, so
-  // we have to use a heuristic. We speculate that the .bss section is at most
-  // as large as the remaining parts (.text, .rodata, and .data sections) of the
-  // user program.
+  for (size_t i = 0; i < N_EXEC_INITIAL_REGIONS; i++) {
+    if (vm_mem_regions_insert_region(&curr_process->addr_space.mem_regions,
+                                     &_exec_initial_regions[i]) < 0) {
+      console_printf("ERROR: exec: (PID %zu) Cannot set up address space\n",
+                     curr_process->id);
+      shared_file_drop(shared_text_file);
+      thread_exit();
+    }
+  }
 
-  const mem_region_t text_region = {.start = (void *)0x0,
-                                    .len = ALIGN(text_len * 2, 4096),
-                                    .type = MEM_REGION_BACKED,
-                                    .backing_file = shared_text_file,
-                                    .prot = PROT_READ | PROT_WRITE | PROT_EXEC};
-  vm_mem_regions_insert_region(&curr_process->addr_space.mem_regions,
-                               &text_region);
+  for (size_t i = 0; i < image.n_segments; i++) {
+    const elf_load_segment_t *const segment = &image.segments[i];
+    const mem_region_t region = {
+        .start = segment->start,
+        .len = segment->len,
+        .type = MEM_REGION_BACKED,
+        .backing_file = shared_file_clone(shared_text_file),
+        .file_offset = segment->file_offset,
+        .file_len = segment->file_len,
+        .prot = segment->prot,
+        .flags = MAP_PRIVATE};
+    if (vm_mem_regions_insert_region(&curr_process->addr_space.mem_regions,
+                                     &region) < 0) {
+      console_printf("ERROR: exec: (PID %zu) Cannot set up address space\n",
+                     curr_process->id);
+      shared_file_drop(region.backing_file);
+      shared_file_drop(shared_text_file);
+      thread_exit();
+    }
+  }
 
-  // Run the user program.
+  shared_file_drop(shared_text_file);
+
+  // Run the user program. It starts with zeroed FP/SIMD registers.
+
+  _fp_simd_discard(curr_thread);
 
   void *const kernel_stack_end =
       (char *)pa_to_kernel_va(page_id_to_pa(curr_thread->stack_page_id)) +
       (1 << THREAD_STACK_ORDER);
   switch_vm(curr_thread);
-  user_program_main((void *)0x0, (void *)0xfffffffff000ULL, kernel_stack_end);
-}
-
-void exec_first(struct file *const text_file) {
-  _exec_generic(text_file, false);
+  user_program_main(image.entry, (void *)0xfffffffff000ULL, kernel_stack_end);
 }
 
-void exec(struct file *const text_file) { _exec_generic(text_file, true); }
-
 static void _thread_cleanup(thread_t *const thread) {
   if (thread->process) {
+#ifdef VM_ENABLE_FAULT_STATS_LOG
+    const vm_fault_stats_t *const fault_stats =
+        &thread->process->addr_space.fault_stats;
+    console_printf("DEBUG: vm: PID %zu: %zu translation faults, %zu "
+                   "permission faults, %zu pages faulted around, %zu blocks "
+                   "mapped\n",
+                   thread->process->id, fault_stats->n_translation_faults,
+                   fault_stats->n_permission_faults,
+                   fault_stats->n_pages_faulted_around,
+                   fault_stats->n_blocks_mapped);
+#endif
     vm_drop_addr_space(thread->process->addr_space);
     for (size_t i = 0; i < N_FDS; i++) {
       if (thread->process->fds[i]) {
         shared_file_drop(thread->process->fds[i]);
+        thread->process->fds[i] = NULL;
       }
     }
-    free(thread->process);
+    obj_cache_free(_process_cache, thread->process);
   }
+  _fp_simd_discard(thread);
   free_pages(thread->stack_page_id);
-  free(thread);
+  obj_cache_free(_run_queue_node_cache, thread->run_queue_node);
+  obj_cache_free(_thread_cache, thread);
 }
 
 process_t *fork(const extended_trap_frame_t *const trap_frame) {
@@ -425,39 +1348,49 @@ process_t *fork(const extended_trap_frame_t *const trap_frame) {
 
   // Allocate memory.
 
-  thread_t *const new_thread = malloc(sizeof(thread_t));
+  thread_t *const new_thread = obj_cache_alloc(_thread_cache);
   if (!new_thread)
     return NULL;
 
-  process_t *const new_process = malloc(sizeof(process_t));
+  rb_node_t *const run_queue_node = obj_cache_alloc(_run_queue_node_cache);
+  if (!run_queue_node) {
+    obj_cache_free(_thread_cache, new_thread);
+    return NULL;
+  }
+
+  process_t *const new_process = obj_cache_alloc(_process_cache);
   if (!new_process) {
-    free(new_thread);
+    obj_cache_free(_run_queue_node_cache, run_queue_node);
+    obj_cache_free(_thread_cache, new_thread);
     return NULL;
   }
 
   const spage_id_t kernel_stack_page_id = alloc_pages(THREAD_STACK_BLOCK_ORDER);
   if (kernel_stack_page_id < 0) {
-    free(new_process);
-    free(new_thread);
+    obj_cache_free(_process_cache, new_process);
+    obj_cache_free(_run_queue_node_cache, run_queue_node);
+    obj_cache_free(_thread_cache, new_thread);
     return NULL;
   }
 
-  thread_fp_simd_ctx_t *const fp_simd_ctx =
-      malloc(sizeof(thread_fp_simd_ctx_t));
-  if (!fp_simd_ctx) {
+  thread_fp_simd_ctx_t *fp_simd_ctx = NULL;
+  if (curr_thread->ctx.fp_simd_ctx &&
+      !(fp_simd_ctx = obj_cache_alloc(_fp_simd_ctx_cache))) {
     free_pages(kernel_stack_page_id);
-    free(new_process);
-    free(new_thread);
+    obj_cache_free(_process_cache, new_process);
+    obj_cache_free(_run_queue_node_cache, run_queue_node);
+    obj_cache_free(_thread_cache, new_thread);
     return NULL;
   }
 
   vm_addr_space_t addr_space = vm_clone_addr_space(curr_process->addr_space);
   if (curr_process->addr_space.mem_regions.root &&
       !addr_space.mem_regions.root) { // Out of memory.
-    free(fp_simd_ctx);
+    obj_cache_free(_fp_simd_ctx_cache, fp_simd_ctx);
     free_pages(kernel_stack_page_id);
-    free(new_process);
-    free(new_thread);
+    obj_cache_free(_process_cache, new_process);
+    obj_cache_free(_run_queue_node_cache, run_queue_node);
+    obj_cache_free(_thread_cache, new_thread);
     return NULL;
   }
 
@@ -468,11 +1401,21 @@ process_t *fork(const extended_trap_frame_t *const trap_frame) {
   new_thread->status.is_stopped = false;
   new_thread->status.is_waken_up_by_signal = false;
   new_thread->status.is_handling_signal = false;
+  new_thread->status.is_idle = false;
+  new_thread->status.is_running = false;
+  new_thread->status.is_killed = false;
+  new_thread->n_mutexes_held = 0;
+  new_thread->affinity = curr_thread->affinity;
+  new_thread->nice = curr_thread->nice;
+  new_thread->cpu_time = 0;
+  new_thread->run_queue_node = run_queue_node;
+  memcpy(run_queue_node->payload, &new_thread, sizeof(thread_t *));
   new_thread->stack_page_id = kernel_stack_page_id;
   new_thread->process = new_process;
 
   new_process->id = _alloc_pid();
   new_process->addr_space = addr_space;
+  mutex_init(&new_process->addr_space_lock);
   new_process->main_thread = new_thread;
   new_process->pending_signals = 0;
   new_process->blocked_signals = 0;
@@ -496,14 +1439,22 @@ process_t *fork(const extended_trap_frame_t *const trap_frame) {
   new_thread->ctx.pc = (uint64_t)(uintptr_t)fork_child_ret;
   new_thread->ctx.kernel_sp = (uint64_t)(uintptr_t)init_kernel_sp;
   new_thread->ctx.fp_simd_ctx = fp_simd_ctx;
-  memcpy(fp_simd_ctx, curr_thread->ctx.fp_simd_ctx,
-         sizeof(thread_fp_simd_ctx_t));
+  if (fp_simd_ctx) {
+    uint64_t daif_val;
+    CRITICAL_SECTION_ENTER(daif_val);
+
+    _fp_simd_write_back(curr_thread);
+    memcpy(fp_simd_ctx, curr_thread->ctx.fp_simd_ctx,
+           sizeof(thread_fp_simd_ctx_t));
+
+    CRITICAL_SECTION_LEAVE(daif_val);
+  }
 
   memcpy(init_kernel_sp, trap_frame, sizeof(extended_trap_frame_t));
 
-  // Add the new thread to the end of the run queue and the process to the
-  // process BST. Note that these two steps can be done in either order but must
-  // not be interrupted in between, since:
+  // Add the new thread to the run queue of the least loaded core and the
+  // process to the process BST. Note that these two steps can be done in either
+  // order but must not be interrupted in between, since:
   // - If the former is done before the latter and the newly-created thread is
   //   scheduled between the two steps, then the new thread won't be able to
   //   find its own process.
@@ -514,7 +1465,7 @@ process_t *fork(const extended_trap_frame_t *const trap_frame) {
   uint64_t daif_val;
   CRITICAL_SECTION_ENTER(daif_val);
 
-  _add_thread_to_run_queue(new_thread);
+  _run_queue_add_new_thread(new_thread);
 
   rb_insert(&_processes, sizeof(process_t *), &new_process,
             (int (*)(const void *, const void *, void *))_cmp_processes_by_pid,
@@ -532,10 +1483,14 @@ void kill_zombies(void) {
   }
 }
 
-void schedule(void) { _suspend_to_wait_queue(&_run_queue); }
+void schedule(void) { _suspend_to_wait_queue(NULL); }
 
 void suspend_to_wait_queue(thread_list_node_t *const wait_queue) {
   XCPT_MASK_ALL();
+  if (current_thread()->status.is_killed &&
+      current_thread()->n_mutexes_held == 0) {
+    thread_exit();
+  }
   current_thread()->status.is_waiting = true;
   _suspend_to_wait_queue(wait_queue);
 }
@@ -548,6 +1503,16 @@ void wake_up_all_threads_in_wait_queue(thread_list_node_t *const wait_queue) {
   }
 }
 
+bool wake_up_first_thread_in_wait_queue(thread_list_node_t *const wait_queue) {
+  thread_t *const thread = _remove_first_thread_from_queue(wait_queue);
+  if (!thread)
+    return false;
+
+  thread->status.is_waiting = false;
+  _add_thread_to_run_queue(thread);
+  return true;
+}
+
 process_t *get_process_by_id(const size_t pid) {
   uint64_t daif_val;
   CRITICAL_SECTION_ENTER(daif_val);
@@ -566,6 +1531,11 @@ process_t *get_process_by_id(const size_t pid) {
 void kill_process(process_t *const process) {
   if (process == current_thread()->process) {
     thread_exit();
+  } else if (process->main_thread->status.is_running ||
+             process->main_thread->n_mutexes_held != 0) {
+    // The thread is either running on another core and in no queue, or in the
+    // middle of updating data protected by a mutex. Let it exit by itself.
+    process->main_thread->status.is_killed = true;
   } else {
     thread_t *const thread = process->main_thread;
 
@@ -588,33 +1558,41 @@ void kill_process(process_t *const process) {
                        void *))_cmp_pid_and_processes_by_pid,
               NULL);
 
-    _remove_thread_from_queue(thread);
+    _dequeue_thread(thread);
     _add_thread_to_queue(thread, &_zombies);
 
     CRITICAL_SECTION_LEAVE(daif_val);
   }
 }
 
+/// \brief Finds a process other than the current one that has not been killed
+///        yet.
+static process_t *_find_process_to_kill_rec(const rb_node_t *const node) {
+  if (!node)
+    return NULL;
+
+  process_t *const process = *(process_t **)node->payload;
+  if (process != current_thread()->process &&
+      !process->main_thread->status.is_killed)
+    return process;
+
+  process_t *const result = _find_process_to_kill_rec(node->children[0]);
+  return result ? result : _find_process_to_kill_rec(node->children[1]);
+}
+
 void kill_all_processes(void) {
-  // Kill all processes other than the current one.
+  // Kill all processes other than the current one. The ones running on other
+  // cores stay in the process BST until they exit by themselves.
   for (;;) {
     uint64_t daif_val;
     CRITICAL_SECTION_ENTER(daif_val);
 
-    process_t *process_to_kill = *(process_t **)_processes->payload;
-    if (process_to_kill == current_thread()->process) {
-      if (_processes->children[0]) {
-        process_to_kill = *(process_t **)_processes->children[0]->payload;
-      } else if (_processes->children[1]) {
-        process_to_kill = *(process_t **)_processes->children[1]->payload;
-      } else { // Only the current process left.
-        CRITICAL_SECTION_LEAVE(daif_val);
-        break;
-      }
-    }
+    process_t *const process_to_kill = _find_process_to_kill_rec(_processes);
 
     CRITICAL_SECTION_LEAVE(daif_val);
 
+    if (!process_to_kill)
+      break;
     kill_process(process_to_kill);
   }
 
@@ -674,6 +1652,28 @@ static void _deliver_signal_to_all_processes_rec(const int signal,
   _deliver_signal_to_all_processes_rec(signal, node->children[1]);
 }
 
+static void
+_for_each_process_rec(const rb_node_t *const node,
+                      void (*const callback)(const process_t *, void *),
+                      void *const arg) {
+  if (!node)
+    return;
+
+  _for_each_process_rec(node->children[0], callback, arg);
+  callback(*(process_t *const *)node->payload, arg);
+  _for_each_process_rec(node->children[1], callback, arg);
+}
+
+void sched_for_each_process(void (*const callback)(const process_t *, void *),
+                            void *const arg) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  _for_each_process_rec(_processes, callback, arg);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
 void deliver_signal_to_all_processes(const int signal) {
   uint64_t daif_val;
   CRITICAL_SECTION_ENTER(daif_val);
@@ -706,6 +1706,10 @@ void handle_signals(void) {
     return;
   process_t *const curr_process = curr_thread->process;
 
+  if (curr_thread->status.is_killed) {
+    thread_exit();
+  }
+
   // Save spsr_el1 and elr_el1, since they can be clobbered when running the
   // signal handlers.
 
@@ -713,6 +1717,14 @@ void handle_signals(void) {
   __asm__ __volatile__("mrs %0, spsr_el1" : "=r"(spsr_val));
   __asm__ __volatile__("mrs %0, elr_el1" : "=r"(elr_val));
 
+  // Let a woken-up thread that is due to run before the current one preempt it.
+
+  run_queue_t *const run_queue = &_run_queues[get_core_id()];
+  if (run_queue->need_resched) {
+    run_queue->stats.n_wakeup_preemptions++;
+    schedule();
+  }
+
   // Save the status bit in order to support nested signal handling.
 
   const bool is_handling_signal = curr_thread->status.is_handling_signal;
@@ -748,8 +1760,15 @@ void handle_signals(void) {
       curr_thread->status.is_handling_signal = true;
       curr_process->blocked_signals |= 1 << signal;
 
+      thread_fp_simd_ctx_t saved_fp_simd_ctx;
+      const bool has_fp_simd_ctx =
+          _fp_simd_enter_signal_handler(&saved_fp_simd_ctx);
+
       run_signal_handler(handler);
 
+      _fp_simd_leave_signal_handler(has_fp_simd_ctx ? &saved_fp_simd_ctx
+                                                    : NULL);
+
       curr_thread->status.is_handling_signal = false;
       curr_process->pending_signals &= ~(1 << signal);
       curr_process->blocked_signals &= ~(1 << signal);
@@ -0,0 +1,159 @@
+#include "oscos/sync.h"
+
+#include "oscos/sched.h"
+#include "oscos/utils/critical-section.h"
+
+static void _wait_queue_init(thread_list_node_t *const wait_queue) {
+  wait_queue->prev = wait_queue->next = wait_queue;
+}
+
+/// \brief Puts the current thread to sleep on a wait queue without being
+///        interrupted by signals.
+///
+/// This function is safe to call only within a critical section, which is
+/// still in effect when this function returns.
+static void _sleep_on(thread_list_node_t *const wait_queue) {
+  suspend_to_wait_queue(wait_queue);
+  XCPT_MASK_ALL();
+
+  // A signal only wakes us up early. It stays pending and is handled on the way
+  // back to user space.
+  current_thread()->status.is_waken_up_by_signal = false;
+}
+
+// Mutex.
+
+void mutex_init(mutex_t *const mutex) {
+  mutex->is_locked = false;
+  _wait_queue_init(&mutex->wait_queue);
+}
+
+void mutex_lock(mutex_t *const mutex) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  while (mutex->is_locked) {
+    _sleep_on(&mutex->wait_queue);
+  }
+  mutex->is_locked = true;
+  current_thread()->n_mutexes_held++;
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+bool mutex_trylock(mutex_t *const mutex) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  const bool is_acquired = !mutex->is_locked;
+  if (is_acquired) {
+    mutex->is_locked = true;
+    current_thread()->n_mutexes_held++;
+  }
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+  return is_acquired;
+}
+
+/// \brief Releases a mutex.
+///
+/// This function is safe to call only within a critical section.
+static void _mutex_release(mutex_t *const mutex) {
+  mutex->is_locked = false;
+  current_thread()->n_mutexes_held--;
+
+  // Wake up all waiters rather than one, since a waiter may be killed or
+  // woken up by a signal and never take the mutex. The others simply go back to
+  // sleep.
+  wake_up_all_threads_in_wait_queue(&mutex->wait_queue);
+}
+
+void mutex_unlock(mutex_t *const mutex) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  _mutex_release(mutex);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+// Semaphore.
+
+void semaphore_init(semaphore_t *const semaphore, const size_t count) {
+  semaphore->count = count;
+  _wait_queue_init(&semaphore->wait_queue);
+}
+
+void semaphore_down(semaphore_t *const semaphore) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  while (semaphore->count == 0) {
+    _sleep_on(&semaphore->wait_queue);
+  }
+  semaphore->count--;
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+bool semaphore_trydown(semaphore_t *const semaphore) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  const bool is_decremented = semaphore->count != 0;
+  if (is_decremented) {
+    semaphore->count--;
+  }
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+  return is_decremented;
+}
+
+void semaphore_up(semaphore_t *const semaphore) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  semaphore->count++;
+  // For the same reason as mutexes, wake up all waiters.
+  wake_up_all_threads_in_wait_queue(&semaphore->wait_queue);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+// Condition variable.
+
+void condvar_init(condvar_t *const condvar) {
+  _wait_queue_init(&condvar->wait_queue);
+}
+
+void condvar_wait(condvar_t *const condvar, mutex_t *const mutex) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  // Releasing the mutex and going to sleep happen in the same critical section,
+  // so that no wakeup is lost in between.
+  _mutex_release(mutex);
+  _sleep_on(&condvar->wait_queue);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+
+  mutex_lock(mutex);
+}
+
+void condvar_signal(condvar_t *const condvar) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  wake_up_first_thread_in_wait_queue(&condvar->wait_queue);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
+
+void condvar_broadcast(condvar_t *const condvar) {
+  uint64_t daif_val;
+  CRITICAL_SECTION_ENTER(daif_val);
+
+  wake_up_all_threads_in_wait_queue(&condvar->wait_queue);
+
+  CRITICAL_SECTION_LEAVE(daif_val);
+}
@@ -12,8 +12,14 @@
 #include "oscos/libc/string.h"
 #include "oscos/mem/malloc.h"
 #include "oscos/mem/page-alloc.h"
+#include "oscos/mem/page-cache.h"
+#include "oscos/mem/zero-pool.h"
 #include "oscos/sched.h"
+#include "oscos/smp.h"
 #include "oscos/timer/timeout.h"
+#include "oscos/utils/core-id.h"
+#include "oscos/utils/lock.h"
+#include "oscos/utils/rb.h"
 #include "oscos/utils/time.h"
 
 #define MAX_CMD_LEN 78
@@ -63,7 +69,15 @@ static void _shell_do_cmd_help(void) {
       "alloc-pages : allocates a block of page frames using the page frame "
       "allocator\n"
       "free-pages  : frees a block of page frames allocated using the page "
-      "frame allocator");
+      "frame allocator\n"
+      "rb-test     : stress-test and benchmark the red-black tree\n"
+      "malloc-stats: print the usage statistics of the dynamic memory "
+      "allocator and the object caches\n"
+      "page-stats  : print the usage statistics of the page frame allocator\n"
+      "sched-stats : print the statistics of the scheduler\n"
+      "ps          : list the processes with their nice values, CPU time and "
+      "page fault counts\n"
+      "lock-stats  : print the contention statistics of the named locks");
 }
 
 static void _shell_do_cmd_hello(void) { console_puts("Hello World!"); }
@@ -136,14 +150,16 @@ static void _shell_do_cmd_exec(void) {
   }
 
   if (!process_create()) {
+    vfs_close(user_program_file);
     console_puts("oscsh: exec: out of memory");
     return;
   }
 
-  exec_first(user_program_file);
+  const int exec_result = exec(user_program_file);
 
   // If execution reaches here, then exec failed.
-  console_puts("oscsh: exec: out of memory");
+  console_printf("oscsh: exec: cannot execute user program: errno %d\n",
+                 -exec_result);
 }
 
 static void _shell_cmd_set_timeout_timer_callback(char *const message) {
@@ -628,6 +644,301 @@ static void _shell_do_cmd_vfs_test_5(void) {
     return;
 }
 
+static void _shell_print_malloc_stats(const malloc_class_stats_t *const stats) {
+  console_printf("%5zu %8zu %9zu %5zu %9zu %8zu %6zu %6zu %4zu", stats->slot_size,
+                 stats->n_allocs, stats->n_magazine_hits,
+                 stats->n_allocs == 0
+                     ? (size_t)0
+                     : stats->n_magazine_hits * 100 / stats->n_allocs,
+                 stats->n_failures, stats->n_frees, stats->n_slabs,
+                 stats->n_empty_slabs, stats->n_magazine_slots);
+}
+
+static void _shell_print_obj_cache_stats(const char *const name,
+                                         const malloc_class_stats_t stats,
+                                         void *const _arg) {
+  (void)_arg;
+
+  _shell_print_malloc_stats(&stats);
+  console_printf("  %s\n", name);
+}
+
+static void _shell_do_cmd_malloc_stats(void) {
+  console_puts(" size   allocs  mag-hits  hit%  failures    frees  slabs  empty  "
+               "mag");
+  for (size_t i = 0; i < malloc_get_n_classes(); i++) {
+    const malloc_class_stats_t stats = malloc_get_class_stats(i);
+    if (stats.n_allocs == 0)
+      continue;
+
+    _shell_print_malloc_stats(&stats);
+    console_putc('\n');
+  }
+
+  console_puts("Object caches:");
+  obj_cache_for_each(_shell_print_obj_cache_stats, NULL);
+}
+
+static void _shell_do_cmd_page_stats(void) {
+  console_puts("core   allocs     hits  hit%    frees  refills   drains  "
+               "blocks (order 0/1/2)");
+  for (size_t core_id = 0; core_id < N_CORES; core_id++) {
+    const page_alloc_pcp_stats_t stats = page_alloc_get_pcp_stats(core_id);
+    console_printf("%4zu %8zu %8zu %5zu %8zu %8zu %8zu  %zu/%zu/%zu\n", core_id,
+                   stats.n_allocs, stats.n_hits,
+                   stats.n_allocs == 0 ? (size_t)0
+                                       : stats.n_hits * 100 / stats.n_allocs,
+                   stats.n_frees, stats.n_refills, stats.n_drains,
+                   stats.n_blocks[0], stats.n_blocks[1], stats.n_blocks[2]);
+  }
+
+  const zero_pool_stats_t zero_pool_stats = zero_pool_get_stats();
+  console_printf("Zero pool: %zu/%d pages, %zu allocs, %zu hits (%zu%%), %zu "
+                 "pages zeroed, %zu drains\n",
+                 zero_pool_stats.n_pages, ZERO_POOL_CAPACITY,
+                 zero_pool_stats.n_allocs, zero_pool_stats.n_hits,
+                 zero_pool_stats.n_allocs == 0
+                     ? (size_t)0
+                     : zero_pool_stats.n_hits * 100 / zero_pool_stats.n_allocs,
+                 zero_pool_stats.n_refills, zero_pool_stats.n_drains);
+
+  const page_cache_stats_t page_cache_stats = page_cache_get_stats();
+  const size_t n_page_cache_lookups =
+      page_cache_stats.n_hits + page_cache_stats.n_misses;
+  console_printf("Page cache: %zu pages, %zu hits, %zu misses (%zu%% hit "
+                 "rate), %zu evictions, %zu write-backs\n",
+                 page_cache_stats.n_pages, page_cache_stats.n_hits,
+                 page_cache_stats.n_misses,
+                 n_page_cache_lookups == 0
+                     ? (size_t)0
+                     : page_cache_stats.n_hits * 100 / n_page_cache_lookups,
+                 page_cache_stats.n_evictions, page_cache_stats.n_write_backs);
+}
+
+/// \brief Converts a duration in timer counter ticks into milliseconds.
+static uint64_t _shell_ticks_to_ms(const uint64_t ticks) {
+  uint64_t core_timer_freq_hz;
+  __asm__("mrs %0, cntfrq_el0" : "=r"(core_timer_freq_hz));
+  core_timer_freq_hz &= 0xffffffff;
+
+  return ticks / core_timer_freq_hz * 1000 +
+         ticks % core_timer_freq_hz * 1000 / core_timer_freq_hz;
+}
+
+static void _shell_do_cmd_sched_stats(void) {
+  console_printf("Cores: %zu online\n", smp_get_n_online_cores());
+
+  for (size_t i = 0; i < N_CORES; i++) {
+    const sched_run_queue_stats_t run_queue_stats =
+        sched_get_run_queue_stats(i);
+    console_printf("Core %zu: %zu ready, %zu migrations in, %zu steals, %zu "
+                   "balance pulls, %zu wakeup preemptions, %" PRIu64
+                   " ms idle\n",
+                   i, run_queue_stats.n_ready_threads,
+                   run_queue_stats.n_migrations, run_queue_stats.n_steals,
+                   run_queue_stats.n_balance_pulls,
+                   run_queue_stats.n_wakeup_preemptions,
+                   _shell_ticks_to_ms(run_queue_stats.idle_time));
+  }
+
+  const sched_fp_simd_stats_t fp_simd_stats = sched_get_fp_simd_stats();
+  console_printf("FP/SIMD: %zu traps, %zu saves, %zu restores, %zu saves "
+                 "avoided, %zu restores avoided\n",
+                 fp_simd_stats.n_traps, fp_simd_stats.n_saves,
+                 fp_simd_stats.n_restores, fp_simd_stats.n_saves_avoided,
+                 fp_simd_stats.n_restores_avoided);
+}
+
+static void _shell_print_process(const process_t *const process,
+                                 void *const _arg) {
+  (void)_arg;
+
+  const thread_t *const thread = process->main_thread;
+  const vm_fault_stats_t *const fault_stats = &process->addr_space.fault_stats;
+  console_printf("%5zu %4d %10" PRIu64 " %8zu %8zu %8zu %6zu %s\n",
+                 process->id, thread->nice,
+                 _shell_ticks_to_ms(thread->cpu_time),
+                 fault_stats->n_translation_faults,
+                 fault_stats->n_permission_faults,
+                 fault_stats->n_pages_faulted_around,
+                 fault_stats->n_blocks_mapped,
+                 thread->status.is_running   ? "running"
+                 : thread->status.is_waiting ? "waiting"
+                                             : "ready");
+}
+
+static void _shell_do_cmd_ps(void) {
+  console_puts("  PID NICE   TIME(ms)  TFAULTS  PFAULTS   AROUND BLOCKS STATE");
+  sched_for_each_process(_shell_print_process, NULL);
+}
+
+static void _shell_print_lock_stats(const lock_stats_t *const stats,
+                                    size_t *const n_locks) {
+  console_printf("%s: %" PRIu64 " acquisitions, %" PRIu64
+                 " contended, %" PRIu64 " ticks waited, %" PRIu64
+                 " ticks held, %" PRIu64 " ticks max held\n",
+                 stats->name, stats->n_acquisitions, stats->n_contended,
+                 stats->wait_ticks, stats->hold_ticks, stats->max_hold_ticks);
+  (*n_locks)++;
+}
+
+static void _shell_do_cmd_lock_stats(void) {
+  size_t n_locks = 0;
+  lock_stats_for_each((void (*)(const lock_stats_t *,
+                                void *))_shell_print_lock_stats,
+                      &n_locks);
+  if (n_locks == 0) {
+    console_puts("oscsh: lock-stats: not collected; build with "
+                 "-DLOCK_ENABLE_STATS");
+  }
+}
+
+#define RB_TEST_N_KEYS 16384
+
+static int _shell_rb_test_cmp(const size_t *const a, const size_t *const b,
+                              void *const _arg) {
+  (void)_arg;
+  return *a < *b ? -1 : *a > *b;
+}
+
+/// \brief Checks the red-black tree invariants of a subtree.
+/// \return The black height of the subtree, or -1 if an invariant is violated.
+static int _shell_rb_test_check_rec(const rb_node_t *const node,
+                                    const size_t *const lo,
+                                    const size_t *const hi) {
+  if (!node)
+    return 1;
+
+  const size_t *const key = (const size_t *)node->payload;
+  if ((lo && *key <= *lo) || (hi && *key >= *hi))
+    return -1;
+
+  if (node->colour == RB_NC_RED) {
+    for (size_t i = 0; i < 2; i++) {
+      if (node->children[i] && node->children[i]->colour == RB_NC_RED)
+        return -1;
+    }
+  }
+
+  const int left_black_height =
+                _shell_rb_test_check_rec(node->children[0], lo, key),
+            right_black_height =
+                _shell_rb_test_check_rec(node->children[1], key, hi);
+  if (left_black_height < 0 || left_black_height != right_black_height)
+    return -1;
+
+  return left_black_height + (node->colour == RB_NC_BLACK);
+}
+
+static size_t _shell_rb_test_height(const rb_node_t *const node) {
+  if (!node)
+    return 0;
+
+  const size_t left_height = _shell_rb_test_height(node->children[0]),
+               right_height = _shell_rb_test_height(node->children[1]);
+  return 1 + (left_height > right_height ? left_height : right_height);
+}
+
+static uint64_t _shell_rb_test_get_time_ns(void) {
+  uint64_t core_timer_freq_hz, curr_timestamp;
+  __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(core_timer_freq_hz));
+  __asm__ __volatile__("mrs %0, cntpct_el0" : "=r"(curr_timestamp));
+  return curr_timestamp * NS_PER_SEC / core_timer_freq_hz;
+}
+
+static bool _shell_rb_test_check(const rb_node_t *const root,
+                                 const char *const stage) {
+  if (root && root->colour != RB_NC_BLACK) {
+    console_printf("oscsh: rb-test: %s: red root\n", stage);
+    return false;
+  }
+  if (_shell_rb_test_check_rec(root, NULL, NULL) < 0) {
+    console_printf("oscsh: rb-test: %s: invariant violated\n", stage);
+    return false;
+  }
+  return true;
+}
+
+static void _shell_do_cmd_rb_test(void) {
+  rb_node_t *root = NULL;
+
+  // Sequential insertions. These degenerate an unbalanced tree into a list.
+
+  const uint64_t insert_start_ns = _shell_rb_test_get_time_ns();
+  for (size_t key = 0; key < RB_TEST_N_KEYS; key++) {
+    if (!rb_insert(&root, sizeof(size_t), &key,
+                   (int (*)(const void *, const void *,
+                            void *))_shell_rb_test_cmp,
+                   NULL)) {
+      console_puts("oscsh: rb-test: out of memory");
+      rb_drop(root, NULL);
+      return;
+    }
+  }
+  const uint64_t insert_end_ns = _shell_rb_test_get_time_ns();
+
+  if (!_shell_rb_test_check(root, "insert"))
+    goto end;
+
+  // Lookups.
+
+  const uint64_t search_start_ns = _shell_rb_test_get_time_ns();
+  for (size_t key = 0; key < RB_TEST_N_KEYS; key++) {
+    const size_t *const result =
+        rb_search(root, &key,
+                  (int (*)(const void *, const void *,
+                           void *))_shell_rb_test_cmp,
+                  NULL);
+    if (!result || *result != key) {
+      console_printf("oscsh: rb-test: key %zu not found\n", key);
+      goto end;
+    }
+  }
+  const uint64_t search_end_ns = _shell_rb_test_get_time_ns();
+
+  // Each n-node red-black tree has height at most 2 log2(n + 1).
+  size_t log2_n_keys = 0;
+  while ((size_t)1 << log2_n_keys < RB_TEST_N_KEYS + 1) {
+    log2_n_keys++;
+  }
+  const size_t height = _shell_rb_test_height(root);
+  console_printf("Keys: %d, height: %zu (bound: %zu)\n", RB_TEST_N_KEYS,
+                 height, 2 * log2_n_keys);
+  if (height > 2 * log2_n_keys) {
+    console_puts("oscsh: rb-test: tree too high");
+    goto end;
+  }
+
+  // Deletions, interleaved to exercise every rebalancing case.
+
+  const uint64_t delete_start_ns = _shell_rb_test_get_time_ns();
+  for (size_t parity = 0; parity < 2; parity++) {
+    for (size_t key = parity; key < RB_TEST_N_KEYS; key += 2) {
+      rb_delete(&root, &key,
+                (int (*)(const void *, const void *, void *))_shell_rb_test_cmp,
+                NULL);
+    }
+    if (!_shell_rb_test_check(root, "delete"))
+      goto end;
+  }
+  const uint64_t delete_end_ns = _shell_rb_test_get_time_ns();
+
+  if (root) {
+    console_puts("oscsh: rb-test: tree not empty after deletions");
+    goto end;
+  }
+
+  console_printf("insert: %" PRIu64 " ns/op, search: %" PRIu64
+                 " ns/op, delete: %" PRIu64 " ns/op\n",
+                 (insert_end_ns - insert_start_ns) / RB_TEST_N_KEYS,
+                 (search_end_ns - search_start_ns) / RB_TEST_N_KEYS,
+                 (delete_end_ns - delete_start_ns) / RB_TEST_N_KEYS);
+  console_puts("rb-test: OK");
+
+end:
+  rb_drop(root, NULL);
+}
+
 static void _shell_cmd_not_found(const char *const cmd) {
   console_printf("oscsh: %s: command not found\n", cmd);
 }
@@ -662,6 +973,18 @@ void run_shell(void) {
       _shell_do_cmd_alloc_pages();
     } else if (strcmp(cmd_buf, "free-pages") == 0) {
       _shell_do_cmd_free_pages();
+    } else if (strcmp(cmd_buf, "malloc-stats") == 0) {
+      _shell_do_cmd_malloc_stats();
+    } else if (strcmp(cmd_buf, "page-stats") == 0) {
+      _shell_do_cmd_page_stats();
+    } else if (strcmp(cmd_buf, "sched-stats") == 0) {
+      _shell_do_cmd_sched_stats();
+    } else if (strcmp(cmd_buf, "ps") == 0) {
+      _shell_do_cmd_ps();
+    } else if (strcmp(cmd_buf, "lock-stats") == 0) {
+      _shell_do_cmd_lock_stats();
+    } else if (strcmp(cmd_buf, "rb-test") == 0) {
+      _shell_do_cmd_rb_test();
     } else if (strcmp(cmd_buf, "vfs-test-1") == 0) {
       _shell_do_cmd_vfs_test_1();
     } else if (strcmp(cmd_buf, "vfs-test-2") == 0) {
@@ -0,0 +1,69 @@
+#include "oscos/smp.h"
+
+#include <stdint.h>
+#include <stdnoreturn.h>
+
+#include "oscos/console.h"
+#include "oscos/mem/cache.h"
+#include "oscos/mem/vm.h"
+#include "oscos/sched.h"
+#include "oscos/timer/timeout.h"
+#include "oscos/utils/core-id.h"
+#include "oscos/utils/kernel-lock.h"
+#include "oscos/xcpt.h"
+
+#define SPIN_TABLE_PA ((pa_t)0xd8)
+
+// Symbol defined in `start.S`.
+extern char _secondary_start[];
+
+noreturn void secondary_main(void);
+
+/// \brief The initial stack pointers of the secondary cores.
+///
+/// Read by `_secondary_start`.
+uint64_t smp_secondary_init_sps[N_CORES];
+
+static thread_t *_secondary_idle_threads[N_CORES];
+static size_t _n_online_cores = 1;
+
+void smp_start_secondary_cores(void) {
+  for (size_t core_id = 1; core_id < N_CORES; core_id++) {
+    thread_t *const idle_thread = sched_create_idle_thread();
+    if (!idle_thread) {
+      console_printf("WARN: smp: Cannot start core %zu: out of memory\n",
+                     core_id);
+      continue;
+    }
+
+    _secondary_idle_threads[core_id] = idle_thread;
+    smp_secondary_init_sps[core_id] = idle_thread->ctx.kernel_sp;
+
+    // The core polls the spin table with the data cache disabled, so the
+    // release address must be written back to memory.
+    uint64_t *const release_addr =
+        pa_to_kernel_va(SPIN_TABLE_PA + core_id * sizeof(uint64_t));
+    *release_addr = kernel_va_to_pa(_secondary_start);
+    cache_clean_range(release_addr, sizeof(uint64_t));
+  }
+
+  // Wake up the cores waiting for events. `cache_clean_range` has already
+  // issued the barrier that orders the writes before the event.
+  __asm__ __volatile__("sev" : : : "memory");
+}
+
+size_t smp_get_n_online_cores(void) { return _n_online_cores; }
+
+noreturn void secondary_main(void) {
+  kernel_lock_acquire();
+
+  xcpt_set_vector_table();
+  sched_init_secondary_core(_secondary_idle_threads[get_core_id()]);
+  vm_init_secondary_core();
+  timeout_init();
+  _n_online_cores++;
+
+  sched_setup_periodic_scheduling();
+  XCPT_UNMASK_ALL();
+  idle();
+}
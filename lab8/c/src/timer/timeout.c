@@ -17,8 +17,9 @@ typedef struct {
   void *arg;
 } timeout_entry_t;
 
-static timeout_entry_t _timeout_entries[MAX_N_TIMEOUT_ENTRIES];
-static size_t _n_timeout_entries = 0;
+// Each core has a timeout queue of its own, served by its core timer.
+static timeout_entry_t _timeout_entries[N_CORES][MAX_N_TIMEOUT_ENTRIES];
+static size_t _n_timeout_entries[N_CORES];
 
 static int _timeout_entry_cmp_by_timestamp(const timeout_entry_t *const e1,
                                            const timeout_entry_t *const e2,
@@ -52,12 +53,18 @@ bool timeout_add_timer_ns(void (*const callback)(void *), void *const arg,
 
 bool timeout_add_timer_ticks(void (*const callback)(void *), void *const arg,
                              const uint64_t after_ticks) {
-  if (_n_timeout_entries == MAX_N_TIMEOUT_ENTRIES)
-    return false;
-
   uint64_t daif_val;
   CRITICAL_SECTION_ENTER(daif_val);
 
+  const size_t core_id = get_core_id();
+  timeout_entry_t *const timeout_entries = _timeout_entries[core_id];
+  size_t *const n_timeout_entries = &_n_timeout_entries[core_id];
+
+  if (*n_timeout_entries == MAX_N_TIMEOUT_ENTRIES) {
+    CRITICAL_SECTION_LEAVE(daif_val);
+    return false;
+  }
+
   uint64_t curr_timestamp;
   __asm__ __volatile__("mrs %0, cntpct_el0" : "=r"(curr_timestamp));
 
@@ -66,7 +73,7 @@ bool timeout_add_timer_ticks(void (*const callback)(void *), void *const arg,
   // Reprogram the timer.
 
   const bool need_timer_reprogramming =
-      _n_timeout_entries == 0 || timestamp < _timeout_entries[0].timestamp;
+      *n_timeout_entries == 0 || timestamp < timeout_entries[0].timestamp;
   if (need_timer_reprogramming) {
     __asm__ __volatile__("msr cntp_cval_el0, %0" : : "r"(timestamp));
   }
@@ -75,7 +82,7 @@ bool timeout_add_timer_ticks(void (*const callback)(void *), void *const arg,
 
   timeout_entry_t entry = {
       .timestamp = timestamp, .callback = callback, .arg = arg};
-  heappush(_timeout_entries, _n_timeout_entries++, sizeof(timeout_entry_t),
+  heappush(timeout_entries, (*n_timeout_entries)++, sizeof(timeout_entry_t),
            &entry,
            (int (*)(const void *, const void *,
                     void *))_timeout_entry_cmp_by_timestamp,
@@ -90,23 +97,27 @@ bool timeout_add_timer_ticks(void (*const callback)(void *), void *const arg,
 }
 
 void xcpt_core_timer_interrupt_handler(void) {
+  const size_t core_id = get_core_id();
+  timeout_entry_t *const timeout_entries = _timeout_entries[core_id];
+  size_t *const n_timeout_entries = &_n_timeout_entries[core_id];
+
   // Remove the top entry from the timeout queue.
 
   timeout_entry_t top_entry;
-  heappop(_timeout_entries, _n_timeout_entries--, sizeof(timeout_entry_t),
+  heappop(timeout_entries, (*n_timeout_entries)--, sizeof(timeout_entry_t),
           &top_entry,
           (int (*)(const void *, const void *,
                    void *))_timeout_entry_cmp_by_timestamp,
           NULL);
 
   // Reprogram the timer.
-  if (_n_timeout_entries == 0) {
+  if (*n_timeout_entries == 0) {
     // Disable the core timer interrupt. (ENABLE = 1, IMASK = 1)
     __asm__ __volatile__("msr cntp_ctl_el0, %0" : : "r"(0x3));
   } else {
     __asm__ __volatile__("msr cntp_cval_el0, %0"
                          :
-                         : "r"(_timeout_entries[0].timestamp));
+                         : "r"(timeout_entries[0].timestamp));
   }
 
   // Execute the callback.
@@ -0,0 +1,103 @@
+#include "oscos/utils/lock.h"
+
+#include <stdint.h>
+
+void spin_lock_init(spinlock_t *const lock, const char *const name) {
+  *lock = (spinlock_t){0};
+#ifdef LOCK_ENABLE_STATS
+  lock_stats_register(&lock->stats, name);
+#else
+  (void)name;
+#endif
+}
+
+void rwlock_init(rwlock_t *const lock, const char *const name) {
+  *lock = (rwlock_t){0};
+#ifdef LOCK_ENABLE_STATS
+  lock_stats_register(&lock->stats, name);
+#else
+  (void)name;
+#endif
+}
+
+void seqlock_init(seqlock_t *const lock, const char *const name) {
+  spin_lock_init(&lock->lock, name);
+  lock->seq = 0;
+}
+
+#ifdef LOCK_ENABLE_STATS
+
+// The registry itself is protected by an unnamed spinlock, which is not
+// registered.
+static spinlock_t _registry_lock;
+static lock_stats_t *_registry;
+
+/// \brief Atomically adds to a counter.
+///
+/// Readers of a reader-writer lock update its statistics concurrently.
+static void _atomic_add(uint64_t *const counter, const uint64_t value) {
+  uint64_t new_val;
+  uint32_t status;
+  __asm__ __volatile__("1: ldxr %0, %2\n"
+                       "   add %0, %0, %3\n"
+                       "   stxr %w1, %0, %2\n"
+                       "   cbnz %w1, 1b"
+                       : "=&r"(new_val), "=&r"(status), "+Q"(*counter)
+                       : "r"(value));
+}
+
+void lock_stats_register(lock_stats_t *const stats, const char *const name) {
+  stats->name = name;
+
+  const uint64_t daif_val = spin_lock_irqsave(&_registry_lock);
+  stats->next = _registry;
+  _registry = stats;
+  spin_unlock_irqrestore(&_registry_lock, daif_val);
+}
+
+uint64_t lock_stats_now(void) {
+  uint64_t timestamp;
+  __asm__ __volatile__("mrs %0, cntpct_el0" : "=r"(timestamp));
+  return timestamp;
+}
+
+void lock_stats_record_acquisition(lock_stats_t *const stats,
+                                   const bool is_contended,
+                                   const uint64_t wait_start) {
+  _atomic_add(&stats->n_acquisitions, 1);
+  if (is_contended) {
+    _atomic_add(&stats->n_contended, 1);
+    _atomic_add(&stats->wait_ticks, lock_stats_now() - wait_start);
+  }
+}
+
+void lock_stats_record_release(lock_stats_t *const stats,
+                               const uint64_t acquired_at) {
+  // Only the exclusive holder gets here.
+  const uint64_t hold_ticks = lock_stats_now() - acquired_at;
+  stats->hold_ticks += hold_ticks;
+  if (hold_ticks > stats->max_hold_ticks) {
+    stats->max_hold_ticks = hold_ticks;
+  }
+}
+
+void lock_stats_for_each(void (*const callback)(const lock_stats_t *stats,
+                                                void *arg),
+                         void *const arg) {
+  const uint64_t daif_val = spin_lock_irqsave(&_registry_lock);
+  for (const lock_stats_t *stats = _registry; stats; stats = stats->next) {
+    callback(stats, arg);
+  }
+  spin_unlock_irqrestore(&_registry_lock, daif_val);
+}
+
+#else
+
+void lock_stats_for_each(void (*const callback)(const lock_stats_t *stats,
+                                                void *arg),
+                         void *const arg) {
+  (void)callback;
+  (void)arg;
+}
+
+#endif
@@ -3,7 +3,31 @@
 #include "oscos/libc/string.h"
 #include "oscos/mem/malloc.h"
 
-// TODO: Properly implement a red-black tree.
+// A red-black tree without parent pointers.
+//
+// Nodes do not store parent pointers, so that the node layout seen by code
+// that walks the tree directly stays the same. Instead, insertion and deletion
+// record the path from the root to the node of interest on the stack and walk
+// back up along it when rebalancing. The path is bounded by `RB_MAX_HEIGHT`.
+
+static bool _rb_is_red(const rb_node_t *const node) {
+  return node && node->colour == RB_NC_RED;
+}
+
+/// \brief Gets the link pointing to the node at the given depth of a path.
+static rb_node_t **_rb_link(rb_node_t **const root, rb_node_t *const path[],
+                            const unsigned char dirs[], const size_t depth) {
+  return depth == 0 ? root : &path[depth - 1]->children[dirs[depth - 1]];
+}
+
+/// \brief Rotates the subtree pointed to by \p link.
+/// \param dir The direction of the rotation. 0 for left and 1 for right.
+static void _rb_rotate(rb_node_t **const link, const size_t dir) {
+  rb_node_t *const node = *link, *const child = node->children[!dir];
+  node->children[!dir] = child->children[dir];
+  child->children[dir] = node;
+  *link = child;
+}
 
 rb_node_t *rb_clone(const rb_node_t *const root, const size_t size,
                     bool (*const cloner)(void *dst, const void *src),
@@ -36,6 +60,7 @@ rb_node_t *rb_clone(const rb_node_t *const root, const size_t size,
   } else {
     memcpy(new_root->payload, root->payload, size);
   }
+  new_root->colour = root->colour;
 
   return new_root;
 }
@@ -99,66 +124,228 @@ rb_successor(const rb_node_t *const root, const void *const restrict key,
   return result ? result->payload : NULL;
 }
 
-bool rb_insert(rb_node_t **const root, const size_t size,
-               const void *const restrict item,
-               int (*const compar)(const void *, const void *, void *),
-               void *const arg) {
-  rb_node_t **curr = root;
-  while (*curr) {
-    const int compar_result = compar(item, (*curr)->payload, arg);
+/// \brief Finds the path to the node holding an item.
+/// \return The node, or NULL if there is none, in which case the path leads to
+///         where the item would be inserted.
+static rb_node_t *
+_rb_find_path(rb_node_t **const root, const void *const restrict key,
+              int (*const compar)(const void *, const void *, void *),
+              void *const arg, rb_node_t *path[], unsigned char dirs[],
+              size_t *const depth) {
+  *depth = 0;
+
+  rb_node_t *curr = *root;
+  while (curr) {
+    const int compar_result = compar(key, curr->payload, arg);
     if (compar_result == 0)
       break;
-    curr = &(*curr)->children[compar_result > 0];
+
+    path[*depth] = curr;
+    dirs[*depth] = compar_result > 0;
+    (*depth)++;
+    curr = curr->children[compar_result > 0];
   }
 
-  if (!*curr) {
-    *curr = malloc(sizeof(rb_node_t) + size);
-    if (!*curr)
-      return false;
+  return curr;
+}
 
-    (*curr)->children[0] = (*curr)->children[1] = NULL;
+/// \brief Links a new node at the end of a path found by \ref _rb_find_path
+///        and restores the invariants.
+static void _rb_link_new_node(rb_node_t **const root, rb_node_t *path[],
+                              unsigned char dirs[], size_t depth,
+                              rb_node_t *const new_node) {
+  new_node->children[0] = new_node->children[1] = NULL;
+  new_node->colour = RB_NC_RED;
+  *_rb_link(root, path, dirs, depth) = new_node;
+
+  // Restore the invariants. `path[0..depth)` are the ancestors of the current
+  // node, which is red.
+
+  while (depth > 0 && _rb_is_red(path[depth - 1])) {
+    // The parent is red and is therefore not the root.
+    rb_node_t *const parent = path[depth - 1],
+                     *const grandparent = path[depth - 2];
+    const size_t parent_dir = dirs[depth - 2];
+    rb_node_t *const uncle = grandparent->children[!parent_dir];
+
+    if (_rb_is_red(uncle)) {
+      parent->colour = uncle->colour = RB_NC_BLACK;
+      grandparent->colour = RB_NC_RED;
+      depth -= 2;
+      continue;
+    }
+
+    rb_node_t *top = parent;
+    if (dirs[depth - 1] != parent_dir) { // Inner child.
+      top = parent->children[!parent_dir];
+      _rb_rotate(&grandparent->children[parent_dir], parent_dir);
+    }
+    _rb_rotate(_rb_link(root, path, dirs, depth - 2), !parent_dir);
+    top->colour = RB_NC_BLACK;
+    grandparent->colour = RB_NC_RED;
+    break;
+  }
+
+  (*root)->colour = RB_NC_BLACK;
+}
+
+bool rb_insert(rb_node_t **const root, const size_t size,
+               const void *const restrict item,
+               int (*const compar)(const void *, const void *, void *),
+               void *const arg) {
+  rb_node_t *path[RB_MAX_HEIGHT];
+  unsigned char dirs[RB_MAX_HEIGHT];
+  size_t depth;
+
+  rb_node_t *const node =
+      _rb_find_path(root, item, compar, arg, path, dirs, &depth);
+  if (node) { // Replace the existing item.
+    memcpy(node->payload, item, size);
+    return true;
   }
 
-  memcpy((*curr)->payload, item, size);
+  rb_node_t *const new_node = malloc(sizeof(rb_node_t) + size);
+  if (!new_node)
+    return false;
+
+  memcpy(new_node->payload, item, size);
+  _rb_link_new_node(root, path, dirs, depth, new_node);
 
   return true;
 }
 
-static rb_node_t **_rb_minimum(rb_node_t **const node) {
-  rb_node_t **curr = node;
-  while ((*curr)->children[0]) {
-    curr = &(*curr)->children[0];
-  }
-  return curr;
+void rb_insert_node(rb_node_t **const root, rb_node_t *const node,
+                    int (*const compar)(const void *, const void *, void *),
+                    void *const arg) {
+  rb_node_t *path[RB_MAX_HEIGHT];
+  unsigned char dirs[RB_MAX_HEIGHT];
+  size_t depth;
+
+  _rb_find_path(root, node->payload, compar, arg, path, dirs, &depth);
+  _rb_link_new_node(root, path, dirs, depth, node);
 }
 
 void rb_delete(rb_node_t **const root, const void *const restrict key,
                int (*const compar)(const void *, const void *, void *),
                void *const arg) {
-  rb_node_t **curr = root;
-  while (*curr) {
-    const int compar_result = compar(key, (*curr)->payload, arg);
-    if (compar_result == 0)
-      break;
-    curr = &(*curr)->children[compar_result > 0];
+  free(rb_remove_node(root, key, compar, arg));
+}
+
+rb_node_t *rb_remove_node(rb_node_t **const root,
+                          const void *const restrict key,
+                          int (*const compar)(const void *, const void *,
+                                              void *),
+                          void *const arg) {
+  // The fix-up may push one extra node onto the path.
+  rb_node_t *path[RB_MAX_HEIGHT + 1];
+  unsigned char dirs[RB_MAX_HEIGHT + 1];
+  size_t depth;
+
+  rb_node_t *const node =
+      _rb_find_path(root, key, compar, arg, path, dirs, &depth);
+  if (!node)
+    return NULL;
+
+  // If the node has two children, swap it with its successor, so that the node
+  // to unlink has at most one child. The payload size is unknown here, so the
+  // nodes themselves are swapped.
+
+  if (node->children[0] && node->children[1]) {
+    const size_t node_depth = depth;
+
+    path[depth] = node;
+    dirs[depth] = 1;
+    depth++;
+    rb_node_t *successor = node->children[1];
+    while (successor->children[0]) {
+      path[depth] = successor;
+      dirs[depth] = 0;
+      depth++;
+      successor = successor->children[0];
+    }
+
+    rb_node_t *const successor_right = successor->children[1];
+    successor->children[0] = node->children[0];
+    if (depth == node_depth + 1) { // The successor is the right child.
+      successor->children[1] = node;
+    } else {
+      successor->children[1] = node->children[1];
+      path[depth - 1]->children[0] = node;
+    }
+    node->children[0] = NULL;
+    node->children[1] = successor_right;
+    *_rb_link(root, path, dirs, node_depth) = successor;
+
+    const rb_node_colour_t colour = node->colour;
+    node->colour = successor->colour;
+    successor->colour = colour;
+
+    path[node_depth] = successor;
   }
 
-  rb_node_t *const curr_node = *curr;
-  if (!curr_node->children[0]) {
-    *curr = curr_node->children[1];
-  } else if (!curr_node->children[1]) {
-    *curr = curr_node->children[0];
-  } else {
-    rb_node_t **const min_right = _rb_minimum(&curr_node->children[1]),
-                      *const min_right_node = *min_right;
+  // Unlink the node.
+
+  rb_node_t *const child = node->children[node->children[0] ? 0 : 1];
+  *_rb_link(root, path, dirs, depth) = child;
+
+  if (node->colour != RB_NC_BLACK)
+    return node;
+  if (_rb_is_red(child)) {
+    child->colour = RB_NC_BLACK;
+    return node;
+  }
+
+  // Restore the invariants. The subtree at `depth` is short of one black node.
+
+  while (depth > 0) {
+    rb_node_t *const parent = path[depth - 1];
+    const size_t dir = dirs[depth - 1];
+    rb_node_t *sibling = parent->children[!dir];
+
+    if (_rb_is_red(sibling)) {
+      _rb_rotate(_rb_link(root, path, dirs, depth - 1), dir);
+      sibling->colour = RB_NC_BLACK;
+      parent->colour = RB_NC_RED;
+
+      path[depth - 1] = sibling;
+      path[depth] = parent;
+      dirs[depth] = dir;
+      depth++;
+
+      sibling = parent->children[!dir];
+    }
+
+    if (!_rb_is_red(sibling->children[0]) &&
+        !_rb_is_red(sibling->children[1])) {
+      sibling->colour = RB_NC_RED;
+      if (parent->colour == RB_NC_RED) {
+        parent->colour = RB_NC_BLACK;
+        return node;
+      }
+      depth--;
+      continue;
+    }
+
+    if (!_rb_is_red(sibling->children[!dir])) {
+      rb_node_t *const inner = sibling->children[dir];
+      _rb_rotate(&parent->children[!dir], !dir);
+      inner->colour = RB_NC_BLACK;
+      sibling->colour = RB_NC_RED;
+      sibling = inner;
+    }
+
+    _rb_rotate(_rb_link(root, path, dirs, depth - 1), dir);
+    sibling->colour = parent->colour;
+    parent->colour = RB_NC_BLACK;
+    sibling->children[!dir]->colour = RB_NC_BLACK;
+    return node;
+  }
 
-    *min_right = min_right_node->children[1];
-    *curr = min_right_node;
-    min_right_node->children[0] = curr_node->children[0];
-    min_right_node->children[1] = curr_node->children[1];
+  if (*root) {
+    (*root)->colour = RB_NC_BLACK;
   }
 
-  free(curr_node);
+  return node;
 }
 
 void rb_drop(rb_node_t *root, void (*deleter)(void *payload)) {
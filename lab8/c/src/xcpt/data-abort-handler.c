@@ -1,6 +1,7 @@
 #include "oscos/console.h"
 #include "oscos/panic.h"
 #include "oscos/sched.h"
+#include "oscos/xcpt.h"
 
 void xcpt_default_handler(uint64_t vten);
 
@@ -11,11 +12,25 @@ void xcpt_data_abort_handler(const uint64_t esr_val) {
   void *fault_addr;
   __asm__ __volatile__("mrs %0, far_el1" : "=r"(fault_addr));
 
+  // Handling the fault may sleep on file I/O, during which other threads
+  // clobber spsr_el1 and elr_el1. Save them, and let interrupts in if the
+  // faulting context did.
+  uint64_t spsr_val, elr_val;
+  __asm__ __volatile__("mrs %0, spsr_el1" : "=r"(spsr_val));
+  __asm__ __volatile__("mrs %0, elr_el1" : "=r"(elr_val));
+  if (!(spsr_val & (1 << 7))) {
+    XCPT_UNMASK_ALL();
+  }
+
   const uint64_t dfsc = esr_val & ((1 << 6) - 1);
 
+  const bool wnr = esr_val & (1 << 6);
+
   if (dfsc >> 2 == 0x1) { // Translation fault.
-    const vm_map_page_result_t result =
-        vm_map_page(&curr_process->addr_space, fault_addr);
+    mutex_lock(&curr_process->addr_space_lock);
+    const vm_map_page_result_t result = vm_map_page(
+        &curr_process->addr_space, fault_addr, wnr ? PROT_WRITE : PROT_READ);
+    mutex_unlock(&curr_process->addr_space_lock);
     if (result == VM_MAP_PAGE_SEGV) {
 #ifdef VM_ENABLE_DEBUG_LOG
       console_printf("DEBUG: vm: Segmentation fault, PID %zu, address 0x%p\n",
@@ -32,9 +47,10 @@ void xcpt_data_abort_handler(const uint64_t esr_val) {
 #endif
     }
   } else if (dfsc >> 2 == 0x3) { // Permission fault.
-    const bool wnr = esr_val & (1 << 6);
+    mutex_lock(&curr_process->addr_space_lock);
     const vm_map_page_result_t result = vm_handle_permission_fault(
         &curr_process->addr_space, fault_addr, wnr ? PROT_WRITE : PROT_READ);
+    mutex_unlock(&curr_process->addr_space_lock);
     if (result == VM_MAP_PAGE_SEGV) {
 #ifdef VM_ENABLE_DEBUG_LOG
       console_printf("DEBUG: vm: Segmentation fault, PID %zu, address 0x%p\n",
@@ -53,4 +69,8 @@ void xcpt_data_abort_handler(const uint64_t esr_val) {
   } else {
     xcpt_default_handler(8);
   }
+
+  XCPT_MASK_ALL();
+  __asm__ __volatile__("msr spsr_el1, %0" : : "r"(spsr_val));
+  __asm__ __volatile__("msr elr_el1, %0" : : "r"(elr_val));
 }
@@ -0,0 +1,8 @@
+#include "oscos/sched.h"
+
+void xcpt_fp_simd_access_handler(void) {
+  if (!thread_fp_simd_acquire()) {
+    // For a lack of better things to do.
+    thread_exit();
+  }
+}
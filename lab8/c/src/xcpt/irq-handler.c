@@ -11,10 +11,10 @@
 void xcpt_irq_handler(void) {
   PERIPHERAL_READ_BARRIER();
 
-  const size_t core_id = get_core_id();
-
   for (;;) {
-    const uint32_t int_src = l1ic_get_int_src(core_id);
+    // The timer callbacks may switch threads, and the current thread may resume
+    // on another core.
+    const uint32_t int_src = l1ic_get_int_src(get_core_id());
 
     if (int_src == 0)
       break;
@@ -14,8 +14,6 @@ int sys_exec(const char *const name, char *const argv[const]) {
   if (open_result < 0)
     return open_result;
 
-  exec(user_program_file);
-
-  // If execution reaches here, then exec failed.
-  return -ENOMEM;
+  // If execution returns, then exec failed.
+  return exec(user_program_file);
 }
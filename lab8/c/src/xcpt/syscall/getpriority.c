@@ -0,0 +1,17 @@
+#include "oscos/sched.h"
+#include "oscos/uapi/errno.h"
+#include "oscos/uapi/sys/resource.h"
+
+int sys_getpriority(const int which, const int who) {
+  if (which != PRIO_PROCESS)
+    return -EINVAL;
+
+  process_t *const process =
+      who == 0 ? current_thread()->process : get_process_by_id(who);
+  if (!process)
+    return -ESRCH;
+
+  // Like Linux, return 20 - nice, which is always positive and thus never
+  // mistaken for an error number.
+  return 20 - sched_get_nice(process);
+}
@@ -28,6 +28,9 @@ int sys_mbox_call(const unsigned char ch, unsigned int *const mbox) {
     return /* -EINVAL */ 0;
 
   const size_t mbox_len = mbox[0];
+  if (mbox_len > MAILBOX_MAX_MESSAGE_SIZE)
+    return /* -EINVAL */ 0;
+
   uint32_t *const mbox_kernel = malloc(mbox_len);
   memcpy(mbox_kernel, mbox, mbox_len);
 
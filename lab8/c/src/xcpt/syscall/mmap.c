@@ -1,5 +1,7 @@
 #include <stddef.h>
+#include <stdint.h>
 
+#include "oscos/fs/vfs.h"
 #include "oscos/mem/page-alloc.h"
 #include "oscos/mem/vm.h"
 #include "oscos/sched.h"
@@ -7,25 +9,70 @@
 #include "oscos/utils/align.h"
 
 void *sys_mmap(void *const addr, const size_t len, const int prot,
-               const int flags, const int fd, const int file_offset) {
-  (void)flags;
-  (void)fd;
-  (void)file_offset;
-
+               const int flags, const int fd, const long file_offset) {
   process_t *const curr_process = current_thread()->process;
 
+  // A negative file descriptor also requests an anonymous mapping, for the
+  // sake of programs that predate `MAP_ANONYMOUS`.
+  const bool is_anonymous = flags & MAP_ANONYMOUS || fd < 0;
+
+  mem_region_t mem_region = {.len = ALIGN(len, 1 << PAGE_ORDER),
+                             .type = MEM_REGION_ANONYMOUS,
+                             .prot = prot};
+
+  if (!is_anonymous) {
+    if (!(flags & MAP_SHARED) == !(flags & MAP_PRIVATE))
+      return (void *)-EINVAL;
+    if (file_offset < 0 || file_offset & ((1 << PAGE_ORDER) - 1))
+      return (void *)-EINVAL;
+    if (!(fd < N_FDS && curr_process->fds[fd]))
+      return (void *)-EBADF;
+
+    struct vnode *const vnode = curr_process->fds[fd]->file->vnode;
+    if (!vfs_is_regular(vnode))
+      return (void *)-ENODEV;
+    // Pages written through the mapping could never be written back.
+    if (flags & MAP_SHARED && prot & PROT_WRITE && vnode->mount->is_read_only)
+      return (void *)-EACCES;
+
+    // The mapping gets its own file, so that faulting pages in does not move
+    // the file position of the file descriptor.
+    struct file *file;
+    const int open_result = vfs_open_vnode(vnode, &file);
+    if (open_result < 0)
+      return (void *)(long)open_result;
+
+    shared_file_t *const backing_file = shared_file_new(file);
+    if (!backing_file) {
+      vfs_close(file);
+      return (void *)-ENOMEM;
+    }
+
+    mem_region.type = MEM_REGION_BACKED;
+    mem_region.backing_file = backing_file;
+    mem_region.file_offset = file_offset;
+    mem_region.file_len = SIZE_MAX;
+    mem_region.flags = flags & (MAP_SHARED | MAP_PRIVATE);
+  }
+
   void *const mmap_addr =
       vm_decide_mmap_addr(curr_process->addr_space, addr, len);
   if (!mmap_addr) {
+    if (mem_region.type == MEM_REGION_BACKED) {
+      shared_file_drop(mem_region.backing_file);
+    }
     return (void *)-EINVAL;
   }
 
-  const mem_region_t mem_region = {.start = mmap_addr,
-                                   .len = ALIGN(len, 1 << PAGE_ORDER),
-                                   .type = MEM_REGION_ANONYMOUS,
-                                   .prot = prot};
-  vm_mem_regions_insert_region(&curr_process->addr_space.mem_regions,
-                               &mem_region);
+  mem_region.start = mmap_addr;
+  const int insert_result = vm_mem_regions_insert_region(
+      &curr_process->addr_space.mem_regions, &mem_region);
+  if (insert_result < 0) {
+    if (mem_region.type == MEM_REGION_BACKED) {
+      shared_file_drop(mem_region.backing_file);
+    }
+    return (void *)(long)insert_result;
+  }
 
   return mmap_addr;
 }
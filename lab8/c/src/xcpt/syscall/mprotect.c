@@ -0,0 +1,23 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "oscos/mem/page-alloc.h"
+#include "oscos/mem/vm.h"
+#include "oscos/sched.h"
+#include "oscos/uapi/errno.h"
+#include "oscos/utils/align.h"
+
+int sys_mprotect(void *const addr, const size_t len, const int prot) {
+  if ((uintptr_t)addr & ((1 << PAGE_ORDER) - 1) ||
+      (uintptr_t)addr >= VM_USER_VA_END ||
+      len > VM_USER_VA_END - (uintptr_t)addr ||
+      prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))
+    return -EINVAL;
+  if (len == 0)
+    return 0;
+
+  process_t *const curr_process = current_thread()->process;
+
+  return vm_protect_range(&curr_process->addr_space, addr,
+                          ALIGN(len, 1 << PAGE_ORDER), prot);
+}
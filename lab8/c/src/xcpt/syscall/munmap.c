@@ -0,0 +1,20 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "oscos/mem/page-alloc.h"
+#include "oscos/mem/vm.h"
+#include "oscos/sched.h"
+#include "oscos/uapi/errno.h"
+#include "oscos/utils/align.h"
+
+int sys_munmap(void *const addr, const size_t len) {
+  if ((uintptr_t)addr & ((1 << PAGE_ORDER) - 1) || len == 0 ||
+      (uintptr_t)addr >= VM_USER_VA_END ||
+      len > VM_USER_VA_END - (uintptr_t)addr)
+    return -EINVAL;
+
+  process_t *const curr_process = current_thread()->process;
+
+  return vm_unmap_range(&curr_process->addr_space, addr,
+                        ALIGN(len, 1 << PAGE_ORDER));
+}
@@ -0,0 +1,19 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "oscos/sched.h"
+#include "oscos/uapi/errno.h"
+
+int sys_sched_setaffinity(const int pid, const size_t cpusetsize,
+                          const uint64_t *const mask) {
+  if (cpusetsize < sizeof(uint64_t) || (uintptr_t)mask & 0x7)
+    return -EINVAL;
+
+  process_t *const process =
+      pid == 0 ? current_thread()->process : get_process_by_id(pid);
+  if (!process)
+    return -ESRCH;
+
+  // Only the first word matters, since there are fewer cores than bits in it.
+  return sched_set_affinity(process, *mask);
+}
@@ -0,0 +1,17 @@
+#include "oscos/sched.h"
+#include "oscos/uapi/errno.h"
+#include "oscos/uapi/sys/resource.h"
+
+int sys_setpriority(const int which, const int who, const int prio) {
+  // There are no process groups or users.
+  if (which != PRIO_PROCESS)
+    return -EINVAL;
+
+  process_t *const process =
+      who == 0 ? current_thread()->process : get_process_by_id(who);
+  if (!process)
+    return -ESRCH;
+
+  sched_set_nice(process, prio);
+  return 0;
+}
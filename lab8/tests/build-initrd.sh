@@ -1,5 +1,13 @@
 #!/bin/sh -e
 
+# With `-a`, file data in the archive is page-aligned, so that the kernel can
+# map it into user programs without copying.
+
+page_align=
+if [ "$1" = -a ]; then
+    page_align=1
+fi
+
 rm -rf rootfs
 
 mkdir rootfs
@@ -11,3 +19,8 @@ find . -mindepth 1 | cpio -o -H newc > ../initramfs.cpio
 
 cd ..
 rm -r rootfs
+
+if [ -n "$page_align" ]; then
+    ./page-align-cpio.py initramfs.cpio initramfs.cpio.tmp
+    mv initramfs.cpio.tmp initramfs.cpio
+fi
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Page-aligns the file data of a New ASCII Format CPIO archive.
+
+The kernel maps page-aligned file data of the initial ramdisk directly into
+user programs instead of copying it. cpio(1) aligns file data to 4 bytes only,
+so this script pads the pathname of each regular file with NUL bytes until its
+data starts at a multiple of the page size, relative to the start of the
+archive. The initial ramdisk must itself be loaded at a page-aligned address.
+
+Usage: page-align-cpio.py INPUT OUTPUT
+"""
+
+import sys
+
+PAGE_SIZE = 4096
+HEADER_LEN = 110
+FIELD_NAMES = ("ino", "mode", "uid", "gid", "nlink", "mtime", "filesize",
+               "devmajor", "devminor", "rdevmajor", "rdevminor", "namesize",
+               "check")
+
+
+def align(x, a):
+    return (x + a - 1) // a * a
+
+
+def parse_entries(archive):
+    offset = 0
+    while True:
+        magic = archive[offset:offset + 6]
+        if magic not in (b"070701", b"070702"):
+            sys.exit(f"bad cpio magic at offset {offset}")
+
+        fields = {}
+        for i, name in enumerate(FIELD_NAMES):
+            start = offset + 6 + 8 * i
+            fields[name] = int(archive[start:start + 8], 16)
+
+        name_start = offset + HEADER_LEN
+        pathname = archive[name_start:name_start + fields["namesize"]]
+        pathname = pathname.split(b"\0", 1)[0]
+        data_start = align(name_start + fields["namesize"], 4)
+        data = archive[data_start:data_start + fields["filesize"]]
+
+        yield magic, fields, pathname, data
+
+        if pathname == b"TRAILER!!!":
+            return
+        offset = align(data_start + fields["filesize"], 4)
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__.strip().splitlines()[-1])
+
+    with open(sys.argv[1], "rb") as f:
+        archive = f.read()
+
+    out = bytearray()
+    for magic, fields, pathname, data in parse_entries(archive):
+        namesize = len(pathname) + 1
+        if data:
+            data_start = align(len(out) + HEADER_LEN + namesize, PAGE_SIZE)
+            namesize = data_start - (len(out) + HEADER_LEN)
+        fields["namesize"] = namesize
+
+        out += magic
+        for name in FIELD_NAMES:
+            out += b"%08X" % fields[name]
+        out += pathname.ljust(namesize, b"\0")
+        out += b"\0" * (align(len(out), 4) - len(out))
+        out += data
+        out += b"\0" * (align(len(out), 4) - len(out))
+
+    out += b"\0" * (align(len(out), 512) - len(out))
+
+    with open(sys.argv[2], "wb") as f:
+        f.write(out)
+
+
+if __name__ == "__main__":
+    main()
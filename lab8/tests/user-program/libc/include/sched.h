@@ -0,0 +1,19 @@
+#ifndef OSCOS_USER_PROGRAM_LIBC_SCHED_H
+#define OSCOS_USER_PROGRAM_LIBC_SCHED_H
+
+#include <stddef.h>
+
+#include "unistd.h"
+
+typedef struct {
+  unsigned long bits[1];
+} cpu_set_t;
+
+#define CPU_ZERO(SET) ((SET)->bits[0] = 0)
+#define CPU_SET(CPU, SET) ((SET)->bits[0] |= 1UL << (CPU))
+#define CPU_CLR(CPU, SET) ((SET)->bits[0] &= ~(1UL << (CPU)))
+#define CPU_ISSET(CPU, SET) (((SET)->bits[0] >> (CPU)) & 1)
+
+int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *mask);
+
+#endif
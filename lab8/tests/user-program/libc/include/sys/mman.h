@@ -0,0 +1,13 @@
+#ifndef OSCOS_USER_PROGRAM_LIBC_SYS_MMAN_H
+#define OSCOS_USER_PROGRAM_LIBC_SYS_MMAN_H
+
+#include <stddef.h>
+
+#include "../oscos-uapi/sys/mman.h"
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd,
+           long offset);
+int munmap(void *addr, size_t length);
+int mprotect(void *addr, size_t length, int prot);
+
+#endif
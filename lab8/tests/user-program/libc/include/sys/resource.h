@@ -0,0 +1,9 @@
+#ifndef OSCOS_USER_PROGRAM_LIBC_SYS_RESOURCE_H
+#define OSCOS_USER_PROGRAM_LIBC_SYS_RESOURCE_H
+
+#include "../oscos-uapi/sys/resource.h"
+
+int getpriority(int which, int who);
+int setpriority(int which, int who, int prio);
+
+#endif
@@ -27,6 +27,8 @@ long lseek64(int fd, long offset, int whence);
 
 void sync(void);
 
+int nice(int inc);
+
 long syscall(long number, ...);
 
 #endif
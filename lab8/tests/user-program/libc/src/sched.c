@@ -0,0 +1,8 @@
+#include "sched.h"
+
+#include "sys/syscall.h"
+
+int sched_setaffinity(const pid_t pid, const size_t cpusetsize,
+                      const cpu_set_t *const mask) {
+  return syscall(SYS_sched_setaffinity, pid, cpusetsize, mask);
+}
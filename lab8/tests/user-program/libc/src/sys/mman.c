@@ -0,0 +1,17 @@
+#include "sys/mman.h"
+
+#include "sys/syscall.h"
+#include "unistd.h"
+
+void *mmap(void *const addr, const size_t length, const int prot,
+           const int flags, const int fd, const long offset) {
+  return (void *)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+}
+
+int munmap(void *const addr, const size_t length) {
+  return syscall(SYS_munmap, addr, length);
+}
+
+int mprotect(void *const addr, const size_t length, const int prot) {
+  return syscall(SYS_mprotect, addr, length, prot);
+}
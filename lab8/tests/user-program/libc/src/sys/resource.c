@@ -0,0 +1,14 @@
+#include "sys/resource.h"
+
+#include "sys/syscall.h"
+#include "unistd.h"
+
+int getpriority(const int which, const int who) {
+  // The system call returns 20 - nice to tell it apart from error numbers.
+  const int result = syscall(SYS_getpriority, which, who);
+  return result < 0 ? result : 20 - result;
+}
+
+int setpriority(const int which, const int who, const int prio) {
+  return syscall(SYS_setpriority, which, who, prio);
+}
@@ -1,5 +1,7 @@
 #include "unistd.h"
 
+#include "errno.h"
+#include "sys/resource.h"
 #include "sys/syscall.h"
 
 pid_t getpid(void) { return syscall(SYS_getpid); }
@@ -35,3 +37,15 @@ long lseek64(const int fd, const long offset, const int whence) {
 }
 
 void sync(void) { syscall(SYS_sync); }
+
+int nice(const int inc) {
+  // A nice value of -1 is indistinguishable from failure but by errno.
+  errno = 0;
+  const int old_nice = getpriority(PRIO_PROCESS, 0);
+  if (old_nice == -1 && errno != 0)
+    return -1;
+
+  if (setpriority(PRIO_PROCESS, 0, old_nice + inc) == -1)
+    return -1;
+  return getpriority(PRIO_PROCESS, 0);
+}